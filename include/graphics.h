@@ -3,9 +3,10 @@
 #include "util/tgaImage.h"
 #include "util//geometry.h"
 
-extern Matrix4x4 View;
-extern Matrix4x4 Viewport;
-extern Matrix4x4 Projection;
+// per thread, so independent renders (e.g. concurrent service jobs) do not share transform state
+extern thread_local Matrix4x4 View;
+extern thread_local Matrix4x4 Viewport;
+extern thread_local Matrix4x4 Projection;
 const float depth = 2000.f;
 constexpr float PI = 3.14159265358979323846f;
 
@@ -14,9 +15,66 @@ void projection(float coeff = 0.f); // coeff = -1/c
 void lookat(Vec3f eye, Vec3f center, Vec3f up);
 
 struct IShader {
+    static constexpr int MaxVaryings = 8;
+
+    int nvaryings = 0;               // how many entries of vary_out the shader uses
+    float vary_out[3][MaxVaryings];  // per-vertex varyings, set by vs, interpolated perspective correctly for ps
+
     virtual ~IShader() = default;
     virtual Vec4f vertex(const int& faceIdx, const int& nthvert) = 0;
-    virtual bool fragment(const Vec3f& viewCoord, const Vec3f bar, TGAColor& outColor) const = 0;
+    // batched path: the position was already transformed by transform_vertices(), only set up the varyings
+    virtual void attributes(const int& faceIdx, const int& nthvert, const Vec4f& screenCoord) {}
+    // bar and varying[] are perspective correct, viewCoord is the screen position and depth
+    virtual bool fragment(const Vec3f& viewCoord, const Vec3f bar, const float varying[], TGAColor& outColor) const = 0;
+};
+
+// inclusive pixel rectangle, empty when x0 > x1 or y0 > y1
+struct Rect {
+    int x0, y0, x1, y1;
+
+    bool empty() const { return x0 > x1 || y0 > y1; }
+};
+
+class DepthBuffer;
+class MultisampleBuffer;
+
+// Edge functions E_i (proportional to the barycentric of vertex i) are evaluated in double, they stay exact for the
+// integer corners so neighbouring triangles never crack. The test is inclusive (E_i >= 0, no top-left rule), so pixels
+// exactly on a shared edge are covered by both triangles; the strict depth test keeps the first one drawn where both
+// give the same depth. All other values are plane equations
+// a * x + (b * y + c) set up once per triangle. They are evaluated from a per-row base only for pixels that need
+// them, so a value never depends on where the span started (scissored redraws match full frames) and a depth plane
+// stored in a compressed tile reproduces exactly what the per-pixel path would have written.
+struct TriangleSetup {
+    static constexpr int MaxPlanes = 4 + IShader::MaxVaryings;  // z, b_i / w_i for the corners, varying_k / w
+
+    double edx[3], edy[3], ec[3];
+    float pdx[MaxPlanes], pdy[MaxPlanes], pc[MaxPlanes];
+    int nplanes;
+    int x0, y0, x1, y1;  // bounding box clipped to target and scissor
+    int ox, oy;          // image position of the target's pixel (0, 0)
+
+    bool inside(int x, int y) const {
+        for (int i = 0; i < 3; ++i)
+            if (edx[i] * x + edy[i] * y + ec[i] < 0) return false;
+        return true;
+    }
+    float z(int x, int y) const { return pdx[0] * x + (pdy[0] * y + pc[0]); }
 };
 
-void triangle(const Vec4f inPts[], const IShader& shader, TGAImage& output, float zbuffer[]);
\ No newline at end of file
+void triangle(const Vec4f inPts[], const IShader& shader, TGAImage& output, DepthBuffer& depthBuffer);
+// same as triangle() for corners that are already in screen space (see ScreenVertexBuffer), pts[i][3] is clip w.
+// Only pixels inside scissor are touched when one is given. Output and depthBuffer may cover just the part of a larger
+// image starting at (originX, originY), pts, scissor and the fragment positions stay in image coordinates so every
+// value comes out exactly as in a full size target (uncompressed depth buffers only).
+void rasterize(const Vec4f pts[], const IShader& shader, TGAImage& output, DepthBuffer& depthBuffer,
+               const Rect* scissor = nullptr, int originX = 0, int originY = 0);
+// multisampled: coverage and depth per sample, fragment() runs once per pixel (at the pixel position, like the single
+// sample path) and its colour goes to the covered samples that passed the depth test
+void rasterize(const Vec4f pts[], const IShader& shader, MultisampleBuffer& target, const Rect* scissor = nullptr);
+// the planes rasterize() sets up for the shader's current triangle, without clipping the bounding box; false for the
+// zero area triangles it skips
+bool setup_shading(const Vec4f pts[], const IShader& shader, TriangleSetup& t);
+// fragment() of pixel (x, y) from the planes exactly as rasterize() evaluates it, for shading outside of it (the
+// visibility resolve), true when discarded
+bool shade_pixel(const TriangleSetup& t, const IShader& shader, int x, int y, TGAColor& c);
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "resource/material.h"
+#include "resource/mesh.h"
+#include "resource/model.h"
+
+// Meshes and materials loaded once and shared read-only by every render that asks for them,
+// keyed by the model's base filename (same naming as Scene). Holds at most capacity models, the least recently used
+// one is dropped first; renders still using a dropped asset keep it alive through their shared_ptr.
+class AssetCache {
+   public:
+    struct Asset {
+        std::unique_ptr<Mesh> mesh;
+        std::unique_ptr<Material> material;
+
+        Model model() const { return Model(mesh.get(), material.get()); }
+    };
+
+    // compressTextures: materials are block compressed right after loading, see Material::compress()
+    explicit AssetCache(size_t capacity = 64, bool compressTextures = false)
+        : capacity(std::max<size_t>(1, capacity)), compress(compressTextures) {}
+
+    // Loads <filename>.obj and its textures on first use, concurrent callers for the same file wait for one load.
+    // Null when the mesh or one of its textures can't be read; failures are not cached, the next call loads again.
+    std::shared_ptr<Asset> get(const std::string& filename);
+    size_t size();
+
+   private:
+    struct Entry {
+        std::mutex loading;
+        std::shared_ptr<Asset> asset;
+        unsigned long lastUse = 0;
+    };
+
+    std::shared_ptr<Asset> load(const std::string& filename) const;
+
+    size_t capacity;
+    bool compress;
+    std::mutex mutex;
+    unsigned long uses = 0;
+    std::map<std::string, std::shared_ptr<Entry>> entries;
+};
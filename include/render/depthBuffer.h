@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "graphics.h"
+
+enum class DepthFormat {
+    Float32,  // exact
+    Unorm24,  // 3 bytes per pixel
+    Unorm16,  // 2 bytes per pixel, enough for shadow maps
+};
+
+const char* depth_format_name(DepthFormat format);
+bool parse_depth_format(const std::string& name, DepthFormat& format);
+
+// Key types the depth test compares: the float itself, or the quantised 0..depth range with 0 reserved for cleared
+// pixels. Larger keys are nearer, like the float depth.
+struct Float32Codec {
+    using Key = float;
+    static constexpr DepthFormat format = DepthFormat::Float32;
+    static constexpr int bytes = 4;
+
+    static Key clearKey() { return -std::numeric_limits<float>::max(); }
+    static Key encode(float z) { return z; }
+    static float decode(Key k) { return k; }
+    static Key load(const unsigned char* p) {
+        Key k;
+        std::memcpy(&k, p, sizeof(k));
+        return k;
+    }
+    static void store(unsigned char* p, Key k) { std::memcpy(p, &k, sizeof(k)); }
+};
+
+template <int Bits, DepthFormat Format>
+struct UnormCodec {
+    using Key = uint32_t;
+    static constexpr DepthFormat format = Format;
+    static constexpr int bytes = Bits / 8;
+    static constexpr uint32_t maxKey = (1u << Bits) - 1;
+
+    static Key clearKey() { return 0; }
+    // double keeps all 24 bits
+    static Key encode(float z) {
+        const double t = std::min(std::max(z * (1. / depth), 0.), 1.);
+        return 1 + static_cast<uint32_t>(t * (maxKey - 1) + 0.5);
+    }
+    static float decode(Key k) {
+        return k ? static_cast<float>((k - 1) * (static_cast<double>(depth) / (maxKey - 1)))
+                 : -std::numeric_limits<float>::max();
+    }
+    static Key load(const unsigned char* p) {
+        Key k = 0;
+        for (int i = 0; i < bytes; ++i) k |= static_cast<Key>(p[i]) << (8 * i);
+        return k;
+    }
+    static void store(unsigned char* p, Key k) {
+        for (int i = 0; i < bytes; ++i) p[i] = static_cast<unsigned char>(k >> (8 * i));
+    }
+};
+
+using Unorm24Codec = UnormCodec<24, DepthFormat::Unorm24>;
+using Unorm16Codec = UnormCodec<16, DepthFormat::Unorm16>;
+
+// fn(Codec()) with the codec of format, so hot loops are compiled once per format
+template <typename Fn>
+void dispatch_depth_format(DepthFormat format, const Fn& fn) {
+    switch (format) {
+        case DepthFormat::Unorm24:
+            fn(Unorm24Codec());
+            break;
+        case DepthFormat::Unorm16:
+            fn(Unorm16Codec());
+            break;
+        default:
+            fn(Float32Codec());
+            break;
+    }
+}
+
+// Depth of a width x height target, larger is nearer and cleared pixels read as -FLT_MAX.
+//
+// Uncompressed buffers keep one value per pixel in the chosen format. Compressed buffers split the target into
+// TileSize x TileSize tiles that are either clear, a single plane z = a * x + (b * y + c) left by one triangle
+// covering the whole tile, or per-pixel storage taken from a block pool the first time a tile is partially written.
+// rasterize() tests against planes directly and only expands a tile when it has to write single pixels.
+class DepthBuffer {
+   public:
+    static constexpr int TileSize = 8;
+
+    struct Tile {
+        enum State : uint8_t { Clear, Plane, Pixels };
+        State state = Clear;
+        int block = -1;  // index into the block pool while state == Pixels
+        float a = 0.f, b = 0.f, c = 0.f;
+
+        float plane(int x, int y) const { return a * x + (b * y + c); }
+    };
+
+    struct Stats {
+        size_t bytes;                               // buffer memory in use
+        size_t float32Bytes;                        // an uncompressed float buffer of the same size
+        size_t clearTiles, planeTiles, pixelTiles;  // compressed only
+    };
+
+    DepthBuffer(int width, int height, DepthFormat format = DepthFormat::Float32, bool compressed = false);
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    DepthFormat getFormat() const { return format; }
+    bool isCompressed() const { return compressed; }
+
+    void clear();
+    void clear(const Rect& r);
+    float get(int x, int y) const;
+    void set(int x, int y, float z);
+    // the key the depth test compares, Codec must match getFormat()
+    template <typename Codec>
+    typename Codec::Key key(int x, int y) const {
+        if (!compressed) return Codec::load(&data[static_cast<size_t>(x + y * width) * Codec::bytes]);
+        const Tile& t = tile(x / TileSize, y / TileSize);
+        if (t.state == Tile::Clear) return Codec::clearKey();
+        if (t.state == Tile::Plane) return Codec::encode(t.plane(x, y));
+        return Codec::load(block(t) + (x % TileSize + y % TileSize * TileSize) * Codec::bytes);
+    }
+    Stats stats() const;
+    size_t coveredPixels() const;  // pixels that are not clear
+
+    // raw access for the rasterizer and the shadow lookup, pixel (x, y) of an uncompressed buffer is at
+    // pixels() + (x + y * width) * bytes
+    unsigned char* pixels() { return data.data(); }
+    const unsigned char* pixels() const { return data.data(); }
+    int getTilesX() const { return tilesX; }
+    Tile& tile(int tx, int ty) { return tiles[tx + ty * tilesX]; }
+    const Tile& tile(int tx, int ty) const { return tiles[tx + ty * tilesX]; }
+    // per-pixel storage of a tile (row-major, TileSize wide), converting a clear or plane tile first
+    unsigned char* expand(int tx, int ty);
+    const unsigned char* block(const Tile& t) const { return data.data() + t.block * blockBytes; }
+    // back to a plane after one triangle covered the whole tile again
+    void setPlane(int tx, int ty, float a, float b, float c);
+
+   private:
+    void release(Tile& t);
+
+    int width;
+    int height;
+    DepthFormat format;
+    bool compressed;
+    int bytes;  // per pixel
+    int tilesX;
+    int tilesY;
+    size_t blockBytes;
+    std::vector<unsigned char> data;  // pixels, or the block pool when compressed
+    std::vector<Tile> tiles;
+    std::vector<int> freeBlocks;
+};
+
+void print_depth_stats(std::ostream& out, const char* name, const DepthBuffer& buffer);
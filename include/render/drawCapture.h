@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "render/depthBuffer.h"
+#include "render/renderer.h"
+#include "render/shadow.h"
+#include "render/vertexBuffer.h"
+#include "util/geometry.h"
+#include "util/tgaImage.h"
+
+// transform globals and post vertex stream of one pass
+struct CapturedPass {
+    Matrix4x4 view;
+    Matrix4x4 projection;
+    Matrix4x4 viewport;
+    std::vector<ScreenVertexBuffer> vertices;  // per model, what rasterize() got
+    std::vector<Matrix4x4> uniforms;           // per model, shadow pass: DepthShader M, main pass: Shader M and MS
+};
+
+// One frame as it reached the raster stage: everything the shadow and main pass rasterized and shaded, and hashes
+// of the images they produced. The Renderer fills it while capturing (Renderer::setCapture()) and rasterizes from it
+// again in Renderer::replay(); meshes and textures are not stored, they are loaded from the scene files again.
+struct DrawCapture {
+    // scene, filled by the caller: model files as given to Scene, relative to resourceDir
+    std::string resourceDir;
+    std::vector<std::string> modelFiles;
+    bool compressedTextures = false;
+    bool environment = false;     // ambient light from environment tables
+    std::string environmentFile;  // empty: procedural_environment(lightDir)
+
+    // renderer settings
+    int width = 0;
+    int height = 0;
+    ShadingMode shadingMode = ShadingMode::Forward;
+    int samples = 1;
+    ShadowFilter shadowFilter;
+    DepthFormat shadowFormat = DepthFormat::Float32;
+    bool shadowCompressed = false;
+    DepthFormat depthFormat = DepthFormat::Float32;
+    bool depthCompressed = false;
+    bool depthSort = false;
+    Vec3f lightDir;
+
+    // per model
+    std::vector<Matrix4x4> transforms;
+    std::vector<int> lods;
+    std::vector<uint32_t> faces;              // of the drawn level, to check the reloaded meshes
+    std::vector<std::vector<Vec3f>> normals;  // skinned normals, empty for unskinned models
+    CapturedPass shadow;
+    CapturedPass main;
+
+    uint64_t depthOutputHash = 0;  // Renderer::getDepthOutput() after the shadow pass
+    uint64_t outputHash = 0;       // Renderer::getOutput() after the main pass
+
+    bool write(const std::string& filename) const;
+    bool read(const std::string& filename);
+};
+
+// FNV-1a over the pixels, to compare a replayed image with the captured one
+uint64_t image_hash(const TGAImage& image);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "util/geometry.h"
+#include "util/tgaImage.h"
+
+// Image based lighting tables precomputed from an equirectangular environment map (+y up, -z in the middle column,
+// texels used as stored, like every other colour in the renderer):
+// - irradiance as 9 spherical harmonics coefficients per channel, already convolved with the cosine lobe
+// - the environment prefiltered with the GGX lobe (split sum, N = V = R), one level per roughness step
+// - the scale and bias to F0 of the split sum BRDF integral over N.V and roughness
+// Shading a pixel then costs the SH polynomial, two bilinear fetches of the specular chain and one LUT fetch.
+class EnvironmentLighting {
+   public:
+    static constexpr int SpecularLevels = 6;  // roughness 0, 0.2, ... 1
+    static constexpr int SpecularWidth = 128;  // of level 0, halved every level
+    static constexpr int LutSize = 32;
+
+    // the tables of env from cacheDir/ibl_<source hash>.bin, or computed on all cores and written there (not
+    // written when cacheDir is empty), false for an empty env
+    bool build(const TGAImage& env, const std::string& cacheDir);
+    bool loadedFromCache() const { return fromCache; }
+    uint64_t getSourceHash() const { return sourceHash; }
+    bool valid() const { return !levels.empty(); }
+
+    // cosine weighted average radiance around n (world space, normalized), in 0..1 per channel
+    Vec3f irradiance(const Vec3f& n) const;
+    // radiance reflected along r by a GGX lobe of the roughness
+    Vec3f specular(const Vec3f& r, float roughness) const;
+    // (scale, bias) of F0 in the specular integral
+    Vec2f brdf(float NdotV, float roughness) const;
+
+   private:
+    bool load(const std::string& filename);
+    bool save(const std::string& filename) const;
+
+    uint64_t sourceHash = 0;
+    bool fromCache = false;
+    float sh[3][9];                          // per channel
+    std::vector<std::vector<Vec3f>> levels;  // SpecularWidth >> l by SpecularWidth / 2 >> l texels
+    std::vector<Vec2f> lut;                  // N.V along x, roughness along y
+};
+
+// a sky gradient over a dark ground with a sun disc toward sunDir, for scenes without an environment map
+TGAImage procedural_environment(const Vec3f& sunDir, int width = 512, int height = 256);
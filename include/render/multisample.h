@@ -0,0 +1,93 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <vector>
+
+#include "graphics.h"
+#include "util/tgaImage.h"
+
+// Multisampled colour and depth target of a width x height frame with 4 or 8 samples per pixel.
+//
+// Coverage and depth are per sample, but rasterize() shades once per pixel and triangle, so most pixels (inside a
+// triangle, or empty) hold the same colour in every sample. Those keep one colour and the "all samples equal" flag;
+// only pixels on triangle edges take a block of per-sample colours from a pool, the first time a triangle covers
+// part of them. resolve() averages the samples into a normal image.
+// Depth follows the same flag: a pixel whose samples all came from one triangle keeps the index of that triangle's
+// depth plane (shared by all of its pixels) and its sample depths are evaluated from the plane, edge pixel blocks
+// hold a float depth per sample next to the colours.
+class MultisampleBuffer {
+   public:
+    static constexpr int MaxSamples = 8;
+
+    // depth of a sample at (sx, sy) is dx * sx + (dy * sy + c), as rasterize() evaluates its depth plane
+    struct DepthPlane {
+        float dx, dy, c;
+    };
+
+    struct Stats {
+        size_t bytes;              // depth planes, colours, flags and the block pools
+        size_t supersampledBytes;  // colour and float depth of a frame with samples times the pixels
+        size_t edgePixels;         // pixels with per-sample colours
+    };
+
+    MultisampleBuffer() : MultisampleBuffer(0, 0, 4) {}
+    MultisampleBuffer(int width, int height, int samples);
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getSamples() const { return samples; }
+    // position of sample s relative to the pixel position, the standard 4x / 8x patterns
+    Vec2f sampleOffset(int s) const;
+
+    void clear();
+    void clear(const Rect& r);
+    // samples of pixel (x, y) into z, larger is nearer and cleared samples are -FLT_MAX
+    void depth(int x, int y, float z[]) const {
+        const size_t i = x + static_cast<size_t>(y) * width;
+        if (!equal[i]) {
+            std::copy(depthPool.begin() + colors[i], depthPool.begin() + colors[i] + samples, z);
+            return;
+        }
+        const DepthPlane& p = planes[planeIndex[i]].plane;
+        for (int s = 0; s < samples; ++s) z[s] = p.dx * (x + offsets[s].x) + (p.dy * (y + offsets[s].y) + p.c);
+    }
+    // colour c and depth into the samples set in mask, z holds plane evaluated at the samples
+    void write(int x, int y, unsigned mask, uint32_t c, const DepthPlane& plane, const float z[]);
+    uint32_t color(int x, int y, int s) const;
+    bool uniform(int x, int y) const { return equal[x + static_cast<size_t>(y) * width] != 0; }
+
+    // average colour of the samples of every pixel in r into out (at the same position)
+    void resolve(const Rect& r, TGAImage& out) const;
+    Stats stats() const;
+    size_t coveredPixels() const;  // pixels with at least one sample that is not clear
+
+   private:
+    unsigned fullMask() const { return (1u << samples) - 1; }
+    // pixel i refers to plane p, a plane no pixel refers to any more is reused
+    void setPlane(size_t i, uint32_t p);
+    uint32_t addPlane(const DepthPlane& plane);
+
+    struct PlaneSlot {
+        DepthPlane plane;
+        uint32_t pixels;  // referring to it
+    };
+
+    int width;
+    int height;
+    int samples;
+    Vec2f offsets[MaxSamples];
+    std::vector<uint32_t> colors;      // per pixel, the colour of all samples, or the offset of its block in the pools
+    std::vector<uint32_t> planeIndex;  // per pixel with equal samples, its depth plane in planes
+    std::vector<uint8_t> equal;        // per pixel, the "all samples equal" flag
+    std::vector<PlaneSlot> planes;     // planes[0] is the cleared depth
+    std::vector<uint32_t> freePlanes;
+    uint32_t lastPlane = 0;            // added by the last full write, the triangle being rasterized
+    std::vector<uint32_t> pool;        // samples colours per block
+    std::vector<float> depthPool;      // samples depths per block
+    std::vector<uint32_t> freeBlocks;
+};
+
+void print_multisample_stats(std::ostream& out, const MultisampleBuffer& buffer);
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+#include "render/renderer.h"
+#include "render/shadow.h"
+#include "resource/model.h"
+#include "util/geometry.h"
+#include "util/tgaImage.h"
+
+// Coarse to fine rendering for interactive use. Level 0 is 1 / 2^(levels - 1) of the size, shaded with the cheap
+// preview variant and a single shadow tap, every further level doubles the resolution. The preview levels skip the
+// triangles hidden behind the depth of the level before (Renderer::setOcclusionDepth(), approximate); the last level
+// is full size with the full shader and filter and draws everything, so it matches a plain Renderer frame. Each level
+// keeps its own Renderer, so unchanged levels are not drawn again.
+// cancel() may be called from any thread, e.g. when the camera moved: the running level stops at its next check.
+class ProgressiveRenderer {
+   public:
+    struct LevelStats {
+        int width;
+        int height;
+        double ms;        // of this level alone
+        size_t occluded;  // triangles skipped by the depth of the level before
+        bool finished;
+    };
+
+    ProgressiveRenderer(int width, int height, int levels = 4);
+
+    // of the full size level, the preview levels always take one hard tap
+    void setShadowFilter(const ShadowFilter& filter);
+    void setEnvironment(const EnvironmentLighting* env);
+
+    // all levels coarse to fine, onLevel(level, image) after each finished one on the calling thread (image in
+    // Renderer orientation, bottom row first); false when cancelled before the last level finished
+    bool render(const std::vector<Model>& models, const Vec3f& light_dir, const Camera& camera,
+                const std::function<void(int, const TGAImage&)>& onLevel = nullptr);
+    void cancel() { cancelled = true; }
+
+    int getLevels() const { return static_cast<int>(levels.size()); }
+    Renderer& getLevel(int level) { return *levels[level]; }
+    TGAImage& getOutput() { return levels.back()->getOutput(); }
+    // since render() started, of its last call; time to final is negative when it was cancelled
+    double getTimeToFirstImage() const { return firstImageMs; }
+    double getTimeToFinal() const { return finalMs; }
+    const std::vector<LevelStats>& getStats() const { return stats; }
+    void printStats(std::ostream& out) const;
+
+   private:
+    std::vector<std::unique_ptr<Renderer>> levels;
+    std::atomic<bool> cancelled{false};
+    std::vector<LevelStats> stats;
+    double firstImageMs = -1.;
+    double finalMs = -1.;
+};
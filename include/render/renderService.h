@@ -0,0 +1,100 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "render/assetCache.h"
+#include "render/renderer.h"
+
+// Long running render server that keeps meshes and materials warm between jobs.
+//
+// Protocol, one request per line:
+//   render [id=ID] (scene=NAME | models=a,b,c) [eye=x,y,z] [center=x,y,z] [up=x,y,z] [light=x,y,z]
+//          [size=WxH] [pcf=RADIUS] [msaa=1|4|8] [out=PATH | out=-]
+//   stats
+// Replies are one header line, followed by the raw TGA bytes when out=- was requested:
+//   ok ID file PATH queue_ms=.. render_ms=.. encode_ms=.. total_ms=..
+//   ok ID bytes N queue_ms=.. render_ms=.. encode_ms=.. total_ms=..
+//   error ID MESSAGE
+//   stats completed=.. failed=.. rejected=.. queued=.. p50_ms=.. p99_ms=.. max_ms=..
+// Model paths are relative to the resource directory and may not leave it (no absolute paths, "." or ".."). out=NAME
+// writes NAME inside the service's output directory and is refused when the service has none. Jobs are rejected
+// when the queue is full.
+// Each worker keeps its shadow map, so jobs that only move the camera skip the shadow pass.
+
+struct RenderJob {
+    std::string id;
+    std::vector<std::string> models;  // base filenames, see AssetCache
+    Camera camera{Vec3f(1.f, 1.f, 4.f), Vec3f(0.f, 0.f, 0.f), Vec3f(0.f, 1.f, 0.f)};
+    Vec3f light_dir{1.f, 1.f, 1.5f};
+    int width = 512;
+    int height = 512;
+    int pcf = 1;   // ShadowFilter::radius
+    int msaa = 1;  // samples per pixel
+    std::string out = "-";  // output file inside the output directory, "-" returns the image bytes in the reply
+};
+
+class RenderService {
+   public:
+    using Reply = std::function<void(const std::string& header, const std::string& payload)>;
+
+    // outputDir: where out=NAME images go, empty allows only out=-; assetCapacity: models kept loaded, see AssetCache
+    RenderService(const std::string& resourceDir, const std::string& outputDir, int workers, size_t queueCapacity,
+                  size_t assetCapacity = 64, bool compressTextures = false);
+    ~RenderService();  // finishes the queued jobs
+
+    // parse and run one protocol line, the reply may come later from a worker thread
+    void handle(const std::string& line, const Reply& reply);
+    std::string stats();
+    // block until the queue is empty and no job is running
+    void wait();
+
+   private:
+    // what a worker keeps between jobs
+    struct Worker {
+        std::unique_ptr<Renderer> renderer;  // frame buffers are reused while the output size does not change
+        // assets of the last job, held so that the renderer's change detection never sees a reused address
+        std::vector<std::shared_ptr<AssetCache::Asset>> assets;
+    };
+
+    struct PendingJob {
+        RenderJob job;
+        Reply reply;
+        double enqueued;  // ms
+    };
+
+    bool parse(const std::string& line, RenderJob& job, std::string& error);
+    bool submit(RenderJob job, const Reply& reply);
+    void workerLoop();
+    void run(PendingJob& pending, Worker& worker);
+
+    std::string resourceDir;
+    std::string outputDir;
+    AssetCache assets;
+    size_t capacity;
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::condition_variable idle;
+    std::deque<PendingJob> queue;
+    size_t active = 0;
+    bool stopping = false;
+    unsigned long nextId = 0;
+    unsigned long completed = 0;
+    unsigned long failed = 0;
+    unsigned long rejected = 0;
+    std::vector<double> latencies;  // total ms of the most recent jobs, ring buffer
+    size_t latencyCursor = 0;
+    std::vector<std::thread> workers;
+};
+
+// serve requests read from stdin, replies on stdout (log output is moved to stderr)
+int serve_stdio(RenderService& service);
+// serve requests on a unix domain socket, one reader thread per connection
+int serve_socket(RenderService& service, const std::string& path);
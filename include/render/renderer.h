@@ -0,0 +1,227 @@
+#pragma once
+
+#include <atomic>
+#include <ostream>
+#include <vector>
+
+#include "render/depthBuffer.h"
+#include "render/ibl.h"
+#include "render/multisample.h"
+#include "render/shaders.h"
+#include "render/shadow.h"
+#include "render/skinning.h"
+#include "render/tileMask.h"
+#include "render/vertexBuffer.h"
+#include "resource/model.h"
+#include "util/frameArena.h"
+#include "util/geometry.h"
+#include "util/jobSystem.h"
+#include "util/tgaImage.h"
+
+struct CapturedPass;
+struct DrawCapture;
+
+struct Camera {
+    Vec3f eye;
+    Vec3f center;
+    Vec3f up;
+};
+
+enum class ShadingMode {
+    Forward,     // fragment() for every fragment passing the depth test at the time it is drawn
+    Visibility,  // rasterize triangle ids first, then fragment() once per visible pixel from the same planes
+};
+
+// Owns the frame buffers of one output size and runs the shadow and main passes over a model list.
+// Both passes remember the screen bounds of every model. When only model transforms changed since the previous
+// call, just the tiles under the old and new footprints (and, for the main pass, the tiles whose shadow lookups
+// hit redrawn shadow map tiles) are cleared and rasterized again, everything else is kept.
+// Every pass runs as JobSystem jobs: the vertex stage of each model (or group of instances) is one job, and the raster
+// job of a model waits for its vertices and for the raster of the model before it (same draw order as a serial loop),
+// so drawing the first models overlaps transforming the next ones. Per pass lists (changed models, job handles,
+// shader copies) live in the FrameArena of the calling thread and the jobs', so once the buffers have their size a
+// frame does not allocate.
+class Renderer {
+   public:
+    Renderer(int width, int height);
+
+    // depth from the light into the shadow map (and a visualisation in getDepthOutput()), the map is kept while
+    // light_dir, camera center/up and the model meshes and transforms stay the same, returns false when it was reused
+    bool shadowPass(const std::vector<Model>& models, const Vec3f& light_dir, const Camera& camera,
+                    const std::vector<InstanceBatch>& batches = {});
+    // shaded image into getOutput(), reads the shadow map of the last shadowPass()
+    void mainPass(const std::vector<Model>& models, const Vec3f& light_dir, const Camera& camera,
+                  const std::vector<InstanceBatch>& batches = {});
+    // Instances of the batches are drawn after the models. Each pass rejects the instances whose bounding sphere is
+    // outside its view before their vertex stage (not for posed batches, skinning can leave the rest pose bounds),
+    // sets the batch shader up once and per instance only its transform uniforms, and transforms and rasterizes
+    // InstanceGroup instances per job, so the cost follows the visible copies.
+    void render(const std::vector<Model>& models, const Vec3f& light_dir, const Camera& camera,
+                const std::vector<InstanceBatch>& batches = {});
+    // of the last main pass
+    size_t getDrawnInstances() const { return drawnInstances; }
+    size_t getCulledInstances() const { return culledInstances; }
+
+    // draw order of both passes roughly front to back, so that more hidden fragments fail the depth test before
+    // fragment() runs: the draws by the nearest view depth of their bounding sphere, the clusters of every mesh (see
+    // Mesh::clusters()) by the depth of their center, both with a radix sort on the depth bits. Off by default;
+    // it changes only which of two equal depths wins.
+    void setDepthSort(bool on);
+    bool getDepthSort() const { return depthSort; }
+    // main pass with the cheap Shader::uniform_preview variant
+    void setPreview(bool on);
+    // main pass triangles entirely behind the depth of a coarser render of the same view are skipped, see
+    // ProgressiveRenderer. The coarse depth is read per 8x8 pixel cell including its neighbours, but surfaces that
+    // slip between coarse samples can still be lost: approximate, for previews only. Not owned, null turns it off.
+    void setOcclusionDepth(const DepthBuffer* coarse);
+    size_t getOccludedTriangles() const { return occludedTriangles; }  // skipped by the last main pass
+    // checked while rasterizing: once set the running pass stops early, and the next one draws everything again.
+    // Not owned, null turns it off.
+    void setCancelFlag(const std::atomic<bool>* flag) { cancel = flag; }
+
+    // record what the following passes rasterize into capture (not owned, null stops): transform globals, screen
+    // space vertices, shader uniforms, settings and image hashes. Passes draw everything while capturing, passes with
+    // instance batches are not recorded.
+    void setCapture(DrawCapture* c);
+    // both passes again from a capture, only raster and shading run: the settings are taken over and the vertices
+    // come from the capture. models must be the captured ones (meshes, levels of detail and transforms).
+    void replay(const std::vector<Model>& models, const DrawCapture& capture);
+
+    // level of detail of every model from the screen size of its bounding sphere in this renderer's main view,
+    // see Model::selectLod()
+    void selectLods(std::vector<Model>& models, const Camera& camera, float maxError = 1.f) const;
+
+    void setShadingMode(ShadingMode mode);
+    ShadingMode getShadingMode() const { return shadingMode; }
+    void setShadowFilter(const ShadowFilter& filter);
+    // ambient light of the main pass from precomputed environment tables, not owned; null for the constant term.
+    // Redraws the whole frame, call it again after changing the tables in place.
+    void setEnvironment(const EnvironmentLighting* env);
+    // samples per pixel of the main pass, 1 (off), 4 or 8. Forward shading only, the visibility mode stays single
+    // sampled. The depth then lives in getMultisampleBuffer() instead of getZBuffer().
+    void setMultisample(int samples);
+    int getMultisample() const { return samples; }
+    // storage of the main pass depth and the shadow map, see DepthBuffer; both start as plain float32
+    void setDepthFormat(DepthFormat format, bool compressed = false);
+    void setShadowMapFormat(DepthFormat format, bool compressed = false);
+    // bytes in use by both depth buffers (and the multisampled target) after the last passes and the savings, then the
+    // high water mark of the frame arenas
+    void memoryReport(std::ostream& out) const;
+    const ShadowFilter& getShadowFilter() const { return shadowFilter; }
+    // force the next pass to draw everything, e.g. after mesh positions or material maps changed in place
+    void invalidateShadowMap() { shadowState.valid = false; }
+    void invalidateFrame() { mainState.valid = false; }
+    // tiles drawn by the last pass
+    const TileMask& getRedrawnTiles() const { return redraw; }
+    // skinned vertices of the posed models, shared by both passes
+    const SkinCache& getSkinCache() const { return skins; }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    TGAImage& getOutput() { return output; }
+    TGAImage& getDepthOutput() { return depthOutput; }
+    const DepthBuffer& getZBuffer() const { return zbuffer; }
+    const DepthBuffer& getShadowMap() const { return shadowMap; }
+    const MultisampleBuffer& getMultisampleBuffer() const { return multisample; }
+
+   private:
+    using Jobs = ArenaVector<JobSystem::Handle>;
+
+    // a model or one instance of a batch, as a pass draws it
+    struct Draw {
+        const Model* model;  // mesh, material and pose, the batch's model for instances
+        const Matrix4x4* transform;
+        int batch;     // -1 for models
+        size_t group;  // draws from this one on that share a vertex and a raster job, 0 inside a group
+    };
+    using Draws = ArenaVector<Draw>;
+
+    // what a pass drew last time
+    struct PassState {
+        bool valid = false;
+        Vec3f light_dir;
+        Camera camera;
+        std::vector<const Mesh*> meshes;
+        std::vector<Matrix4x4> transforms;
+        std::vector<unsigned> poses;  // Model::getPoseVersion()
+        std::vector<const Material*> materials;
+        std::vector<Rect> bounds;  // screen footprint of each model
+    };
+
+    // the models, then the instances inside the view of the current globals; returns the culled instances
+    size_t collectDraws(const std::vector<Model>& models, const std::vector<InstanceBatch>& batches,
+                        Draws& draws) const;
+    // indices of the draws whose transform, pose or material changed, false when the draw list itself changed
+    static bool changedModels(const PassState& state, const Draws& draws, ArenaVector<size_t>& changed);
+    // transform the changed draws (all of them when changed is null) with the current globals and fill redraw.
+    // transformed[k] finishes once screen[k] and the bounds of draw k are ready, only a full redraw returns before.
+    void planRedraw(PassState& state, const Draws& draws, const Vec3f& light_dir, const Camera& camera,
+                    const ArenaVector<size_t>* changed, std::vector<ScreenVertexBuffer>& screen, Jobs& transformed);
+    void markShadowedTiles();
+    void clearTiles(DepthBuffer& depthBuffer, TGAImage& image, MultisampleBuffer* samples = nullptr);
+    void updateTileDepth();
+    bool multisampled() const { return samples > 1 && shadingMode == ShadingMode::Forward; }
+    // rasterize the faces of one draw that touch a tile in redraw, raster(pts, scissor) draws one triangle. With
+    // occluders (see buildOccluders()) faces hidden behind them are skipped.
+    template <typename Raster>
+    void drawModel(const Draw& draw, const ScreenVertexBuffer& screen, const Rect& bounds, IShader& shader,
+                   const float* occluders, const Raster& raster);
+    // nearest depth per OcclusionCell cell a triangle must reach to be drawn, from occlusionDepth
+    void buildOccluders();
+    bool occluded(const Vec4f pts[], const Rect& box) const;
+    const float* mainOccluders() const { return occlusionDepth ? occluders.data() : nullptr; }
+    bool cancelled() const { return cancel && cancel->load(std::memory_order_relaxed); }
+    // drawModel() of every draw as a chain of jobs (one per group, nearest first when depth sorting) after its
+    // transform, returns when the last one finished
+    template <typename DrawFn>
+    void drawModels(const Draws& draws, const Jobs& transformed, const DrawFn& draw);
+    // raster and shading of the passes once the redraw is planned, screen[k] is ready when transformed[k] finished
+    void drawShadows(const Draws& draws, const std::vector<ScreenVertexBuffer>& screen,
+                     ArenaVector<DepthShader>& depthShaders, const Jobs& transformed);
+    void drawMain(const Draws& draws, const std::vector<ScreenVertexBuffer>& screen, ArenaVector<Shader>& shaders,
+                  const Jobs& transformed);
+    void forwardPass(const Draws& draws, const std::vector<ScreenVertexBuffer>& screen, ArenaVector<Shader>& shaders,
+                     const Jobs& transformed);
+    void visibilityPass(const Draws& draws, const std::vector<ScreenVertexBuffer>& screen, const Jobs& transformed);
+    void resolvePass(const Draws& draws, const std::vector<ScreenVertexBuffer>& screen,
+                     const ArenaVector<Shader>& shaders);
+    // globals, bounds and a full redraw from a captured pass
+    void replayPass(const CapturedPass& pass, PassState& state);
+    void captureMainPass(const Draws& draws, const ArenaVector<Shader>& shaders, const Vec3f& light_dir);
+
+    int width;
+    int height;
+    DepthBuffer zbuffer;
+    DepthBuffer shadowMap;
+    Matrix4x4 shadowMapM;  // Viewport * Projection * View of the light
+    Matrix4x4 passView;    // transform globals of the running pass for its vertex jobs, which run on other threads
+    Matrix4x4 passScreen;  // Viewport * Projection
+    ShadowFilter shadowFilter;
+    TGAImage output;
+    TGAImage depthOutput;
+    std::vector<ScreenVertexBuffer> vertices;        // per model, main pass
+    std::vector<ScreenVertexBuffer> shadowVertices;  // per model, shadow pass
+    SkinCache skins;
+    const EnvironmentLighting* environment = nullptr;
+    ShadingMode shadingMode = ShadingMode::Forward;
+    int samples = 1;
+    MultisampleBuffer multisample;  // main pass target while multisampled()
+    std::vector<VisibilitySample> visibility;
+    PassState shadowState;
+    PassState mainState;
+    TileMask redraw;         // tiles of the running pass
+    TileMask shadowChanged;  // shadow map tiles redrawn since the last main pass
+    std::vector<Vec2f> tileDepth;  // min and max depth of the covered pixels per main pass tile, min > max if empty
+    DrawCapture* capture = nullptr;
+    bool preview = false;
+    bool depthSort = false;
+    static constexpr int OcclusionCell = 8;
+    const DepthBuffer* occlusionDepth = nullptr;
+    std::vector<float> occluders;  // per cell, row major
+    int occlusionCellsX = 0;
+    size_t occludedTriangles = 0;
+    const std::atomic<bool>* cancel = nullptr;
+    static constexpr size_t InstanceGroup = 16;
+    size_t drawnInstances = 0;
+    size_t culledInstances = 0;
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "resource/material.h"
+#include "resource/mesh.h"
+#include "resource/model.h"
+
+// The models of one scene, each loaded from <filename>.obj and <filename>_{diffuse,nm_tangent,spec}.tga. Meshes and
+// textures are loaded concurrently as JobSystem jobs.
+class Scene {
+   public:
+    Scene(const std::vector<std::string>& modelsFilename);
+    Scene(const Scene&) = delete;
+    Scene& operator=(const Scene&) = delete;
+
+    const std::vector<Model>& getModels() const { return models; }
+    std::vector<Model>& getModels() { return models; }
+    // of model k, e.g. to attach skin weights or compress the textures
+    Mesh& getMesh(size_t k) { return *meshs[k]; }
+    Material& getMaterial(size_t k) { return *materials[k]; }
+
+   private:
+    std::vector<std::unique_ptr<Mesh>> meshs;
+    std::vector<std::unique_ptr<Material>> materials;
+    std::vector<Model> models;
+};
+
+// model list of the built-in scenes ("african_head", "boggie", "diablo3_pose"), empty for unknown names
+std::vector<std::string> scene_files(const std::string& resourceDir, const std::string& name);
+std::vector<std::string> scene_names();
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "graphics.h"
+#include "render/depthBuffer.h"
+#include "render/ibl.h"
+#include "render/shadow.h"
+#include "resource/model.h"
+
+struct DepthShader : IShader {
+    const Model* model;   // current rendering model
+    Matrix4x4 uniform_M;  // Projection * ModelView;
+
+    DepthShader(const Model* m, const Matrix4x4& M) : model(m), uniform_M(M){};
+
+    virtual Vec4f vertex(const int& faceIdx, const int& nthvert);
+    virtual bool fragment(const Vec3f& viewCoord, const Vec3f bar, const float varying[], TGAColor& outColor) const;
+};
+
+// varyings: uv (0, 1), normal (2, 3, 4)
+struct Shader : IShader {
+    const Model* model;                    // current rendering model
+    const DepthBuffer* uniform_shadowmap;  // depth rendered by the shadow pass
+    Matrix4x4 uniform_M;                   // Projection * ModelView;
+    Matrix4x4 uniform_shadow;              // ShadowMapVPM * (Viewport * Projection * ModelView).invert
+    Vec3f uniform_light_dir;               // uniform_M * lightdir
+    Vec3f uniform_light_model;             // lightdir in model space, for the slope scaled shadow bias
+    ShadowFilter uniform_shadow_filter;
+    Matrix<2, 3, float> vary_uv;           // triangle uv coordinates, set by vs, read by ps
+    Matrix<3, 3, float> vary_tri;          // triangle coordinates before viewport transform, set by vs, read by ps
+    Matrix4x4 uniform_viewport_inv;        // Viewport.invert(), brings batched screen coordinates back for vary_tri
+    Matrix4x4 uniform_view_inv;            // View.invert(), world space directions for the environment lookups
+    // skinned normals indexed like the mesh normals, null reads the mesh normals
+    const std::vector<Vec3f>* uniform_normals = nullptr;
+    // ambient light from the environment, null keeps the constant ambient term
+    const EnvironmentLighting* uniform_ibl = nullptr;
+    // cheap variant for previews: interpolated normal, diffuse texture and one shadow tap, no specular or ibl
+    bool uniform_preview = false;
+
+    Shader(const Model* m, const Matrix4x4& M, const Matrix4x4& MS, const Vec3f& light_dir,
+           const DepthBuffer* shadowMap, const ShadowFilter& filter = ShadowFilter());
+
+    // uniforms of one instance drawn with a copy of its batch's shader, keeps the View and Viewport inverses
+    void setInstance(const Matrix4x4& transform, const Matrix4x4& M, const Matrix4x4& MS, const Vec3f& light_dir);
+
+    virtual Vec4f vertex(const int& faceIdx, const int& nthvert);
+    virtual void attributes(const int& faceIdx, const int& nthvert, const Vec4f& screenCoord);
+    virtual bool fragment(const Vec3f& viewCoord, const Vec3f bar, const float varying[], TGAColor& outColor) const;
+
+   private:
+    void setVaryings(const int& nthvert, const Mesh::Vertex& v);
+};
+
+// what the visibility pass keeps per pixel, the resolve sets the triangle up again and evaluates its planes there
+struct VisibilitySample {
+    int model;  // index into the rendered model list, -1 for empty pixels
+    int face;
+};
+
+// visibility pass: only records which triangle won the depth test, shading happens once per pixel afterwards
+struct VisibilityShader : IShader {
+    VisibilitySample* uniform_buffer;
+    int uniform_width;
+    int uniform_model;
+    int vary_face;  // set by attributes()
+
+    VisibilityShader(VisibilitySample* buffer, int width, int modelIdx)
+        : uniform_buffer(buffer), uniform_width(width), uniform_model(modelIdx), vary_face(0) {}
+
+    virtual Vec4f vertex(const int& faceIdx, const int& nthvert) { return Vec4f(); }
+    virtual void attributes(const int& faceIdx, const int& nthvert, const Vec4f& screenCoord) { vary_face = faceIdx; }
+    virtual bool fragment(const Vec3f& viewCoord, const Vec3f bar, const float varying[],
+                          TGAColor& outColor) const {
+        uniform_buffer[static_cast<int>(viewCoord.x) + static_cast<int>(viewCoord.y) * uniform_width] = {
+            uniform_model, vary_face};
+        return false;
+    }
+};
@@ -0,0 +1,17 @@
+#pragma once
+
+// Shadow lookup settings, depths and biases are in shadow map depth units (0..depth).
+struct ShadowFilter {
+    int radius = 1;            // percentage closer filtering over (2 * radius + 1)^2 taps, 0 is a single hard tap
+    float constantBias = 2.f;  //
+    float slopeBias = 3.f;     // times tan(angle between normal and light), grows on surfaces seen edge on
+    float maxBias = 24.f;      //
+
+    float bias(float cosTheta) const;
+};
+
+class DepthBuffer;
+
+// Fraction of the kernel taps around (x, y) where the shadow map does not occlude refDepth, 1 is fully lit.
+// Taps outside the map count as lit. The comparison runs on the map's own keys, SIMD for float32 and unorm16.
+float shadow_lookup(const DepthBuffer& shadowMap, float x, float y, float refDepth, int radius);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "resource/mesh.h"
+#include "resource/model.h"
+#include "resource/skeleton.h"
+#include "util/geometry.h"
+
+// positions and normals of a mesh after skinning, indexed like the mesh's own
+struct SkinnedVertices {
+    PositionStream positions;
+    std::vector<Vec3f> normals;
+};
+
+// Linear blend skinning of all positions and normals of a skinned mesh by a pose palette, in parallel chunks and
+// one vertex per SSE register. The palette must cover every joint the mesh weights refer to.
+void skin_vertices(const Mesh& mesh, const std::vector<Matrix4x4>& palette, SkinnedVertices& out);
+
+// Skinned vertices per mesh and pose, redone only when the pose version changed, so the shadow and main passes
+// (and later frames with the same pose) share one skinning run.
+class SkinCache {
+   public:
+    // null when the model has no pose or its mesh no skin
+    const SkinnedVertices* get(const Model& model);
+    void clear() { entries.clear(); }
+
+    size_t getRuns() const { return runs; }  // skin_vertices() calls so far
+    size_t getHits() const { return hits; }
+
+   private:
+    struct Entry {
+        unsigned version = 0;
+        SkinnedVertices vertices;
+    };
+
+    std::map<std::pair<const Mesh*, const Pose*>, Entry> entries;
+    size_t runs = 0;
+    size_t hits = 0;
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "graphics.h"
+
+// One flag per fixed size screen tile, marks which parts of a frame have to be redrawn.
+class TileMask {
+   public:
+    static constexpr int TileSize = 64;
+
+    TileMask(int width, int height);
+
+    void clear() { std::fill(tiles.begin(), tiles.end(), 0); }
+    void markAll() { std::fill(tiles.begin(), tiles.end(), 1); }
+    void mark(const Rect& r);  // every tile touching r
+    void merge(const TileMask& other);
+
+    bool dirty(int tx, int ty) const { return tiles[tx + ty * tilesX] != 0; }
+    bool any(const Rect& r) const;  // any dirty tile touching r
+    bool all() const { return count() == static_cast<int>(tiles.size()); }
+    int count() const { return static_cast<int>(std::count(tiles.begin(), tiles.end(), 1)); }
+    int size() const { return static_cast<int>(tiles.size()); }
+    int getTilesX() const { return tilesX; }
+    int getTilesY() const { return tilesY; }
+    Rect tileRect(int tx, int ty) const;
+
+    // fn(Rect) for each horizontal run of dirty tiles touching r, clipped to r
+    template <typename Fn>
+    void forEachSpan(const Rect& r, const Fn& fn) const {
+        const Rect t = tilesOf(r);
+        for (int ty = t.y0; ty <= t.y1; ++ty)
+            for (int tx = t.x0; tx <= t.x1; ++tx) {
+                if (!dirty(tx, ty)) continue;
+                const int first = tx;
+                while (tx < t.x1 && dirty(tx + 1, ty)) ++tx;
+                fn(Rect{std::max(r.x0, first * TileSize), std::max(r.y0, ty * TileSize),
+                        std::min(r.x1, (tx + 1) * TileSize - 1), std::min(r.y1, (ty + 1) * TileSize - 1)});
+            }
+    }
+
+   private:
+    Rect tilesOf(const Rect& r) const;  // tile index range of r clipped to the screen, empty when off screen
+
+    int width;
+    int height;
+    int tilesX;
+    int tilesY;
+    std::vector<unsigned char> tiles;
+};
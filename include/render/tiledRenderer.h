@@ -0,0 +1,56 @@
+#pragma once
+
+#include <ostream>
+#include <vector>
+
+#include "render/renderer.h"
+#include "render/shadow.h"
+#include "resource/model.h"
+#include "util/geometry.h"
+
+// Renders images too large to keep in memory: the faces are binned into tileSize x tileSize screen tiles, every
+// tile is rasterized into its own small colour and depth buffer and written straight into the output file. Peak
+// memory depends on the tile size, the thread count and the scene, not on the image size. The shadow map has a fixed
+// resolution of its own. Forward shading only; with shadowSize == width the image matches Renderer.
+class TiledRenderer {
+   public:
+    struct Stats {
+        int tiles;           // tiles with at least one face
+        size_t binnedFaces;  // face references over all bins, faces crossing tile borders count once per tile
+        size_t peakBytes;    // shadow map, vertices, bins and the per-thread tile buffers
+    };
+
+    TiledRenderer(int width, int height, int tileSize = 256, int shadowSize = 2048);
+
+    void setShadowFilter(const ShadowFilter& filter) { shadowFilter = filter; }
+    void setEnvironment(const EnvironmentLighting* env) { environment = env; }
+    // uncompressed TGA with the origin at the bottom left (what Renderer's output looks like after flip_vertically),
+    // false when the file could not be written
+    bool render(const std::vector<Model>& models, const Vec3f& light_dir, const Camera& camera,
+                const char* filename);
+    const Stats& getStats() const { return stats; }
+    void printStats(std::ostream& out) const;
+
+   private:
+    struct BinnedFace {
+        int model;
+        int face;
+    };
+
+    void shadowPass(const std::vector<Model>& models, const Vec3f& light_dir, const Camera& camera);
+    void binFaces(const std::vector<Model>& models);
+
+    int width;
+    int height;
+    int tileSize;
+    int tilesX;
+    int tilesY;
+    DepthBuffer shadowMap;
+    Matrix4x4 shadowMapM;  // Viewport * Projection * View of the light
+    ShadowFilter shadowFilter;
+    std::vector<ScreenVertexBuffer> vertices;   // per model, in full image coordinates
+    std::vector<std::vector<BinnedFace>> bins;  // per tile, in model and face order
+    SkinCache skins;
+    const EnvironmentLighting* environment = nullptr;
+    Stats stats{0, 0, 0};
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "graphics.h"
+#include "resource/mesh.h"
+#include "util/geometry.h"
+
+// Screen space vertices (after perspective divide and viewport), one entry per mesh position.
+// x, y, z are rounded the same way triangle() rounds its corners, w keeps the clip space w.
+struct ScreenVertexBuffer {
+    std::vector<float> x, y, z, w;
+
+    void resize(size_t n);
+    size_t size() const { return x.size(); }
+    Vec4f operator[](const size_t& i) const {
+        Vec4f ret;
+        ret[0] = x[i];
+        ret[1] = y[i];
+        ret[2] = z[i];
+        ret[3] = w[i];
+        return ret;
+    }
+};
+
+// Transform a whole position stream by M (Viewport * Projection * ModelView) in one pass.
+void transform_vertices(const PositionStream& in, const Matrix4x4& M, ScreenVertexBuffer& out);
+// Pixel index of a screen coordinate on an axis of limit pixels, clamped to [-1, limit + 1] in float first: vertices
+// behind the camera can be far outside the int range.
+inline int to_pixel(float v, int limit) { return static_cast<int>(std::min(std::max(v, -1.f), limit + 1.f)); }
+// Pixels any triangle over these vertices can touch on a width x height target, empty when all are off screen.
+Rect screen_bounds(const ScreenVertexBuffer& vertices, int width, int height);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "util/tgaImage.h"
+
+// A texture stored as 4x4 texel blocks in the layouts of BC1 (rgb, 8 bytes a block), BC4 (one channel, 8 bytes) or
+// BC5 (two channels, 16 bytes). get() decodes the whole block of a texel into a small per-thread cache, so the
+// neighbouring fetches of a rasterized span read already decoded texels.
+class BlockTexture {
+   public:
+    enum Format { BC1, BC4, BC5 };
+
+    BlockTexture() = default;
+    // channels are TGAColor byte indices (0 b, 1 g, 2 r) kept by BC4 (channel0) and BC5 (both), ignored by BC1
+    BlockTexture(const TGAImage& image, Format format, int channel0 = 0, int channel1 = 1);
+
+    // texel (x, y) clamped to the image, decoded channels at the byte positions they were read from and the others
+    // 0 (BC1: b, g, r and alpha 255); TGAColor() for an empty texture like TGAImage::get()
+    TGAColor get(int x, int y) const;
+
+    bool empty() const { return blocks.empty(); }
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    Format getFormat() const { return format; }
+    size_t bytes() const { return blocks.size(); }
+
+   private:
+    void decode(size_t block, uint32_t texels[16]) const;
+
+    Format format = BC1;
+    int channels[2] = {0, 1};
+    int width = 0;
+    int height = 0;
+    int blocksWide = 0;
+    int bytespp = 0;
+    unsigned id = 0;  // unique per encoded texture, keys the decoded block cache
+    std::vector<uint8_t> blocks;
+};
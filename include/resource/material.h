@@ -1,4 +1,7 @@
 #pragma once
+#include <cstddef>
+
+#include "resource/blockTexture.h"
 #include "util/geometry.h"
 #include "util/tgaImage.h"
 
@@ -11,8 +14,22 @@ class Material {
     Vec3f normal(Vec2f uv);
     float specular(Vec2f uv);
 
+    // false when one of the maps exists but can't be read, missing maps are allowed (untextured models)
+    bool loaded() const { return mapsLoaded; }
+
+    // Re-encode the loaded maps as block textures and free the images: diffuse as BC1, the tangent space normal's
+    // x and y as BC5 with z rebuilt on fetch, specular as BC4. Fetches then decode the blocks directly.
+    void compress();
+    bool compressed() const { return isCompressed; }
+    size_t textureBytes() const;  // of the maps in their current form
+
    private:
     TGAImage diffuseMap;
     TGAImage normalMap;
     TGAImage specularMap;
-};
\ No newline at end of file
+    BlockTexture diffuseBlocks;
+    BlockTexture normalBlocks;
+    BlockTexture specularBlocks;
+    bool isCompressed = false;
+    bool mapsLoaded = true;
+};
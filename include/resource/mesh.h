@@ -1,9 +1,25 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <string>
 #include <vector>
 
 #include "util/geometry.h"
 
+// structure-of-arrays copy of the vertex positions, consumed by the batched vertex kernels
+struct PositionStream {
+    std::vector<float> x, y, z;
+
+    size_t size() const { return x.size(); }
+};
+
+// joints influencing one position, the weights sum to 1 and unused slots have weight 0
+struct SkinWeights {
+    uint16_t joints[4];
+    float weights[4];
+};
+
 class Mesh {
    public:
     Mesh(const std::string& filename);
@@ -28,10 +44,72 @@ class Mesh {
     std::vector<int> face_uv(const int& idx) const;
     std::vector<int> face_normal(const int& idx) const;
     const std::vector<Vertex>& face(const int& idx) const;
+    const PositionStream& positions() const { return positionStream; }
+
+    // Level of detail chain built by quadric error simplification (meshLod.cpp): every level has about half the
+    // faces of the previous one. Vertices on uv / normal seams and open borders are never moved, so texture charts
+    // and silhouettes stay intact. Level 0 is the mesh itself.
+    void buildLods(int maxLevels = 6, size_t minFaces = 64);
+    int nlods() const { return 1 + static_cast<int>(lods.size()); }
+    // level clamped to the chain
+    const Mesh* lod(int level) const {
+        return level <= 0 || lods.empty() ? this : &lods[std::min(level, nlods() - 1) - 1];
+    }
+    // largest distance any collapse moved the surface of a level, in object space
+    float lodError(int level) const { return lod(level)->error; }
+    const Vec3f& boundCenter() const { return center; }
+    float boundRadius() const { return radius; }
+
+    // runs of ClusterFaces consecutive faces, which the vertex cache order keeps close together in space; the renderer
+    // draws them front to back when depth sorting (Renderer::setDepthSort())
+    struct Cluster {
+        uint32_t firstFace;
+        uint32_t nfaces;
+        Vec3f center;  // of the bounding box of their positions
+    };
+    static constexpr size_t ClusterFaces = 16;
+    const std::vector<Cluster>& clusters() const { return faceClusters; }
+
+    // Load-time reordering (meshOptimize.cpp): faces in vertex cache order (Forsyth), restarting near the last face
+    // in uv space when the cache runs dry, then positions, uvs and normals renumbered in the order the faces fetch
+    // them. Every LOD level is reordered the same way.
+    void optimize();
+    // average cache miss ratio (misses per face on a 16 entry FIFO) of the file order and after optimize()
+    float acmrLoaded() const { return acmrBefore; }
+    float acmrOptimized() const { return acmrAfter; }
+
+    // Linear blend skinning data (see render/skinning.h), one entry per position in file order (as the "v" lines of
+    // the OBJ), remapped to the optimized order and carried over to every LOD level. Normals are skinned with the
+    // weights of the first position they are used with.
+    void setSkin(const std::vector<SkinWeights>& weights);
+    // optimized index of every position in file order, see optimize()
+    const std::vector<int>& filePositions() const { return filePosition; }
+    bool skinned() const { return !skin.empty(); }
+    const std::vector<SkinWeights>& skinWeights() const { return skin; }
+    const std::vector<int>& normalPositions() const { return normalPosition; }  // -1 for unused normals
 
    private:
+    Mesh() = default;
+    void finishLoad();  // position stream, bounding sphere and clusters
+    void bindSkin(const std::vector<SkinWeights>& weights);  // in the order of verts
+
     std::vector<Vec3f> verts;
     std::vector<Vec3f> uvs;
     std::vector<Vec3f> normals;
     std::vector<std::vector<Vertex>> faces;
-};
\ No newline at end of file
+    PositionStream positionStream;
+    Vec3f center;
+    float radius = 0.f;
+    std::vector<Cluster> faceClusters;
+    float error = 0.f;
+    float acmrBefore = 0.f;
+    float acmrAfter = 0.f;
+    std::vector<Mesh> lods;
+    std::vector<int> source;        // LOD levels, the base mesh position of every position
+    std::vector<int> filePosition;  // base mesh, empty for LOD levels
+    std::vector<SkinWeights> skin;
+    std::vector<int> normalPosition;  // levels 1 and up
+};
+
+// misses per face of a FIFO post-transform cache of cacheSize positions fed with the faces in order
+float vertex_cache_miss_ratio(const Mesh& mesh, int cacheSize = 16);
@@ -1,23 +1,49 @@
 #pragma once
 
+#include <algorithm>
 #include <vector>
 
 #include "resource/material.h"
 #include "resource/mesh.h"
+#include "resource/skeleton.h"
 #include "util/geometry.h"
 
 class Model {
    public:
     Model(Mesh* mesh, Material* material) : meshRes(mesh), materialRes(material), transform(Matrix4x4::identity()){};
 
-    Mesh* getMesh() const { return meshRes; }
+    // the mesh at the selected level of detail, see Mesh::buildLods()
+    const Mesh* getMesh() const { return meshRes->lod(lodLevel); }
+    const Mesh* getBaseMesh() const { return meshRes; }
     Material* getMaterial() const { return materialRes; }
 
     const Matrix4x4& getTransform() const { return transform; }
     void setTransform(const Matrix4x4& m) { transform = m; }
 
+    int getLod() const { return lodLevel; }
+    void setLod(int level) { lodLevel = std::max(0, std::min(level, meshRes->nlods() - 1)); }
+    // coarsest level whose error stays below maxError pixels while the bounding sphere covers pixelRadius pixels
+    void selectLod(float pixelRadius, float maxError = 1.f);
+
+    // joint transforms that skin the mesh when it has skin weights, not owned; null draws the rest pose
+    const Pose* getPose() const { return pose; }
+    void setPose(const Pose* p) { pose = p; }
+    // 0 when the model is drawn unskinned
+    unsigned getPoseVersion() const { return pose && meshRes->skinned() ? pose->getVersion() : 0; }
+
    private:
     Mesh* meshRes{nullptr};
     Material* materialRes{nullptr};
     Matrix4x4 transform;
-};
\ No newline at end of file
+    int lodLevel = 0;
+    const Pose* pose{nullptr};
+};
+
+// Copies of one mesh and material that differ only in their transform, see Renderer::render(). Level of detail and
+// pose of model apply to every instance, its own transform is ignored.
+struct InstanceBatch {
+    Model model;
+    std::vector<Matrix4x4> transforms;
+
+    InstanceBatch(Mesh* mesh, Material* material) : model(mesh, material) {}
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+
+#include "util/geometry.h"
+
+// Joint hierarchy of a skinned mesh. Joints are added parent first, so a single forward sweep computes the global
+// transforms. The bind transform takes joint space to model space in the rest pose of the mesh.
+class Skeleton {
+   public:
+    // index of the new joint, parent -1 for a root
+    int addJoint(int parent, const Matrix4x4& bind);
+
+    size_t njoints() const { return parents.size(); }
+    int parent(int joint) const { return parents[joint]; }
+    const Matrix4x4& bind(int joint) const { return binds[joint]; }
+    const Matrix4x4& inverseBind(int joint) const { return inverseBinds[joint]; }
+
+   private:
+    std::vector<int> parents;
+    std::vector<Matrix4x4> binds;
+    std::vector<Matrix4x4> inverseBinds;
+};
+
+// Local joint transforms of one skeleton and the skinning palette (global * inverse bind per joint) they produce.
+// update() rebuilds the palette and hands out a new version; skinned vertices are cached per mesh and version, so
+// a pose that did not change between passes or frames is skinned only once.
+class Pose {
+   public:
+    explicit Pose(const Skeleton& skeleton);  // the bind pose
+
+    const Skeleton& getSkeleton() const { return *skeleton; }
+    // transform of the joint relative to its parent, starts as the bind pose
+    const Matrix4x4& getLocal(int joint) const { return locals[joint]; }
+    void setLocal(int joint, const Matrix4x4& m) { locals[joint] = m; }
+    void update();
+
+    const std::vector<Matrix4x4>& getPalette() const { return palette; }
+    // unique over all poses, never 0
+    unsigned getVersion() const { return version; }
+
+   private:
+    const Skeleton* skeleton;
+    std::vector<Matrix4x4> locals;
+    std::vector<Matrix4x4> palette;
+    unsigned version = 0;
+};
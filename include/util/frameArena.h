@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+// Linear allocator for transient render data: per pass job lists, shader copies, skinning palettes. Every thread
+// has its own arena (local()), so stages never contend for the heap. allocate() bumps an offset in the current
+// block; nothing is freed one by one, a Scope rewinds the arena to where it was opened in O(1) instead. The
+// outermost scope of a frame (each job runs in one) therefore resets the arena at frame end. Blocks are kept, so
+// once an arena has grown to its high water mark, frames stop touching the heap.
+class FrameArena {
+   public:
+    // remembers the position at construction and rewinds to it on destruction, scopes nest like the stack
+    class Scope {
+       public:
+        explicit Scope(FrameArena& a) : arena(a), block(a.current), offset(a.offset), base(a.base) {}
+        ~Scope() { arena.rewind(block, offset, base); }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+       private:
+        FrameArena& arena;
+        size_t block;
+        size_t offset;
+        size_t base;
+    };
+
+    struct Stats {
+        size_t arenas = 0;     // threads that used an arena
+        size_t used = 0;       // bytes allocated right now
+        size_t highWater = 0;  // most bytes allocated at once, summed over the arenas
+        size_t reserved = 0;   // bytes in blocks
+    };
+
+    explicit FrameArena(size_t blockSize = 256 << 10);
+    ~FrameArena();
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    // the calling thread's arena
+    static FrameArena& local();
+    // over the arenas of all live threads
+    static Stats totals();
+    static void printStats(std::ostream& out);
+
+    void* allocate(size_t bytes, size_t alignment);
+    void reset() { rewind(0, 0, 0); }
+
+    size_t used() const { return base + offset; }
+    size_t highWater() const { return high; }
+    size_t reserved() const { return capacity; }
+
+   private:
+    struct Block {
+        std::unique_ptr<unsigned char[]> data;
+        size_t size;
+    };
+
+    void rewind(size_t block, size_t off, size_t b) {
+        current = block;
+        offset = off;
+        base = b;
+    }
+
+    size_t blockSize;
+    std::vector<Block> blocks;
+    size_t current = 0;   // block allocate() bumps
+    size_t offset = 0;    // into blocks[current]
+    size_t base = 0;      // bytes of the blocks before current
+    size_t high = 0;
+    size_t capacity = 0;
+};
+
+// std allocator over an arena, deallocate() does nothing; reserve() up front since growth leaves the old buffers
+template <typename T>
+class ArenaAllocator {
+   public:
+    using value_type = T;
+
+    explicit ArenaAllocator(FrameArena& a) : arena(&a) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T*, size_t) {}
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+
+   private:
+    template <typename U>
+    friend class ArenaAllocator;
+    FrameArena* arena;
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
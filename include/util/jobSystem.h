@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "util/frameArena.h"
+
+// Work stealing scheduler shared by every parallel stage (loading, skinning, vertex transform, raster, resolve).
+// Each worker owns a deque: jobs it submits go to the back and it takes its own work from the back (newest first,
+// still in cache), idle workers steal from the front of the others. Jobs submitted by other threads go to a shared
+// queue. A job becomes runnable once the jobs it depends on have finished. wait() runs queued jobs on the calling
+// thread instead of blocking, so a job may wait for the jobs it submitted; it must not hold a lock while doing so.
+// Jobs come from a free list and keep their callable inline, and the deques are ring buffers, so a warmed up
+// scheduler does not allocate. Each job runs inside a FrameArena::Scope of its thread.
+class JobSystem {
+   public:
+    class Job;
+    using Handle = std::shared_ptr<Job>;  // null counts as finished
+
+    struct WorkerStats {
+        uint64_t jobs = 0;    // jobs run
+        uint64_t steals = 0;  // of them taken from another worker's deque
+        double busyMs = 0.;   // time spent running them
+    };
+
+    // the process wide scheduler, one thread per hardware thread until setThreadCount()
+    static JobSystem& instance();
+
+    explicit JobSystem(int threads = 0);  // 0: one per hardware thread
+    ~JobSystem();
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // threads running jobs including the caller of wait(), so threads - 1 workers. Restarts the workers, call it
+    // while no job is pending.
+    void setThreadCount(int threads);
+    int getThreadCount() const { return static_cast<int>(queues.size()); }
+
+    // fn must fit Job::kInlineBytes, capture references or a pointer to bigger state; dependencies beyond
+    // kMaxDependencies are waited for through an extra empty join job
+    template <typename Fn>
+    Handle submit(Fn&& fn, std::initializer_list<Handle> dependencies = {});
+    static bool done(const Handle& job);
+    void wait(const Handle& job);
+    void wait(const std::vector<Handle>& jobs);
+
+    // fn(chunkBegin, chunkEnd) over [begin, end) in a few chunks per thread, each a multiple of grain long except the
+    // last one; the caller runs the first chunk and returns when all ran
+    template <typename Fn>
+    void parallelFor(size_t begin, size_t end, size_t grain, const Fn& fn);
+
+    // index 0 sums the threads outside the scheduler (jobs they run while waiting), then one entry per worker
+    std::vector<WorkerStats> getStats() const;
+    void resetStats();
+    // jobs, steals, busy time and utilisation (busy / wall time since the last reset) per worker
+    void printStats(std::ostream& out) const;
+
+   private:
+    static constexpr size_t kChunksPerThread = 4;
+
+    // deque of handles in a ring buffer that only grows
+    class HandleRing {
+       public:
+        bool empty() const { return !count; }
+        void push_back(Handle job);
+        Handle pop_back();
+        Handle pop_front();
+
+       private:
+        std::vector<Handle> slots;
+        size_t head = 0;
+        size_t count = 0;
+    };
+
+    struct alignas(64) Queue {
+        std::mutex mutex;
+        HandleRing jobs;
+        std::atomic<uint64_t> ran{0};
+        std::atomic<uint64_t> stolen{0};
+        std::atomic<uint64_t> busyUs{0};
+    };
+
+    void start(int threads);
+    void stop();
+    void workerLoop(size_t self);
+    static Handle allocate();
+    void schedule(const Handle& job, const Handle* dependencies, size_t count);
+    void enqueue(Handle job);
+    Handle take(size_t self, bool& stolen);
+    bool runOne(size_t self);
+    void finish(const Handle& job);
+    size_t self() const;  // queue index of the calling thread, 0 outside the scheduler
+    void sleep(const std::function<bool()>& wake);
+
+    std::vector<std::unique_ptr<Queue>> queues;  // 0: shared queue of outside threads, then one per worker
+    std::vector<std::thread> workers;
+    std::atomic<size_t> queued{0};
+    std::atomic<int> sleepers{0};
+    std::atomic<bool> stopping{false};
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    std::atomic<uint64_t> statsStartUs{0};
+};
+
+class JobSystem::Job {
+   public:
+    static constexpr size_t kInlineBytes = 64;
+    static constexpr size_t kMaxDependencies = 4;
+
+    Job() = default;
+    ~Job() { release(); }
+    Job(const Job&) = delete;
+    Job& operator=(const Job&) = delete;
+
+   private:
+    friend class JobSystem;
+
+    // entry in the continuation list of a dependency, owned by the waiting job
+    struct Link {
+        Handle job;
+        Link* next = nullptr;
+    };
+
+    void run() { invoke(storage); }
+    void release() {
+        if (destroy) destroy(storage);
+        destroy = nullptr;
+    }
+
+    alignas(std::max_align_t) unsigned char storage[kInlineBytes];  // the callable
+    void (*invoke)(void*) = nullptr;
+    void (*destroy)(void*) = nullptr;
+    std::atomic<int> pending{1};  // unfinished dependencies, plus one until submit() is through
+    std::atomic<bool> finished{false};
+    std::mutex mutex;  // guards continuations against finishing
+    Link* continuations = nullptr;
+    Link links[kMaxDependencies];
+};
+
+template <typename Fn>
+JobSystem::Handle JobSystem::submit(Fn&& fn, std::initializer_list<Handle> dependencies) {
+    using Callable = typename std::decay<Fn>::type;
+    static_assert(sizeof(Callable) <= Job::kInlineBytes && alignof(Callable) <= alignof(std::max_align_t),
+                  "job captures do not fit inline");
+    Handle job = allocate();
+    new (job->storage) Callable(std::forward<Fn>(fn));
+    job->invoke = [](void* f) { (*static_cast<Callable*>(f))(); };
+    job->destroy = [](void* f) { static_cast<Callable*>(f)->~Callable(); };
+    schedule(job, dependencies.begin(), dependencies.size());
+    return job;
+}
+
+template <typename Fn>
+void JobSystem::parallelFor(size_t begin, size_t end, size_t grain, const Fn& fn) {
+    if (end <= begin) return;
+    grain = std::max<size_t>(grain, 1);
+    const size_t count = end - begin;
+    const size_t nchunks = std::min(queues.size() * kChunksPerThread, (count + grain - 1) / grain);
+    if (nchunks <= 1) {
+        fn(begin, end);
+        return;
+    }
+    const size_t step = ((count + nchunks - 1) / nchunks + grain - 1) / grain * grain;
+    FrameArena& arena = FrameArena::local();
+    FrameArena::Scope scope(arena);
+    ArenaVector<Handle> chunks{ArenaAllocator<Handle>(arena)};
+    chunks.reserve(nchunks);
+    for (size_t first = begin + step; first < end; first += step)
+        chunks.push_back(submit([&fn, first, end, step]() { fn(first, std::min(end, first + step)); }));
+    fn(begin, std::min(end, begin + step));
+    for (const Handle& chunk : chunks) wait(chunk);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "util/jobSystem.h"
+
+// Split [begin, end) into a few chunks per JobSystem thread and call fn(chunkBegin, chunkEnd) on each, the calling
+// thread takes part and returns when every chunk ran. Chunk sizes are multiples of grain, so kernels working in
+// fixed-width batches only see a ragged tail at the end. Safe to nest, e.g. inside a job.
+template <typename Fn>
+void parallel_for(size_t begin, size_t end, size_t grain, const Fn& fn) {
+    JobSystem::instance().parallelFor(begin, end, grain, fn);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+// Pipeline instrumentation. The PROFILE_* macros compile to nothing unless MINIRENDERER_PROFILE is defined
+// (cmake -DMINIRENDERER_PROFILE=ON), so the hot loops pay nothing in normal builds.
+// PROFILE_ONLY(...) keeps local tallies that hot loops flush with one PROFILE_COUNT per triangle.
+
+enum class Counter {
+    TrianglesSubmitted,
+    TrianglesCulled,  // degenerate or completely off screen
+    TrianglesRasterized,
+    PixelsCovered,
+    PixelsDepthRejected,
+    PixelsShaded,  // fragment() calls while rasterizing, in visibility mode these only write ids
+    PixelsDiscarded,
+    PixelsResolved,      // fragment() calls of the deferred resolve, once per visible pixel
+    PixelsVisible,       // covered pixels at the end of the main pass
+    MainPassShades,      // full fragment() calls of the main pass, forward or resolve
+    ShadowPassesReused,  // shadowPass() calls served from the cached shadow map
+    TilesRedrawn,        // TileMask tiles cleared and rasterized again, shadow and main pass
+    DepthTilesAccepted,  // compressed depth tiles a triangle covered and passed as a whole
+    DepthTilesRejected,  // compressed depth tiles a triangle covered and failed as a whole
+    InstancesDrawn,      // InstanceBatch copies inside the view of a pass
+    InstancesCulled,     // InstanceBatch copies rejected before their vertex stage
+    Count
+};
+
+struct PipelineCounters {
+    uint64_t value[static_cast<size_t>(Counter::Count)] = {};
+
+    uint64_t operator[](Counter c) const { return value[static_cast<size_t>(c)]; }
+};
+
+class Profiler {
+   public:
+    // counters and events are kept per thread and only merged when read
+    static void add(Counter c, uint64_t n);
+    static void addEvent(const char* name, uint64_t startUs, uint64_t durationUs);
+    static uint64_t nowUs();
+
+    static void reset();
+    static PipelineCounters counters();
+    // the calling thread's share, so a pass can tally its own work while other passes run
+    static uint64_t threadCount(Counter c);
+    static const char* counterName(Counter c);
+
+    // counter totals followed by the time per scope name and thread
+    static void printSummary(std::ostream& out);
+    // chrome://tracing / Perfetto trace-event JSON
+    static bool writeChromeTrace(const std::string& filename);
+};
+
+// times the enclosing block as one trace event on the calling thread
+class ProfileScope {
+   public:
+    explicit ProfileScope(const char* n) : name(n), start(Profiler::nowUs()) {}
+    ~ProfileScope() { Profiler::addEvent(name, start, Profiler::nowUs() - start); }
+
+   private:
+    const char* name;
+    uint64_t start;
+};
+
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+
+#ifdef MINIRENDERER_PROFILE
+#define PROFILE_COUNT(counter, n) Profiler::add(counter, n)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_ONLY(...) __VA_ARGS__
+#else
+#define PROFILE_COUNT(counter, n) ((void)0)
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_ONLY(...)
+#endif
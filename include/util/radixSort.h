@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// Sort key of a float: unsigned order of the keys is the order of the floats (negative ones included, no NaNs).
+inline uint32_t float_sort_key(float f) {
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+}
+
+// Sort item of a key and a payload (e.g. an index), radix_sort() orders by the key only.
+inline uint64_t sort_item(uint32_t key, uint32_t payload) { return static_cast<uint64_t>(key) << 32 | payload; }
+inline uint32_t sort_payload(uint64_t item) { return static_cast<uint32_t>(item); }
+
+// Stable least significant digit radix sort of n items by their key, 8 bits per pass; scratch must hold n items too.
+// Passes over a byte every key shares are skipped, so keys from a narrow range cost fewer passes. The result ends up
+// in items.
+void radix_sort(uint64_t* items, uint64_t* scratch, size_t n);
@@ -0,0 +1,8 @@
+#pragma once
+
+// MINIRENDERER_SSE2 is defined where the SSE2 intrinsics can be used unconditionally (every x86-64 target), the
+// vectorized paths fall back to plain loops elsewhere.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MINIRENDERER_SSE2
+#endif
@@ -2,6 +2,7 @@
 #define __IMAGE_H__
 
 #include <fstream>
+#include <iostream>
 #include "geometry.h"
 
 #pragma pack(push, 1)
@@ -74,8 +75,8 @@ class TGAImage {
     int height;
     int bytespp;
 
-    bool load_rle_data(std::ifstream &in);
-    bool unload_rle_data(std::ofstream &out);
+    bool load_rle_data(std::ifstream &in, std::ostream &log);
+    bool unload_rle_data(std::ostream &out);
 
    public:
     enum Format { GRAYSCALE = 1, RGB = 3, RGBA = 4 };
@@ -83,8 +84,10 @@ class TGAImage {
     TGAImage();
     TGAImage(int w, int h, int bpp);
     TGAImage(const TGAImage &img);
-    bool read_tga_file(const char *filename);
+    // errors and the size of the loaded image go to log
+    bool read_tga_file(const char *filename, std::ostream &log = std::cerr);
     bool write_tga_file(const char *filename, bool rle = true);
+    bool write_tga(std::ostream &out, bool rle = true);
     bool flip_horizontally();
     bool flip_vertically();
     bool scale(int w, int h);
@@ -96,7 +99,24 @@ class TGAImage {
     int get_height() const;
     int get_bytespp() const;
     unsigned char *buffer();
+    const unsigned char *buffer() const;
     void clear();
 };
 
+// Uncompressed TGA written piecewise: header and footer go out on open, pixel runs can then be written at any
+// position in any order, so an image larger than memory can be produced tile by tile. Row 0 is the bottom row.
+class TGAStreamWriter {
+   public:
+    TGAStreamWriter(const char *filename, int w, int h, int bpp);
+    bool good() const { return out.good(); }
+    // count pixels starting at (x, y)
+    bool write_pixels(int x, int y, const unsigned char *pixels, int count);
+
+   private:
+    std::ofstream out;
+    int width;
+    int height;
+    int bytespp;
+};
+
 #endif  //__IMAGE_H__
\ No newline at end of file
@@ -1,10 +1,17 @@
 #include "graphics.h"
 
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
 
-Matrix4x4 View;
-Matrix4x4 Projection;
-Matrix4x4 Viewport;
+#include "render/depthBuffer.h"
+#include "render/multisample.h"
+#include "util/profiler.h"
+
+thread_local Matrix4x4 View;
+thread_local Matrix4x4 Projection;
+thread_local Matrix4x4 Viewport;
 
 void viewport(int x, int y, int w, int h) {
     Viewport = Matrix4x4::identity();
@@ -32,40 +39,355 @@ void lookat(Vec3f eye, Vec3f center, Vec3f up) {
     }
 }
 
-Vec3f barycentric(Vec3f a, Vec3f b, Vec3f c, Vec2i p) {
-    const Vec3f v0(b.x - a.x, c.x - a.x, a.x - p.x);
-    const Vec3f v1(b.y - a.y, c.y - a.y, a.y - p.y);
-    const Vec3f ans = cross(v0, v1);
-    if (std::abs(ans.z) < 1e-2) return {-1.f, -1.f, 1.f};
-    return {1.0f - (ans.x + ans.y) / ans.z, ans.x / ans.z, ans.y / ans.z};
-}
-
-void triangle(const Vec4f inPts[], const IShader& shader, TGAImage& output, float zbuffer[]) {
-    Vec2f min{static_cast<float>(output.get_width() - 1), static_cast<float>(output.get_height() - 1)};
-    Vec2f max{0, 0};
-    const Vec2f clamp = min;
-    Vec4f pts[4];
+void triangle(const Vec4f inPts[], const IShader& shader, TGAImage& output, DepthBuffer& depthBuffer) {
+    Vec4f pts[3];
     for (int i = 0; i < 3; ++i) {
         pts[i] = Viewport * inPts[i];
         pts[i] = (pts[i] / pts[i][3]).round();
-        for (int j = 0; j < 2; ++j) {
-            min[j] = std::max(0.f, std::min(min[j], pts[i][j]));
-            max[j] = std::min(clamp[j], std::max(max[j], pts[i][j]));
+        pts[i][3] = inPts[i][3];
+    }
+    rasterize(pts, shader, output, depthBuffer);
+}
+
+namespace {
+
+// fragment() for a pixel that passed the depth test, row holds pdy * y + pc of every plane, true when discarded
+inline bool fragment(const TriangleSetup& t, const IShader& shader, int x, int y, float z, const float row[],
+                     TGAColor& c) {
+    float value[TriangleSetup::MaxPlanes];
+    float varying[IShader::MaxVaryings];
+    for (int k = 1; k < t.nplanes; ++k) value[k] = t.pdx[k] * x + row[k];
+    const float invW = 1.f / (value[1] + value[2] + value[3]);
+    const Vec3f bar(value[1] * invW, value[2] * invW, value[3] * invW);
+    for (int k = 0; k < shader.nvaryings; ++k) varying[k] = value[4 + k] * invW;
+    return shader.fragment(Vec3f(x, y, z), bar, varying, c);
+}
+
+// fragment() into output, true when discarded
+inline bool shade(const TriangleSetup& t, const IShader& shader, int x, int y, float z, const float row[],
+                  TGAImage& output) {
+    TGAColor c;
+    if (fragment(t, shader, x, y, z, row, c)) return true;
+    output.set(x - t.ox, y - t.oy, c);
+    return false;
+}
+
+// row by row over an uncompressed buffer
+template <typename Codec>
+void raster_spans(const TriangleSetup& t, const IShader& shader, TGAImage& output, DepthBuffer& depthBuffer) {
+    PROFILE_ONLY(uint64_t covered = 0, rejected = 0, shaded = 0, discarded = 0);
+    unsigned char* pixels = depthBuffer.pixels();
+    const int width = depthBuffer.getWidth();
+    float row[TriangleSetup::MaxPlanes];
+    for (int y = t.y0; y <= t.y1; ++y) {
+        double e[3];
+        for (int i = 0; i < 3; ++i) e[i] = t.edx[i] * t.x0 + t.edy[i] * y + t.ec[i];
+        for (int k = 0; k < t.nplanes; ++k) row[k] = t.pdy[k] * y + t.pc[k];
+        for (int x = t.x0; x <= t.x1; ++x) {
+            if (e[0] >= 0 && e[1] >= 0 && e[2] >= 0) {
+                const float z = t.pdx[0] * x + row[0];
+                const typename Codec::Key key = Codec::encode(z);
+                unsigned char* p = pixels + static_cast<size_t>(x - t.ox + (y - t.oy) * width) * Codec::bytes;
+                PROFILE_ONLY(++covered);
+                if (Codec::load(p) < key) {
+                    PROFILE_ONLY(++shaded);
+                    if (!shade(t, shader, x, y, z, row, output)) {
+                        Codec::store(p, key);
+                    } else {
+                        PROFILE_ONLY(++discarded);
+                    }
+                } else {
+                    PROFILE_ONLY(++rejected);
+                }
+            }
+            for (int i = 0; i < 3; ++i) e[i] += t.edx[i];
         }
     }
+    PROFILE_COUNT(Counter::PixelsCovered, covered);
+    PROFILE_COUNT(Counter::PixelsDepthRejected, rejected);
+    PROFILE_COUNT(Counter::PixelsShaded, shaded);
+    PROFILE_COUNT(Counter::PixelsDiscarded, discarded);
+}
 
-    Vec2i p;
-    for (p.x = static_cast<int>(min.x); p.x <= max.x; ++p.x)
-        for (p.y = static_cast<int>(min.y); p.y <= max.y; ++p.y) {
-            const Vec3f bc_screen = barycentric(projection<3>(pts[0]), projection<3>(pts[1]), projection<3>(pts[2]), p);
-            if (bc_screen.x < 0 || bc_screen.y < 0 || bc_screen.z < 0) continue;
-            const float z = bc_screen.x * pts[0][2] + bc_screen.y * pts[1][2] + bc_screen.z * pts[2][2];
-            if (zbuffer[static_cast<int>(p.x + p.y * output.get_width())] < z) {
-                TGAColor c;
-                if (!shader.fragment(Vec3f(p.x, p.y, z), bc_screen, c)) {
-                    zbuffer[static_cast<int>(p.x + p.y * output.get_width())] = z;
-                    output.set(p.x, p.y, c);
+// smallest and largest value of a plane over a tile, widened by the float rounding of its evaluation
+inline void plane_range(float a, float b, float c, int x0, int y0, float& lo, float& hi) {
+    constexpr int S = DepthBuffer::TileSize;
+    const float corners[4] = {a * x0 + (b * y0 + c), a * (x0 + S - 1) + (b * y0 + c), a * x0 + (b * (y0 + S - 1) + c),
+                              a * (x0 + S - 1) + (b * (y0 + S - 1) + c)};
+    const float err =
+        4.f * std::numeric_limits<float>::epsilon() * (std::abs(a) * (x0 + S) + std::abs(b) * (y0 + S) + std::abs(c));
+    lo = std::min(std::min(corners[0], corners[1]), std::min(corners[2], corners[3])) - err;
+    hi = std::max(std::max(corners[0], corners[1]), std::max(corners[2], corners[3])) + err;
+}
+
+// tile by tile over a compressed buffer: whole tiles are accepted or rejected against a clear or plane tile without
+// touching pixels, everything else is tested per pixel against the tile's plane or its expanded storage
+template <typename Codec>
+void raster_tiles(const TriangleSetup& t, const IShader& shader, TGAImage& output, DepthBuffer& depthBuffer) {
+    using Key = typename Codec::Key;
+    constexpr int S = DepthBuffer::TileSize;
+    PROFILE_ONLY(uint64_t covered = 0, rejected = 0, shaded = 0, discarded = 0, accepted = 0, culled = 0);
+    float row[TriangleSetup::MaxPlanes];
+    for (int ty = t.y0 / S; ty <= t.y1 / S; ++ty)
+        for (int tx = t.x0 / S; tx <= t.x1 / S; ++tx) {
+            const int bx = tx * S, by = ty * S;
+            const int cx0 = std::max(t.x0, bx), cx1 = std::min(t.x1, bx + S - 1);
+            const int cy0 = std::max(t.y0, by), cy1 = std::min(t.y1, by + S - 1);
+            DepthBuffer::Tile& tile = depthBuffer.tile(tx, ty);
+            // the triangle is convex, so all four corner pixels inside means the whole tile is
+            const bool whole = cx0 == bx && cy0 == by && cx1 == bx + S - 1 && cy1 == by + S - 1 && t.inside(bx, by) &&
+                               t.inside(cx1, by) && t.inside(bx, cy1) && t.inside(cx1, cy1);
+            if (whole && tile.state != DepthBuffer::Tile::Pixels) {
+                bool accept = tile.state == DepthBuffer::Tile::Clear;
+                if (!accept) {
+                    float zlo, zhi, slo, shi;
+                    plane_range(t.pdx[0], t.pdy[0], t.pc[0], bx, by, zlo, zhi);
+                    plane_range(tile.a, tile.b, tile.c, bx, by, slo, shi);
+                    if (Codec::encode(zhi) <= Codec::encode(slo)) {
+                        PROFILE_ONLY(++culled, covered += S * S, rejected += S * S);
+                        continue;
+                    }
+                    accept = Codec::encode(zlo) > Codec::encode(shi);
+                }
+                if (accept) {
+                    // every pixel passes, the tile becomes this triangle's plane unless the shader discards
+                    uint64_t discards = 0;
+                    for (int y = by; y < by + S; ++y) {
+                        for (int k = 0; k < t.nplanes; ++k) row[k] = t.pdy[k] * y + t.pc[k];
+                        for (int x = bx; x < bx + S; ++x)
+                            if (shade(t, shader, x, y, t.pdx[0] * x + row[0], row, output))
+                                discards |= uint64_t(1) << ((x - bx) + (y - by) * S);
+                    }
+                    PROFILE_ONLY(++accepted, covered += S * S, shaded += S * S);
+                    if (!discards) {
+                        depthBuffer.setPlane(tx, ty, t.pdx[0], t.pdy[0], t.pc[0]);
+                        continue;
+                    }
+                    unsigned char* px = depthBuffer.expand(tx, ty);
+                    for (int i = 0; i < S * S; ++i) {
+                        if (discards >> i & 1) {
+                            PROFILE_ONLY(++discarded);
+                            continue;
+                        }
+                        Codec::store(px + i * Codec::bytes, Codec::encode(t.z(bx + i % S, by + i / S)));
+                    }
+                    continue;
+                }
+            }
+
+            unsigned char* px = tile.state == DepthBuffer::Tile::Pixels ? depthBuffer.expand(tx, ty) : nullptr;
+            int written = 0;
+            for (int y = cy0; y <= cy1; ++y) {
+                double e[3];
+                for (int i = 0; i < 3; ++i) e[i] = t.edx[i] * cx0 + t.edy[i] * y + t.ec[i];
+                for (int k = 0; k < t.nplanes; ++k) row[k] = t.pdy[k] * y + t.pc[k];
+                for (int x = cx0; x <= cx1; ++x) {
+                    if (e[0] >= 0 && e[1] >= 0 && e[2] >= 0) {
+                        const float z = t.pdx[0] * x + row[0];
+                        const Key key = Codec::encode(z);
+                        const int i = (x - bx) + (y - by) * S;
+                        const Key stored = px ? Codec::load(px + i * Codec::bytes)
+                                              : tile.state == DepthBuffer::Tile::Plane ? Codec::encode(tile.plane(x, y))
+                                                                                       : Codec::clearKey();
+                        PROFILE_ONLY(++covered);
+                        if (stored < key) {
+                            PROFILE_ONLY(++shaded);
+                            if (!shade(t, shader, x, y, z, row, output)) {
+                                if (!px) px = depthBuffer.expand(tx, ty);
+                                Codec::store(px + i * Codec::bytes, key);
+                                ++written;
+                            } else {
+                                PROFILE_ONLY(++discarded);
+                            }
+                        } else {
+                            PROFILE_ONLY(++rejected);
+                        }
+                    }
+                    for (int i = 0; i < 3; ++i) e[i] += t.edx[i];
                 }
             }
+            // every pixel now holds this triangle's plane, which is exactly what the plane would reproduce
+            if (whole && written == S * S) depthBuffer.setPlane(tx, ty, t.pdx[0], t.pdy[0], t.pc[0]);
         }
-}
\ No newline at end of file
+    PROFILE_COUNT(Counter::PixelsCovered, covered);
+    PROFILE_COUNT(Counter::PixelsDepthRejected, rejected);
+    PROFILE_COUNT(Counter::PixelsShaded, shaded);
+    PROFILE_COUNT(Counter::PixelsDiscarded, discarded);
+    PROFILE_COUNT(Counter::DepthTilesAccepted, accepted);
+    PROFILE_COUNT(Counter::DepthTilesRejected, culled);
+}
+
+// per sample coverage and depth, fragment() once per pixel at the pixel position for the samples that pass
+void raster_multisample(const TriangleSetup& t, const IShader& shader, MultisampleBuffer& target) {
+    PROFILE_ONLY(uint64_t covered = 0, rejected = 0, shaded = 0, discarded = 0);
+    const int n = target.getSamples();
+    double eoff[3][MultisampleBuffer::MaxSamples];  // edge function offsets of the samples, exact for 1/16 positions
+    Vec2f offset[MultisampleBuffer::MaxSamples];
+    for (int s = 0; s < n; ++s) {
+        offset[s] = target.sampleOffset(s);
+        for (int i = 0; i < 3; ++i) eoff[i][s] = t.edx[i] * offset[s].x + t.edy[i] * offset[s].y;
+    }
+    const MultisampleBuffer::DepthPlane plane{t.pdx[0], t.pdy[0], t.pc[0]};
+    float row[TriangleSetup::MaxPlanes];
+    float zrow[MultisampleBuffer::MaxSamples];
+    float zs[MultisampleBuffer::MaxSamples];
+    float depth[MultisampleBuffer::MaxSamples];
+    for (int y = t.y0; y <= t.y1; ++y) {
+        double e[3];
+        for (int i = 0; i < 3; ++i) e[i] = t.edx[i] * t.x0 + t.edy[i] * y + t.ec[i];
+        for (int k = 0; k < t.nplanes; ++k) row[k] = t.pdy[k] * y + t.pc[k];
+        for (int s = 0; s < n; ++s) zrow[s] = t.pdy[0] * (y + offset[s].y) + t.pc[0];
+        for (int x = t.x0; x <= t.x1; ++x) {
+            unsigned coverage = 0;
+            for (int s = 0; s < n; ++s) {
+                if (e[0] + eoff[0][s] < 0 || e[1] + eoff[1][s] < 0 || e[2] + eoff[2][s] < 0) continue;
+                coverage |= 1u << s;
+                zs[s] = t.pdx[0] * (x + offset[s].x) + zrow[s];
+            }
+            for (int i = 0; i < 3; ++i) e[i] += t.edx[i];
+            if (!coverage) continue;
+            PROFILE_ONLY(++covered);
+            target.depth(x, y, depth);
+            unsigned mask = 0;
+            for (int s = 0; s < n; ++s)
+                if ((coverage >> s & 1) && depth[s] < zs[s]) mask |= 1u << s;
+            if (!mask) {
+                PROFILE_ONLY(++rejected);
+                continue;
+            }
+            PROFILE_ONLY(++shaded);
+            TGAColor c;
+            if (fragment(t, shader, x, y, t.pdx[0] * x + row[0], row, c)) {
+                PROFILE_ONLY(++discarded);
+                continue;
+            }
+            target.write(x, y, mask, c.val, plane, zs);
+        }
+    }
+    PROFILE_COUNT(Counter::PixelsCovered, covered);
+    PROFILE_COUNT(Counter::PixelsDepthRejected, rejected);
+    PROFILE_COUNT(Counter::PixelsShaded, shaded);
+    PROFILE_COUNT(Counter::PixelsDiscarded, discarded);
+}
+
+// edge functions and planes of the triangle, with the bounding box clipped to [lo, hi], false when nothing is covered
+bool setup_triangle(const Vec4f pts[], const IShader& shader, const Vec2f& lo, const Vec2f& hi, TriangleSetup& t) {
+    Vec2f min = hi;
+    Vec2f max = lo;
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 2; ++j) {
+            min[j] = std::max(lo[j], std::min(min[j], pts[i][j]));
+            max[j] = std::min(hi[j], std::max(max[j], pts[i][j]));
+        }
+    }
+    // off screen or zero area
+    const double area = (static_cast<double>(pts[1][0]) - pts[0][0]) * (pts[2][1] - pts[0][1]) -
+                        (static_cast<double>(pts[2][0]) - pts[0][0]) * (pts[1][1] - pts[0][1]);
+    if (min.x > max.x || min.y > max.y || std::abs(area) < 1e-2) return false;
+
+    t.x0 = static_cast<int>(min.x);
+    t.y0 = static_cast<int>(min.y);
+    t.x1 = static_cast<int>(max.x);
+    t.y1 = static_cast<int>(max.y);
+    t.ox = t.oy = 0;
+    const double orient = area > 0 ? 1. : -1.;
+    for (int i = 0; i < 3; ++i) {
+        const Vec4f& a = pts[(i + 1) % 3];
+        const Vec4f& b = pts[(i + 2) % 3];
+        t.edx[i] = -orient * (static_cast<double>(b[1]) - a[1]);
+        t.edy[i] = orient * (static_cast<double>(b[0]) - a[0]);
+        t.ec[i] = -t.edx[i] * a[0] - t.edy[i] * a[1];
+    }
+    const float invArea = static_cast<float>(1. / std::abs(area));
+
+    // perspective correction needs positive clip w, without clipping fall back to screen space interpolation
+    const bool perspective = pts[0][3] > 1e-6f && pts[1][3] > 1e-6f && pts[2][3] > 1e-6f;
+    t.nplanes = 4 + shader.nvaryings;
+    float qdx[3], qdy[3], qc[3];
+    t.pdx[0] = t.pdy[0] = t.pc[0] = 0.f;
+    for (int i = 0; i < 3; ++i) {
+        const float scale = invArea / (perspective ? pts[i][3] : 1.f);
+        qdx[i] = static_cast<float>(t.edx[i]) * scale;
+        qdy[i] = static_cast<float>(t.edy[i]) * scale;
+        qc[i] = static_cast<float>(t.ec[i]) * scale;
+        t.pdx[0] += static_cast<float>(t.edx[i]) * invArea * pts[i][2];
+        t.pdy[0] += static_cast<float>(t.edy[i]) * invArea * pts[i][2];
+        t.pc[0] += static_cast<float>(t.ec[i]) * invArea * pts[i][2];
+    }
+    for (int k = 0; k < 3; ++k) {
+        t.pdx[1 + k] = qdx[k];
+        t.pdy[1 + k] = qdy[k];
+        t.pc[1 + k] = qc[k];
+    }
+    for (int k = 0; k < shader.nvaryings; ++k) {
+        float& dx = t.pdx[4 + k];
+        float& dy = t.pdy[4 + k];
+        float& c = t.pc[4 + k];
+        dx = dy = c = 0.f;
+        for (int i = 0; i < 3; ++i) {
+            dx += shader.vary_out[i][k] * qdx[i];
+            dy += shader.vary_out[i][k] * qdy[i];
+            c += shader.vary_out[i][k] * qc[i];
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+void rasterize(const Vec4f pts[], const IShader& shader, TGAImage& output, DepthBuffer& depthBuffer,
+               const Rect* scissor, int originX, int originY) {
+    PROFILE_COUNT(Counter::TrianglesSubmitted, 1);
+    Vec2f lo{static_cast<float>(originX), static_cast<float>(originY)};
+    Vec2f hi{static_cast<float>(originX + output.get_width() - 1),
+             static_cast<float>(originY + output.get_height() - 1)};
+    if (scissor) {
+        lo = Vec2f(std::max(lo.x, static_cast<float>(scissor->x0)), std::max(lo.y, static_cast<float>(scissor->y0)));
+        hi = Vec2f(std::min(hi.x, static_cast<float>(scissor->x1)), std::min(hi.y, static_cast<float>(scissor->y1)));
+    }
+    TriangleSetup t;
+    if (!setup_triangle(pts, shader, lo, hi, t)) {
+        PROFILE_COUNT(Counter::TrianglesCulled, 1);
+        return;
+    }
+    PROFILE_COUNT(Counter::TrianglesRasterized, 1);
+    t.ox = originX;
+    t.oy = originY;
+
+    dispatch_depth_format(depthBuffer.getFormat(), [&](auto codec) {
+        using Codec = decltype(codec);
+        if (depthBuffer.isCompressed())
+            raster_tiles<Codec>(t, shader, output, depthBuffer);
+        else
+            raster_spans<Codec>(t, shader, output, depthBuffer);
+    });
+}
+
+void rasterize(const Vec4f pts[], const IShader& shader, MultisampleBuffer& target, const Rect* scissor) {
+    PROFILE_COUNT(Counter::TrianglesSubmitted, 1);
+    Vec2f lo{0.f, 0.f};
+    Vec2f hi{static_cast<float>(target.getWidth() - 1), static_cast<float>(target.getHeight() - 1)};
+    if (scissor) {
+        lo = Vec2f(std::max(lo.x, static_cast<float>(scissor->x0)), std::max(lo.y, static_cast<float>(scissor->y0)));
+        hi = Vec2f(std::min(hi.x, static_cast<float>(scissor->x1)), std::min(hi.y, static_cast<float>(scissor->y1)));
+    }
+    // corners are whole pixels, so samples of pixels outside the box can not be covered
+    TriangleSetup t;
+    if (!setup_triangle(pts, shader, lo, hi, t)) {
+        PROFILE_COUNT(Counter::TrianglesCulled, 1);
+        return;
+    }
+    PROFILE_COUNT(Counter::TrianglesRasterized, 1);
+    raster_multisample(t, shader, target);
+}
+
+bool setup_shading(const Vec4f pts[], const IShader& shader, TriangleSetup& t) {
+    const float inf = std::numeric_limits<float>::max();
+    return setup_triangle(pts, shader, Vec2f(-inf, -inf), Vec2f(inf, inf), t);
+}
+
+bool shade_pixel(const TriangleSetup& t, const IShader& shader, int x, int y, TGAColor& c) {
+    float row[TriangleSetup::MaxPlanes];
+    for (int k = 0; k < t.nplanes; ++k) row[k] = t.pdy[k] * y + t.pc[k];
+    return fragment(t, shader, x, y, t.pdx[0] * x + row[0], row, c);
+}
@@ -1,96 +1,33 @@
 #include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "graphics.h"
-#include "resource/material.h"
-#include "resource/mesh.h"
-#include "resource/model.h"
+#include "render/depthBuffer.h"
+#include "render/drawCapture.h"
+#include "render/ibl.h"
+#include "render/progressiveRenderer.h"
+#include "render/renderService.h"
+#include "render/renderer.h"
+#include "render/scene.h"
+#include "render/tiledRenderer.h"
+#include "util/jobSystem.h"
+#include "util/profiler.h"
 #include "util/tgaImage.h"
 
-constexpr int width = 2048;
-constexpr int height = 2048;
-const Model* model = nullptr;  // current rendering model
-float* zbuffer = nullptr;
-float* shadowMap = nullptr;
+int width = 2048;  // --size
+int height = 2048;
 Vec3f light_dir{1.f, 1.f, 1.5f};
 const Vec3f eye_pos{1.f, 1.0f, 4.f};
 const Vec3f center{0.f, 0.f, 0.f};
 const Vec3f up{0.f, 1.f, 0.f};
 
-struct DepthShader : IShader {
-    Matrix4x4 uniform_M;  // Projection * ModelView;
-
-    DepthShader(const Matrix4x4& M) : uniform_M(M){};
-
-    virtual Vec4f vertex(const int& faceIdx, const int& nthvert) {
-        const Vec4f vertex =
-            uniform_M * embed<4>(model->getMesh()->vert(model->getMesh()->face_vertex(faceIdx)[nthvert]));
-        return vertex;
-    }
-    virtual bool fragment(const Vec3f& viewCoord, const Vec3f bar, TGAColor& outColor) const {
-        outColor = TGAColor(255, 255, 255, 255) * (viewCoord.z / depth);
-        return false;
-    }
-};
-
-struct Shader : IShader {
-    Matrix4x4 uniform_M;              // Projection * ModelView;
-    Matrix4x4 uniform_shadow;         // ShadowMapVPM * (Viewport * Projection * ModelView).invert
-    Vec3f uniform_light_dir;          // uniform_M * lightdir
-    Matrix<2, 3, float> vary_uv;      // triangle uv coordinates, set by vs, read by ps
-    Matrix<3, 3, float> vary_normal;  // trangle noraml vector, set by vs, read by ps
-    Matrix<3, 3, float> vary_tri;     // triangle coordinates before viewport transform, set by vs, read by ps
-
-    Shader(const Matrix4x4& M, const Matrix4x4& MS)
-        : uniform_M(M),
-          uniform_shadow(MS),
-          uniform_light_dir(projection<3>(uniform_M * embed<4>(light_dir)).normalize()),
-          vary_uv(),
-          vary_tri() {}
-
-    virtual Vec4f vertex(const int& faceIdx, const int& nthvert) {
-        vary_uv.set_column(nthvert, model->getMesh()->uv(model->getMesh()->face_uv(faceIdx)[nthvert]));
-        vary_normal.set_column(nthvert, model->getMesh()->normal(model->getMesh()->face_normal(faceIdx)[nthvert]));
-        Vec4f vertex = uniform_M * embed<4>(model->getMesh()->vert(model->getMesh()->face_vertex(faceIdx)[nthvert]));
-        vary_tri.set_column(nthvert, projection<3>(vertex / vertex[3]));
-        return vertex;
-    }
-
-    virtual bool fragment(const Vec3f& viewCoord, const Vec3f bar, TGAColor& outColor) const {
-        const Vec2f uv = vary_uv * bar;
-        const Vec3f bn = (vary_normal * bar).normalize();
-
-        Matrix<3, 3, float> A;
-        A[0] = vary_tri.column(1) - vary_tri.column(0);
-        A[1] = vary_tri.column(2) - vary_tri.column(0);
-        A[2] = bn;
-
-        const Matrix<3, 3, float> AI = A.invert();
-        const Vec3f i = AI * Vec3f(vary_uv[0][1] - vary_uv[0][0], vary_uv[0][2] - vary_uv[0][0], 0.f);
-        const Vec3f j = AI * Vec3f(vary_uv[1][1] - vary_uv[1][0], vary_uv[1][2] - vary_uv[1][0], 0.f);
-        Matrix<3, 3, float> B;
-        B.set_column(0, i);
-        B.set_column(1, j);
-        B.set_column(2, bn);
-
-        const Vec3f n = (B * model->getMaterial()->normal(uv)).normalize();
-
-        Vec4f sm_p = uniform_shadow * embed<4>(viewCoord);
-        sm_p = sm_p / sm_p[3];
-        const int shadowPos = static_cast<int>(sm_p[0] + 0.5) + static_cast<int>(sm_p[1] + 0.5) * width;
-        const float shadow = 0.3f + 0.7f * (shadowMap[shadowPos] < sm_p[2] + 8.1f);  // magic coeff to avoid z-fighting
-
-        const Vec3f r = n * (uniform_light_dir * n) * 2 - uniform_light_dir;
-        const float spec = std::pow(std::max(r.z, 0.f), model->getMaterial()->specular(uv));
-        const float diff = std::max(0.f, uniform_light_dir * n);
-        outColor = model->getMaterial()->diffuse(uv);
-        for (size_t i = 0; i < 3; ++i)
-            outColor[i] =
-                static_cast<unsigned char>(std::min(5.f + outColor[i] * shadow * (1.2f * diff + 0.6f * spec), 255.f));
-        return false;
-    }
-};
-
-float max_elevation_angle(float* zbuffer, Vec2f p, Vec2f dir) {
+float max_elevation_angle(const DepthBuffer& zbuffer, Vec2f p, Vec2f dir) {
     float maxangle = 0;
     for (float t = 0.; t < 1000.; t += 1.) {
         Vec2f cur = p + dir * t;
@@ -98,88 +35,266 @@ float max_elevation_angle(float* zbuffer, Vec2f p, Vec2f dir) {
 
         float distance = (p - cur).norm();
         if (distance < 1.f) continue;
-        float elevation = zbuffer[int(cur.x) + int(cur.y) * width] - zbuffer[int(p.x) + int(p.y) * width];
+        float elevation = zbuffer.get(int(cur.x), int(cur.y)) - zbuffer.get(int(p.x), int(p.y));
         maxangle = std::max(maxangle, atanf(elevation / distance));
     }
     return maxangle;
 }
 
-int main(int argc, char** argv) {
-    std::vector<std::string> modelsFilename{
-        {"../resource/boggie/body"},
-        {"../resource/boggie/eyes"},
-        {"../resource/boggie/head"},
+// MiniRenderer --serve [SOCKET] [--threads N] [--queue N] [--resource DIR] [--output DIR] [--assets N]
+//                      [--compress-textures] [--jobs N]
+int serve(int argc, char** argv) {
+    std::string socketPath;
+    std::string resourceDir = "../resource";
+    std::string outputDir;  // empty: images only come back in the replies
+    int assets = 64;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    int queue = 64;
+    bool compressTextures = false;
+    // value of a count option, false (with a message) unless it is a number of at least min
+    const auto count = [](const std::string& option, const char* value, int min, int& out) {
+        char* end;
+        const long n = std::strtol(value, &end, 10);
+        if (end == value || *end || n < min || n > 1 << 20) {
+            std::cerr << "bad " << option << " " << value << ", expected a number >= " << min << std::endl;
+            return false;
+        }
+        out = static_cast<int>(n);
+        return true;
     };
-    std::vector<Mesh> meshs;
-    std::vector<Material> materials;
-    std::vector<Model> models;
-    meshs.reserve(modelsFilename.size());
-    materials.reserve(modelsFilename.size());
-    models.reserve(modelsFilename.size());
-    for (const std::string& filename : modelsFilename) {
-        meshs.emplace_back(filename + ".obj");
-        materials.emplace_back(filename + "_diffuse.tga", filename + "_nm_tangent.tga", filename + "_spec.tga");
-        models.emplace_back(&meshs.back(), &materials.back());
+    for (int i = 2; i < argc; ++i) {
+        const std::string arg = argv[i];
+        int jobs;
+        if (arg == "--threads" && i + 1 < argc) {
+            if (!count(arg, argv[++i], 1, threads)) return 1;
+        } else if (arg == "--queue" && i + 1 < argc) {
+            if (!count(arg, argv[++i], 1, queue)) return 1;
+        } else if (arg == "--resource" && i + 1 < argc) {
+            resourceDir = argv[++i];
+        } else if (arg == "--output" && i + 1 < argc) {
+            outputDir = argv[++i];
+        } else if (arg == "--assets" && i + 1 < argc) {
+            if (!count(arg, argv[++i], 1, assets)) return 1;
+        } else if (arg == "--compress-textures") {
+            compressTextures = true;
+        } else if (arg == "--jobs" && i + 1 < argc) {
+            if (!count(arg, argv[++i], 0, jobs)) return 1;
+            JobSystem::instance().setThreadCount(jobs);  // 0: all hardware threads
+        } else if (arg.compare(0, 1, "-") == 0) {
+            std::cerr << "unknown or incomplete option " << arg << std::endl;
+            return 1;
+        } else if (!socketPath.empty()) {
+            std::cerr << "second socket path " << arg << std::endl;
+            return 1;
+        } else {
+            socketPath = arg;
+        }
     }
+    RenderService service(resourceDir, outputDir, threads, queue, assets, compressTextures);
+    return socketPath.empty() ? serve_stdio(service) : serve_socket(service, socketPath);
+}
 
-    light_dir.norm();
+int main(int argc, char** argv) {
+    if (argc > 1 && std::string(argv[1]) == "--serve") return serve(argc, argv);
 
-    zbuffer = new float[width * height + 1];
-    for (int i = 0; i < width * height; ++i) zbuffer[i] = -std::numeric_limits<float>::max();
+    // --size and --tiled decide how the frame is allocated, read them first (and the options every renderer uses)
+    int tileSize = 0;
+    int progressiveLevels = 0;
+    bool ibl = false;
+    bool compressTextures = false;
+    bool jobStats = false;
+    std::string iblFile;  // empty: procedural sky
+    ShadowFilter shadowFilter;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--size" && i + 1 < argc) {
+            if (std::sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0 ||
+                width > 32767 || height > 32767) {
+                std::cerr << "bad --size " << argv[i] << ", expected WxH" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--tiled") {
+            tileSize = 256;
+            if (i + 1 < argc && std::atoi(argv[i + 1]) > 0) tileSize = std::atoi(argv[++i]);
+        } else if (arg == "--progressive") {
+            progressiveLevels = 4;
+            if (i + 1 < argc && std::atoi(argv[i + 1]) > 0) progressiveLevels = std::atoi(argv[++i]);
+        } else if (arg == "--ibl") {
+            ibl = true;
+            if (i + 1 < argc && std::string(argv[i + 1]).find(".tga") != std::string::npos) iblFile = argv[++i];
+        } else if (arg == "--compress-textures") {
+            compressTextures = true;
+        } else if (arg == "--jobs" && i + 1 < argc) {
+            JobSystem::instance().setThreadCount(std::atoi(argv[++i]));  // threads in total, 0: all hardware threads
+        } else if (arg == "--job-stats") {
+            jobStats = true;
+        } else if (arg == "--pcf" && i + 1 < argc) {
+            shadowFilter.radius = std::max(0, std::atoi(argv[++i]));
+        }
+    }
 
-    shadowMap = new float[width * height + 1];
-    for (int i = 0; i < width * height; ++i) zbuffer[i] = -std::numeric_limits<float>::max();
+    const std::string resourceDir = "../resource";
+    const std::vector<std::string> sceneFiles = scene_files(resourceDir, "boggie");
+    Scene scene(sceneFiles);
+    if (compressTextures) {
+        size_t raw = 0, compressed = 0;
+        for (size_t k = 0; k < scene.getModels().size(); ++k) {
+            Material& material = scene.getMaterial(k);
+            raw += material.textureBytes();
+            material.compress();
+            compressed += material.textureBytes();
+        }
+        std::cout << "textures: " << raw / 1024 << " KB raw, " << compressed / 1024 << " KB block compressed"
+                  << std::endl;
+    }
+    const Camera camera{eye_pos, center, up};
+    EnvironmentLighting environment;
+    if (ibl) {
+        // tables cached next to the binary as ibl_<hash>.bin
+        TGAImage env;
+        if (iblFile.empty()) {
+            env = procedural_environment(light_dir);
+        } else if (!env.read_tga_file(iblFile.c_str())) {
+            std::cerr << "can't read environment " << iblFile << std::endl;
+            return 1;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        environment.build(env, ".");
+        std::cout << "ibl: " << (environment.loadedFromCache() ? "loaded from cache" : "precomputed") << " in "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+                  << " ms" << std::endl;
+    }
+    if (tileSize) {
+        // frame buffers of one tile per thread, rows go straight to output.tga
+        TiledRenderer tiled(width, height, tileSize);
+        tiled.setShadowFilter(shadowFilter);
+        if (ibl) tiled.setEnvironment(&environment);
+        if (!tiled.render(scene.getModels(), light_dir, camera, "output.tga")) return 1;
+        tiled.printStats(std::cout);
+        if (jobStats) JobSystem::instance().printStats(std::cout);
+#ifdef MINIRENDERER_PROFILE
+        Profiler::printSummary(std::cout);
+        Profiler::writeChromeTrace("trace.json");
+#endif
+        return 0;
+    }
+
+    if (progressiveLevels) {
+        // coarse previews first, each written as preview_<level>.tga, the last level is output.tga
+        ProgressiveRenderer progressive(width, height, progressiveLevels);
+        progressive.setShadowFilter(shadowFilter);
+        if (ibl) progressive.setEnvironment(&environment);
+        std::vector<TGAImage> previews;
+        progressive.render(scene.getModels(), light_dir, camera,
+                           [&](int level, const TGAImage& image) { previews.push_back(image); });
+        for (size_t level = 0; level < previews.size(); ++level) {
+            previews[level].flip_vertically();
+            const std::string name = level + 1 < static_cast<size_t>(progressive.getLevels())
+                                         ? "preview_" + std::to_string(level) + ".tga"
+                                         : std::string("output.tga");
+            previews[level].write_tga_file(name.c_str());
+        }
+        progressive.printStats(std::cout);
+        if (jobStats) JobSystem::instance().printStats(std::cout);
+#ifdef MINIRENDERER_PROFILE
+        Profiler::printSummary(std::cout);
+        Profiler::writeChromeTrace("trace.json");
+#endif
+        return 0;
+    }
+
+    Renderer renderer(width, height);
+    renderer.setShadowFilter(shadowFilter);
+    if (ibl) renderer.setEnvironment(&environment);
+    // MiniRenderer [--size WxH] [--tiled [TILE]] [--progressive [LEVELS]] [--ibl [ENV.tga]] [--compress-textures]
+    //              [--jobs N] [--job-stats] [--visibility] [--pcf RADIUS] [--msaa 4|8] [--lod [MAX_ERROR_PX]]
+    //              [--shadow-format float32|unorm24|unorm16] [--depth-tiles] [--depth-sort] [--memory]
+    //              [--mesh-stats] [--capture FILE]
+    bool memoryReport = false;
+    bool meshStats = false;
+    float lodError = 0.f;     // 0: full detail
+    std::string captureFile;  // draw stream for MiniRendererReplay
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        DepthFormat format;
+        if (arg == "--visibility") {
+            renderer.setShadingMode(ShadingMode::Visibility);
+        } else if (arg == "--pcf" && i + 1 < argc) {
+            ++i;  // read with the options of every renderer
+        } else if (arg == "--shadow-format" && i + 1 < argc && parse_depth_format(argv[i + 1], format)) {
+            renderer.setShadowMapFormat(format);
+            ++i;
+        } else if (arg == "--msaa" && i + 1 < argc) {
+            renderer.setMultisample(std::atoi(argv[++i]));
+        } else if (arg == "--depth-tiles") {
+            renderer.setDepthFormat(DepthFormat::Float32, true);
+        } else if (arg == "--depth-sort") {
+            renderer.setDepthSort(true);
+        } else if (arg == "--lod") {
+            lodError = 1.f;
+            if (i + 1 < argc && std::atof(argv[i + 1]) > 0.f) lodError = static_cast<float>(std::atof(argv[++i]));
+        } else if (arg == "--memory") {
+            memoryReport = true;
+        } else if (arg == "--mesh-stats") {
+            meshStats = true;
+        } else if (arg == "--capture" && i + 1 < argc) {
+            captureFile = argv[++i];
+        }
+    }
+    if (meshStats) {
+        std::vector<const Mesh*> printed;
+        for (const Model& model : scene.getModels()) {
+            const Mesh* mesh = model.getBaseMesh();
+            if (std::find(printed.begin(), printed.end(), mesh) != printed.end()) continue;
+            printed.push_back(mesh);
+            std::cout << "mesh " << printed.size() - 1 << ": " << mesh->nfaces() << " faces, ACMR "
+                      << mesh->acmrLoaded() << " loaded, " << mesh->acmrOptimized() << " optimized" << std::endl;
+        }
+    }
+    if (lodError > 0.f) renderer.selectLods(scene.getModels(), camera, lodError);
+    DrawCapture capture;
+    if (!captureFile.empty()) renderer.setCapture(&capture);
 
     {
         // shadowmap
-        TGAImage depthOutput(width, height, TGAImage::RGB);
-        lookat(light_dir, center, up);
-        viewport(width / 8, height / 8, width * 3 / 4, height * 3 / 4);
-        projection(0);
-        for (const Model& m : models) {
-            model = &m;
-            Matrix4x4 ModelView = View * model->getTransform();
-            DepthShader depthShader(ModelView);
-            Vec4f screen_coord[3];
-            for (size_t i = 0; i < model->getMesh()->nfaces(); ++i) {
-                for (size_t j = 0; j < 3; ++j) {
-                    screen_coord[j] = depthShader.vertex(i, j);
-                }
-                triangle(screen_coord, depthShader, depthOutput, shadowMap);
-            }
-        }
+        renderer.shadowPass(scene.getModels(), light_dir, camera);
+        TGAImage depthOutput = renderer.getDepthOutput();
         depthOutput.flip_vertically();
         depthOutput.write_tga_file("depthOutput.tga");
     }
 
-    const Matrix4x4 shadowMapM = Viewport * Projection * View;
-
     // renderring
-    TGAImage output(width, height, TGAImage::RGB);
-    lookat(eye_pos, center, up);
-    viewport(width / 8, height / 8, width * 3 / 4, height * 3 / 4);
-    projection(-1.f / (eye_pos - center).norm());
-    for (const Model& m : models) {
-        model = &m;
-        Matrix4x4 ModelView = View * model->getTransform();
-        Shader shader(Projection * ModelView,
-                      shadowMapM * model->getTransform() * (Viewport * Projection * ModelView).invert());
-        Vec4f screen_coord[3];
-        for (size_t i = 0; i < model->getMesh()->nfaces(); ++i) {
-            for (size_t j = 0; j < 3; ++j) {
-                screen_coord[j] = shader.vertex(i, j);
-            }
-            triangle(screen_coord, shader, output, zbuffer);
-        }
-    }
+    renderer.mainPass(scene.getModels(), light_dir, camera);
+    TGAImage& output = renderer.getOutput();
     output.flip_vertically();
     output.write_tga_file("output.tga");
 
+    if (!captureFile.empty()) {
+        capture.resourceDir = resourceDir;
+        for (const std::string& file : sceneFiles) capture.modelFiles.push_back(file.substr(resourceDir.size() + 1));
+        capture.compressedTextures = compressTextures;
+        capture.environment = ibl;
+        capture.environmentFile = iblFile;
+        if (!capture.write(captureFile)) {
+            std::cerr << "can't write capture " << captureFile << std::endl;
+            return 1;
+        }
+    }
+
+    if (memoryReport) renderer.memoryReport(std::cout);
+    if (jobStats) JobSystem::instance().printStats(std::cout);
+
+#ifdef MINIRENDERER_PROFILE
+    Profiler::printSummary(std::cout);
+    Profiler::writeChromeTrace("trace.json");
+#endif
+
     // Post process
     // SSAO
+    // const DepthBuffer& zbuffer = renderer.getZBuffer();
     // for (int x = 0; x < width; x++) {
     //    for (int y = 0; y < height; y++) {
-    //        if (zbuffer[x + y * width] < -1e5) continue;
+    //        if (zbuffer.get(x, y) < -1e5) continue;
     //        float total = 0;
     //        for (float a = 0; a < PI * 2 - 1e-4; a += PI / 4) {
     //            total += PI / 2 - max_elevation_angle(zbuffer, Vec2f(x, y), Vec2f(cos(a), sin(a)));
@@ -191,7 +306,5 @@ int main(int argc, char** argv) {
     //                            static_cast<unsigned char>(total * 255), 255));
     //    }
     //}
-    delete[] zbuffer;
-    delete[] shadowMap;
     return 0;
-}
\ No newline at end of file
+}
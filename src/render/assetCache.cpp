@@ -0,0 +1,48 @@
+#include "render/assetCache.h"
+
+std::shared_ptr<AssetCache::Asset> AssetCache::get(const std::string& filename) {
+    std::shared_ptr<Entry> entry;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<Entry>& slot = entries[filename];
+        if (!slot) slot = std::make_shared<Entry>();
+        slot->lastUse = ++uses;
+        entry = slot;
+    }
+    std::shared_ptr<Asset> asset;
+    {
+        std::lock_guard<std::mutex> loading(entry->loading);
+        if (!entry->asset) entry->asset = load(filename);
+        asset = entry->asset;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!asset) {
+        auto it = entries.find(filename);
+        if (it != entries.end() && it->second == entry) entries.erase(it);
+        return asset;
+    }
+    while (entries.size() > capacity) {
+        auto oldest = entries.end();
+        for (auto it = entries.begin(); it != entries.end(); ++it)
+            if (it->second != entry && (oldest == entries.end() || it->second->lastUse < oldest->second->lastUse))
+                oldest = it;
+        entries.erase(oldest);
+    }
+    return asset;
+}
+
+std::shared_ptr<AssetCache::Asset> AssetCache::load(const std::string& filename) const {
+    std::shared_ptr<Asset> asset = std::make_shared<Asset>();
+    asset->mesh.reset(new Mesh(filename + ".obj"));
+    if (asset->mesh->nfaces() == 0) return nullptr;
+    asset->material.reset(
+        new Material(filename + "_diffuse.tga", filename + "_nm_tangent.tga", filename + "_spec.tga"));
+    if (!asset->material->loaded()) return nullptr;
+    if (compress) asset->material->compress();
+    return asset;
+}
+
+size_t AssetCache::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
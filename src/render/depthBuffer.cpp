@@ -0,0 +1,181 @@
+#include "render/depthBuffer.h"
+
+#include <iomanip>
+
+const char* depth_format_name(DepthFormat format) {
+    switch (format) {
+        case DepthFormat::Unorm24:
+            return "unorm24";
+        case DepthFormat::Unorm16:
+            return "unorm16";
+        default:
+            return "float32";
+    }
+}
+
+bool parse_depth_format(const std::string& name, DepthFormat& format) {
+    for (DepthFormat f : {DepthFormat::Float32, DepthFormat::Unorm24, DepthFormat::Unorm16})
+        if (name == depth_format_name(f)) {
+            format = f;
+            return true;
+        }
+    return false;
+}
+
+DepthBuffer::DepthBuffer(int w, int h, DepthFormat f, bool c)
+    : width(w),
+      height(h),
+      format(f),
+      compressed(c),
+      bytes(0),
+      tilesX((w + TileSize - 1) / TileSize),
+      tilesY((h + TileSize - 1) / TileSize) {
+    dispatch_depth_format(format, [&](auto codec) { bytes = decltype(codec)::bytes; });
+    blockBytes = static_cast<size_t>(TileSize) * TileSize * bytes;
+    if (compressed)
+        tiles.resize(tilesX * tilesY);
+    else
+        data.resize(static_cast<size_t>(width) * height * bytes);
+    clear();
+}
+
+void DepthBuffer::clear() {
+    if (compressed) {
+        std::fill(tiles.begin(), tiles.end(), Tile());
+        data.clear();
+        freeBlocks.clear();
+        return;
+    }
+    dispatch_depth_format(format, [&](auto codec) {
+        using Codec = decltype(codec);
+        if (Codec::clearKey() == 0) {
+            std::fill(data.begin(), data.end(), 0);
+        } else {
+            for (size_t i = 0; i < data.size(); i += Codec::bytes) Codec::store(&data[i], Codec::clearKey());
+        }
+    });
+}
+
+void DepthBuffer::clear(const Rect& r) {
+    const Rect c{std::max(r.x0, 0), std::max(r.y0, 0), std::min(r.x1, width - 1), std::min(r.y1, height - 1)};
+    if (c.empty()) return;
+    if (!compressed) {
+        dispatch_depth_format(format, [&](auto codec) {
+            using Codec = decltype(codec);
+            for (int y = c.y0; y <= c.y1; ++y)
+                for (int x = c.x0; x <= c.x1; ++x)
+                    Codec::store(&data[static_cast<size_t>(x + y * width) * Codec::bytes], Codec::clearKey());
+        });
+        return;
+    }
+    for (int ty = c.y0 / TileSize; ty <= c.y1 / TileSize; ++ty)
+        for (int tx = c.x0 / TileSize; tx <= c.x1 / TileSize; ++tx) {
+            const Rect t{tx * TileSize, ty * TileSize, std::min(width, (tx + 1) * TileSize) - 1,
+                         std::min(height, (ty + 1) * TileSize) - 1};
+            if (c.x0 <= t.x0 && c.y0 <= t.y0 && t.x1 <= c.x1 && t.y1 <= c.y1) {
+                release(tile(tx, ty));
+                tile(tx, ty).state = Tile::Clear;
+                continue;
+            }
+            for (int y = std::max(c.y0, t.y0); y <= std::min(c.y1, t.y1); ++y)
+                for (int x = std::max(c.x0, t.x0); x <= std::min(c.x1, t.x1); ++x)
+                    set(x, y, -std::numeric_limits<float>::max());
+        }
+}
+
+float DepthBuffer::get(int x, int y) const {
+    float z = 0.f;
+    dispatch_depth_format(format, [&](auto codec) {
+        using Codec = decltype(codec);
+        z = Codec::decode(key<Codec>(x, y));
+    });
+    return z;
+}
+
+void DepthBuffer::set(int x, int y, float z) {
+    dispatch_depth_format(format, [&](auto codec) {
+        using Codec = decltype(codec);
+        const typename Codec::Key k = z == -std::numeric_limits<float>::max() ? Codec::clearKey() : Codec::encode(z);
+        if (!compressed) {
+            Codec::store(&data[(x + y * width) * Codec::bytes], k);
+            return;
+        }
+        unsigned char* p = expand(x / TileSize, y / TileSize);
+        Codec::store(p + (x % TileSize + y % TileSize * TileSize) * Codec::bytes, k);
+    });
+}
+
+unsigned char* DepthBuffer::expand(int tx, int ty) {
+    Tile& t = tile(tx, ty);
+    if (t.state == Tile::Pixels) return data.data() + t.block * blockBytes;
+    if (freeBlocks.empty()) {
+        t.block = static_cast<int>(data.size() / blockBytes);
+        data.resize(data.size() + blockBytes);
+    } else {
+        t.block = freeBlocks.back();
+        freeBlocks.pop_back();
+    }
+    unsigned char* p = data.data() + t.block * blockBytes;
+    dispatch_depth_format(format, [&](auto codec) {
+        using Codec = decltype(codec);
+        for (int y = 0; y < TileSize; ++y)
+            for (int x = 0; x < TileSize; ++x) {
+                const typename Codec::Key k = t.state == Tile::Plane
+                                                  ? Codec::encode(t.plane(tx * TileSize + x, ty * TileSize + y))
+                                                  : Codec::clearKey();
+                Codec::store(p + (x + y * TileSize) * Codec::bytes, k);
+            }
+    });
+    t.state = Tile::Pixels;
+    return p;
+}
+
+void DepthBuffer::setPlane(int tx, int ty, float a, float b, float c) {
+    Tile& t = tile(tx, ty);
+    release(t);
+    t.state = Tile::Plane;
+    t.a = a;
+    t.b = b;
+    t.c = c;
+}
+
+void DepthBuffer::release(Tile& t) {
+    if (t.state == Tile::Pixels) freeBlocks.push_back(t.block);
+    t.block = -1;
+}
+
+DepthBuffer::Stats DepthBuffer::stats() const {
+    Stats s{0, static_cast<size_t>(width) * height * sizeof(float), 0, 0, 0};
+    if (!compressed) {
+        s.bytes = data.size();
+        return s;
+    }
+    for (const Tile& t : tiles) {
+        s.clearTiles += t.state == Tile::Clear;
+        s.planeTiles += t.state == Tile::Plane;
+        s.pixelTiles += t.state == Tile::Pixels;
+    }
+    s.bytes = tiles.size() * sizeof(Tile) + s.pixelTiles * blockBytes;
+    return s;
+}
+
+size_t DepthBuffer::coveredPixels() const {
+    size_t n = 0;
+    dispatch_depth_format(format, [&](auto codec) {
+        using Codec = decltype(codec);
+        for (int y = 0; y < height; ++y)
+            for (int x = 0; x < width; ++x) n += key<Codec>(x, y) != Codec::clearKey();
+    });
+    return n;
+}
+
+void print_depth_stats(std::ostream& out, const char* name, const DepthBuffer& buffer) {
+    const DepthBuffer::Stats s = buffer.stats();
+    out << std::left << std::setw(12) << name << std::setw(8) << depth_format_name(buffer.getFormat())
+        << (buffer.isCompressed() ? "tiled  " : "       ") << std::right << std::fixed << std::setprecision(2)
+        << std::setw(9) << s.bytes / 1048576. << " MB, saves " << std::setw(6)
+        << (static_cast<double>(s.float32Bytes) - s.bytes) / 1048576. << " MB vs float32";
+    if (buffer.isCompressed())
+        out << " (tiles clear " << s.clearTiles << ", plane " << s.planeTiles << ", pixels " << s.pixelTiles << ")";
+    out << std::defaultfloat << std::endl;
+}
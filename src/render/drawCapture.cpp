@@ -0,0 +1,209 @@
+#include "render/drawCapture.h"
+
+#include <algorithm>
+#include <fstream>
+
+namespace {
+
+const char kMagic[8] = {'M', 'R', 'D', 'R', 'A', 'W', 0, 0};
+const uint32_t kFormatVersion = 2;
+
+class Writer {
+   public:
+    explicit Writer(std::ofstream& o) : out(o) {}
+
+    template <typename T>
+    void pod(const T& value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+    void flag(bool value) { pod(static_cast<uint8_t>(value)); }
+    template <typename E>
+    void enumeration(E value) {
+        pod(static_cast<int32_t>(value));
+    }
+    template <typename T>
+    void array(const std::vector<T>& values) {
+        pod(static_cast<uint64_t>(values.size()));
+        out.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+    }
+    void string(const std::string& s) {
+        pod(static_cast<uint64_t>(s.size()));
+        out.write(s.data(), s.size());
+    }
+    void pass(const CapturedPass& p) {
+        pod(p.view);
+        pod(p.projection);
+        pod(p.viewport);
+        pod(static_cast<uint64_t>(p.vertices.size()));
+        for (const ScreenVertexBuffer& v : p.vertices) {
+            array(v.x);
+            array(v.y);
+            array(v.z);
+            array(v.w);
+        }
+        array(p.uniforms);
+    }
+
+   private:
+    std::ofstream& out;
+};
+
+class Reader {
+   public:
+    explicit Reader(std::ifstream& i) : in(i) {
+        in.seekg(0, std::ios::end);
+        size = static_cast<uint64_t>(std::max<std::streamoff>(0, in.tellg()));
+        in.seekg(0, std::ios::beg);
+    }
+
+    template <typename T>
+    void pod(T& value) {
+        in.read(reinterpret_cast<char*>(&value), sizeof(T));
+    }
+    void flag(bool& value) {
+        uint8_t b = 0;
+        pod(b);
+        if (b > 1) in.setstate(std::ios::failbit);
+        value = b == 1;
+    }
+    template <typename E>
+    void enumeration(E& value, E last) {
+        int32_t v = -1;
+        pod(v);
+        if (v < 0 || v > static_cast<int32_t>(last)) in.setstate(std::ios::failbit);
+        if (in) value = static_cast<E>(v);
+    }
+    // length of a list whose elements take at least elementBytes each, bounded by what is left of the file
+    uint64_t count(uint64_t elementBytes) {
+        uint64_t n = 0;
+        pod(n);
+        if (!in || n > remaining() / elementBytes) in.setstate(std::ios::failbit);
+        return in ? n : 0;
+    }
+    template <typename T>
+    void array(std::vector<T>& values) {
+        values.resize(count(sizeof(T)));
+        in.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(T));
+    }
+    void string(std::string& s) {
+        s.resize(count(1));
+        in.read(&s[0], s.size());
+    }
+    void pass(CapturedPass& p) {
+        pod(p.view);
+        pod(p.projection);
+        pod(p.viewport);
+        p.vertices.resize(count(4 * sizeof(uint64_t)));  // four array lengths each
+        for (ScreenVertexBuffer& v : p.vertices) {
+            array(v.x);
+            array(v.y);
+            array(v.z);
+            array(v.w);
+        }
+        array(p.uniforms);
+    }
+
+   private:
+    uint64_t remaining() {
+        const std::streamoff at = in.tellg();
+        return at < 0 || static_cast<uint64_t>(at) > size ? 0 : size - static_cast<uint64_t>(at);
+    }
+
+    std::ifstream& in;
+    uint64_t size = 0;
+};
+
+}  // namespace
+
+bool DrawCapture::write(const std::string& filename) const {
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open()) return false;
+    Writer w(out);
+    out.write(kMagic, sizeof(kMagic));
+    w.pod(kFormatVersion);
+    w.string(resourceDir);
+    w.pod(static_cast<uint64_t>(modelFiles.size()));
+    for (const std::string& file : modelFiles) w.string(file);
+    w.flag(compressedTextures);
+    w.flag(environment);
+    w.string(environmentFile);
+
+    w.pod(width);
+    w.pod(height);
+    w.enumeration(shadingMode);
+    w.pod(samples);
+    w.pod(shadowFilter);
+    w.enumeration(shadowFormat);
+    w.flag(shadowCompressed);
+    w.enumeration(depthFormat);
+    w.flag(depthCompressed);
+    w.flag(depthSort);
+    w.pod(lightDir);
+
+    w.array(transforms);
+    w.array(lods);
+    w.array(faces);
+    w.pod(static_cast<uint64_t>(normals.size()));
+    for (const std::vector<Vec3f>& n : normals) w.array(n);
+    w.pass(shadow);
+    w.pass(main);
+    w.pod(depthOutputHash);
+    w.pod(outputHash);
+    return out.good();
+}
+
+bool DrawCapture::read(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.is_open()) return false;
+    Reader r(in);
+    char magic[8];
+    uint32_t version = 0;
+    in.read(magic, sizeof(magic));
+    r.pod(version);
+    if (!in || !std::equal(magic, magic + sizeof(magic), kMagic) || version != kFormatVersion) return false;
+    r.string(resourceDir);
+    modelFiles.resize(r.count(sizeof(uint64_t)));
+    for (std::string& file : modelFiles) r.string(file);
+    r.flag(compressedTextures);
+    r.flag(environment);
+    r.string(environmentFile);
+
+    r.pod(width);
+    r.pod(height);
+    r.enumeration(shadingMode, ShadingMode::Visibility);
+    r.pod(samples);
+    r.pod(shadowFilter);
+    r.enumeration(shadowFormat, DepthFormat::Unorm16);
+    r.flag(shadowCompressed);
+    r.enumeration(depthFormat, DepthFormat::Unorm16);
+    r.flag(depthCompressed);
+    r.flag(depthSort);
+    r.pod(lightDir);
+
+    r.array(transforms);
+    r.array(lods);
+    r.array(faces);
+    normals.resize(r.count(sizeof(uint64_t)));
+    for (std::vector<Vec3f>& n : normals) r.array(n);
+    r.pass(shadow);
+    r.pass(main);
+    r.pod(depthOutputHash);
+    r.pod(outputHash);
+    if (!in) return false;
+    // every per model list must cover the same models
+    const size_t n = modelFiles.size();
+    return transforms.size() == n && lods.size() == n && faces.size() == n && normals.size() == n &&
+           shadow.vertices.size() == n && main.vertices.size() == n && shadow.uniforms.size() == n &&
+           main.uniforms.size() == 2 * n;
+}
+
+uint64_t image_hash(const TGAImage& image) {
+    uint64_t h = 14695981039346656037ull;
+    const unsigned char* p = image.buffer();
+    const size_t n = static_cast<size_t>(image.get_width()) * image.get_height() * image.get_bytespp();
+    for (size_t i = 0; i < n; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
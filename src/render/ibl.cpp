@@ -0,0 +1,381 @@
+#include "render/ibl.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+
+#include "util/parallel.h"
+#include "util/profiler.h"
+
+namespace {
+
+constexpr float kPi = 3.14159265358979f;
+constexpr uint32_t kFormatVersion = 1;  // bump when the tables or the way they are computed change
+constexpr int kSourceWidth = 256;       // the environment is resampled to this before filtering
+constexpr int kSpecularSamples = 128;
+constexpr int kLutSamples = 512;
+const char kMagic[8] = {'M', 'R', 'I', 'B', 'L', 0, 0, 0};
+
+// float rgb latitude / longitude image
+struct LatLong {
+    int width = 0;
+    int height = 0;
+    std::vector<Vec3f> texels;
+
+    LatLong() = default;
+    LatLong(int w, int h) : width(w), height(h), texels(static_cast<size_t>(w) * h, Vec3f(0.f, 0.f, 0.f)) {}
+    Vec3f& at(int x, int y) { return texels[x + static_cast<size_t>(y) * width]; }
+    const Vec3f& at(int x, int y) const { return texels[x + static_cast<size_t>(y) * width]; }
+};
+
+// u, v in [0, 1], v = 0 is straight up
+Vec3f direction(float u, float v) {
+    const float phi = (u - 0.5f) * 2.f * kPi, theta = v * kPi;
+    return Vec3f(std::sin(theta) * std::sin(phi), std::cos(theta), -std::sin(theta) * std::cos(phi));
+}
+
+// polynomial atan2 and acos (errors below 1e-4 radians, well under a texel), the lookups run once per pixel
+float fast_atan2(float y, float x) {
+    const float ax = std::fabs(x), ay = std::fabs(y);
+    const float a = std::min(ax, ay) / std::max(std::max(ax, ay), 1e-20f), s = a * a;
+    float r = ((-0.0464964749f * s + 0.15931422f) * s - 0.327622764f) * s * a + a;
+    if (ay > ax) r = 0.5f * kPi - r;
+    if (x < 0.f) r = kPi - r;
+    return y < 0.f ? -r : r;
+}
+
+float fast_acos(float x) {
+    const float ax = std::min(std::fabs(x), 1.f);
+    const float r = std::sqrt(1.f - ax) * (1.5707288f + ax * (-0.2121144f + ax * (0.0742610f - 0.0187293f * ax)));
+    return x < 0.f ? kPi - r : r;
+}
+
+Vec2f lat_long(const Vec3f& d) {
+    return Vec2f(fast_atan2(d.x, -d.z) * (0.5f / kPi) + 0.5f, fast_acos(d.y) * (1.f / kPi));
+}
+
+// wraps around in u, clamps in v
+Vec3f bilinear(const std::vector<Vec3f>& texels, int width, int height, float u, float v) {
+    const float fx = u * width - 0.5f, fy = std::min(std::max(v * height - 0.5f, 0.f), height - 1.f);
+    const int x0 = static_cast<int>(fx + 1.f) - 1, y0 = static_cast<int>(fy);  // fx >= -1, so this is floor
+    const float tx = fx - x0, ty = fy - y0;
+    const int xa = x0 < 0 ? width - 1 : x0 >= width ? x0 - width : x0, xb = xa + 1 == width ? 0 : xa + 1;
+    const Vec3f* row0 = &texels[static_cast<size_t>(y0) * width];
+    const Vec3f* row1 = y0 + 1 < height ? row0 + width : row0;
+    const float w00 = (1.f - tx) * (1.f - ty), w10 = tx * (1.f - ty), w01 = (1.f - tx) * ty, w11 = tx * ty;
+    return Vec3f(row0[xa].x * w00 + row0[xb].x * w10 + row1[xa].x * w01 + row1[xb].x * w11,
+                 row0[xa].y * w00 + row0[xb].y * w10 + row1[xa].y * w01 + row1[xb].y * w11,
+                 row0[xa].z * w00 + row0[xb].z * w10 + row1[xa].z * w01 + row1[xb].z * w11);
+}
+
+Vec3f bilinear(const LatLong& img, float u, float v) { return bilinear(img.texels, img.width, img.height, u, v); }
+
+// box filtered resample of the environment to width x width / 2
+LatLong resample(const TGAImage& env, int width) {
+    LatLong out(width, width / 2);
+    const int sw = env.get_width(), sh = env.get_height();
+    parallel_for(0, out.height, 1, [&](size_t begin, size_t end) {
+        for (int y = static_cast<int>(begin); y < static_cast<int>(end); ++y)
+            for (int x = 0; x < out.width; ++x) {
+                const int x0 = x * sw / out.width, x1 = std::max(x0 + 1, (x + 1) * sw / out.width);
+                const int y0 = y * sh / out.height, y1 = std::max(y0 + 1, (y + 1) * sh / out.height);
+                Vec3f sum(0.f, 0.f, 0.f);
+                for (int sy = y0; sy < y1; ++sy)
+                    for (int sx = x0; sx < x1; ++sx) {
+                        const TGAColor c = env.get(sx, sy);
+                        sum = sum + (env.get_bytespp() < 3 ? Vec3f(c.raw[0], c.raw[0], c.raw[0])
+                                                           : Vec3f(c.r, c.g, c.b));
+                    }
+                out.at(x, y) = sum * (1.f / (255.f * (x1 - x0) * (y1 - y0)));
+            }
+    });
+    return out;
+}
+
+std::vector<LatLong> mip_chain(LatLong base) {
+    std::vector<LatLong> chain;
+    chain.push_back(std::move(base));
+    while (chain.back().width > 4) {
+        const LatLong& src = chain.back();
+        LatLong next(src.width / 2, src.height / 2);
+        for (int y = 0; y < next.height; ++y)
+            for (int x = 0; x < next.width; ++x)
+                next.at(x, y) = (src.at(2 * x, 2 * y) + src.at(2 * x + 1, 2 * y) + src.at(2 * x, 2 * y + 1) +
+                                 src.at(2 * x + 1, 2 * y + 1)) *
+                                0.25f;
+        chain.push_back(std::move(next));
+    }
+    return chain;
+}
+
+// real spherical harmonics up to band 2
+void sh_basis(const Vec3f& d, float out[9]) {
+    out[0] = 0.282095f;
+    out[1] = 0.488603f * d.y;
+    out[2] = 0.488603f * d.z;
+    out[3] = 0.488603f * d.x;
+    out[4] = 1.092548f * d.x * d.y;
+    out[5] = 1.092548f * d.y * d.z;
+    out[6] = 0.315392f * (3.f * d.z * d.z - 1.f);
+    out[7] = 1.092548f * d.x * d.z;
+    out[8] = 0.546274f * (d.x * d.x - d.y * d.y);
+}
+
+Vec2f hammersley(uint32_t i, uint32_t n) {
+    uint32_t bits = i;
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return Vec2f(static_cast<float>(i) / n, bits * 2.3283064365386963e-10f);
+}
+
+// half vector around +z, distributed like the GGX lobe of alpha (= roughness^2)
+Vec3f ggx_half(const Vec2f& xi, float alpha) {
+    const float phi = 2.f * kPi * xi.x;
+    const float cosTheta = std::sqrt((1.f - xi.y) / (1.f + (alpha * alpha - 1.f) * xi.y));
+    const float sinTheta = std::sqrt(std::max(0.f, 1.f - cosTheta * cosTheta));
+    return Vec3f(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+}
+
+float ggx_d(float NdotH, float alpha) {
+    const float a2 = alpha * alpha, d = NdotH * NdotH * (a2 - 1.f) + 1.f;
+    return a2 / (kPi * d * d);
+}
+
+float smith_g(float NdotV, float NdotL, float k) {
+    return NdotV / (NdotV * (1.f - k) + k) * NdotL / (NdotL * (1.f - k) + k);
+}
+
+uint64_t fnv1a(uint64_t h, const void* data, size_t n) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < n; ++i) h = (h ^ p[i]) * 1099511628211ull;
+    return h;
+}
+
+uint64_t source_hash(const TGAImage& env) {
+    const int params[] = {static_cast<int>(kFormatVersion), kSourceWidth, EnvironmentLighting::SpecularLevels,
+                          EnvironmentLighting::SpecularWidth, EnvironmentLighting::LutSize, kSpecularSamples,
+                          kLutSamples, env.get_width(), env.get_height(), env.get_bytespp()};
+    uint64_t h = fnv1a(14695981039346656037ull, params, sizeof(params));
+    for (int y = 0; y < env.get_height(); ++y)
+        for (int x = 0; x < env.get_width(); ++x) h = fnv1a(h, env.get(x, y).raw, env.get_bytespp());
+    return h;
+}
+
+}  // namespace
+
+bool EnvironmentLighting::build(const TGAImage& env, const std::string& cacheDir) {
+    if (env.get_width() <= 0 || env.get_height() <= 0) return false;
+    PROFILE_SCOPE("ibl precompute");
+    sourceHash = source_hash(env);
+    char name[32];
+    std::snprintf(name, sizeof(name), "ibl_%016llx.bin", static_cast<unsigned long long>(sourceHash));
+    const std::string cacheFile = cacheDir.empty() ? std::string() : cacheDir + "/" + name;
+    fromCache = !cacheFile.empty() && load(cacheFile);
+    if (fromCache) return true;
+
+    const std::vector<LatLong> source = mip_chain(resample(env, kSourceWidth));
+    const LatLong& base = source[0];
+
+    // irradiance: project the radiance onto the SH basis, then convolve with the clamped cosine (A_l / pi)
+    std::mutex shMutex;
+    std::fill(&sh[0][0], &sh[0][0] + 27, 0.f);
+    parallel_for(0, base.height, 1, [&](size_t begin, size_t end) {
+        Vec3f local[9];
+        for (Vec3f& c : local) c = Vec3f(0.f, 0.f, 0.f);
+        for (int y = static_cast<int>(begin); y < static_cast<int>(end); ++y) {
+            const float v = (y + 0.5f) / base.height;
+            const float solidAngle = (2.f * kPi / base.width) * (kPi / base.height) * std::sin(v * kPi);
+            for (int x = 0; x < base.width; ++x) {
+                float basis[9];
+                sh_basis(direction((x + 0.5f) / base.width, v), basis);
+                for (int i = 0; i < 9; ++i) local[i] = local[i] + base.at(x, y) * (basis[i] * solidAngle);
+            }
+        }
+        std::lock_guard<std::mutex> lock(shMutex);
+        for (int i = 0; i < 9; ++i) {
+            sh[0][i] += local[i].x;
+            sh[1][i] += local[i].y;
+            sh[2][i] += local[i].z;
+        }
+    });
+    for (int c = 0; c < 3; ++c)
+        for (int i = 0; i < 9; ++i) sh[c][i] *= i == 0 ? 1.f : i < 4 ? 2.f / 3.f : 0.25f;
+
+    // specular: level 0 is the mirror image, rougher levels integrate GGX samples read from the source mip whose
+    // texels cover about the solid angle of one sample (filtered importance sampling)
+    levels.assign(SpecularLevels, std::vector<Vec3f>());
+    const float texelSolidAngle = 4.f * kPi / (base.width * base.height);
+    for (int l = 0; l < SpecularLevels; ++l) {
+        const int width = SpecularWidth >> l, height = width / 2;
+        std::vector<Vec3f>& level = levels[l];
+        level.resize(static_cast<size_t>(width) * height);
+        const float alpha = std::pow(static_cast<float>(l) / (SpecularLevels - 1), 2.f);
+        struct Sample {
+            Vec3f dir;  // in the frame of N
+            float weight;
+            int mip;
+        };
+        std::vector<Sample> samples;
+        for (int i = 0; l > 0 && i < kSpecularSamples; ++i) {
+            const Vec3f h = ggx_half(hammersley(i, kSpecularSamples), alpha);
+            const Vec3f dir = h * (2.f * h.z) - Vec3f(0.f, 0.f, 1.f);  // V = N = +z
+            if (dir.z <= 0.f) continue;
+            const float pdf = ggx_d(h.z, alpha) / 4.f;
+            const float mip = 0.5f * std::log2(1.f / (kSpecularSamples * pdf * texelSolidAngle)) + 1.f;
+            samples.push_back(
+                Sample{dir, dir.z, std::min(std::max(static_cast<int>(mip + 0.5f), 0), int(source.size()) - 1)});
+        }
+        parallel_for(0, height, 1, [&](size_t begin, size_t end) {
+            for (int y = static_cast<int>(begin); y < static_cast<int>(end); ++y)
+                for (int x = 0; x < width; ++x) {
+                    const float u = (x + 0.5f) / width, v = (y + 0.5f) / height;
+                    if (l == 0) {
+                        level[x + y * width] = bilinear(source[std::min<size_t>(1, source.size() - 1)], u, v);
+                        continue;
+                    }
+                    Vec3f n = direction(u, v);
+                    Vec3f t = cross(std::fabs(n.y) < 0.999f ? Vec3f(0.f, 1.f, 0.f) : Vec3f(1.f, 0.f, 0.f), n);
+                    t.normalize();
+                    const Vec3f b = cross(n, t);
+                    Vec3f sum(0.f, 0.f, 0.f);
+                    float total = 0.f;
+                    for (const Sample& s : samples) {
+                        const Vec2f st = lat_long(t * s.dir.x + b * s.dir.y + n * s.dir.z);
+                        sum = sum + bilinear(source[s.mip], st.x, st.y) * s.weight;
+                        total += s.weight;
+                    }
+                    level[x + y * width] = total > 0.f ? sum * (1.f / total) : Vec3f(0.f, 0.f, 0.f);
+                }
+        });
+    }
+
+    // split sum BRDF: F0 * scale + bias integrated over the GGX lobe with Smith visibility
+    lut.assign(LutSize * LutSize, Vec2f(0.f, 0.f));
+    parallel_for(0, LutSize, 1, [&](size_t begin, size_t end) {
+        for (int j = static_cast<int>(begin); j < static_cast<int>(end); ++j) {
+            const float roughness = (j + 0.5f) / LutSize, alpha = roughness * roughness;
+            for (int i = 0; i < LutSize; ++i) {
+                const float NdotV = (i + 0.5f) / LutSize;
+                const Vec3f view(std::sqrt(1.f - NdotV * NdotV), 0.f, NdotV);
+                float scale = 0.f, bias = 0.f;
+                for (int s = 0; s < kLutSamples; ++s) {
+                    const Vec3f h = ggx_half(hammersley(s, kLutSamples), alpha);
+                    const float VdotH = view * h;
+                    const Vec3f light = h * (2.f * VdotH) - view;
+                    if (light.z <= 0.f || VdotH <= 0.f) continue;
+                    const float visibility = smith_g(NdotV, light.z, alpha / 2.f) * VdotH / (h.z * NdotV);
+                    const float fresnel = std::pow(1.f - VdotH, 5.f);
+                    scale += (1.f - fresnel) * visibility;
+                    bias += fresnel * visibility;
+                }
+                lut[i + j * LutSize] = Vec2f(scale / kLutSamples, bias / kLutSamples);
+            }
+        }
+    });
+    if (!cacheFile.empty()) save(cacheFile);
+    return true;
+}
+
+Vec3f EnvironmentLighting::irradiance(const Vec3f& n) const {
+    float basis[9];
+    sh_basis(n, basis);
+    float e[3] = {0.f, 0.f, 0.f};
+    for (int c = 0; c < 3; ++c)
+        for (int i = 0; i < 9; ++i) e[c] += sh[c][i] * basis[i];
+    return Vec3f(std::max(e[0], 0.f), std::max(e[1], 0.f), std::max(e[2], 0.f));
+}
+
+Vec3f EnvironmentLighting::specular(const Vec3f& r, float roughness) const {
+    const float f = std::min(std::max(roughness, 0.f), 1.f) * (SpecularLevels - 1);
+    const int l0 = std::min(static_cast<int>(f), SpecularLevels - 2);
+    const float t = f - l0;
+    const Vec2f uv = lat_long(r);
+    const int w0 = SpecularWidth >> l0, w1 = w0 / 2;
+    const Vec3f a = bilinear(levels[l0], w0, w0 / 2, uv.x, uv.y), b = bilinear(levels[l0 + 1], w1, w1 / 2, uv.x, uv.y);
+    return Vec3f(a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t);
+}
+
+Vec2f EnvironmentLighting::brdf(float NdotV, float roughness) const {
+    const float fx = std::min(std::max(NdotV * LutSize - 0.5f, 0.f), LutSize - 1.f);
+    const float fy = std::min(std::max(roughness * LutSize - 0.5f, 0.f), LutSize - 1.f);
+    const int x0 = std::min(static_cast<int>(fx), LutSize - 2), y0 = std::min(static_cast<int>(fy), LutSize - 2);
+    const float tx = fx - x0, ty = fy - y0;
+    const auto at = [&](int x, int y) { return lut[x + y * LutSize]; };
+    return (at(x0, y0) * (1.f - tx) + at(x0 + 1, y0) * tx) * (1.f - ty) +
+           (at(x0, y0 + 1) * (1.f - tx) + at(x0 + 1, y0 + 1) * tx) * ty;
+}
+
+bool EnvironmentLighting::load(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.is_open()) return false;
+    char magic[8];
+    uint32_t version = 0;
+    uint64_t hash = 0;
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char*>(&version), sizeof(version));
+    in.read(reinterpret_cast<char*>(&hash), sizeof(hash));
+    if (!in || !std::equal(magic, magic + sizeof(magic), kMagic) || version != kFormatVersion || hash != sourceHash)
+        return false;
+    const auto read = [&](float* data, size_t n) { in.read(reinterpret_cast<char*>(data), n * sizeof(float)); };
+    read(&sh[0][0], 27);
+    std::vector<std::vector<Vec3f>> readLevels(SpecularLevels);
+    for (int l = 0; l < SpecularLevels; ++l) {
+        const int width = SpecularWidth >> l;
+        readLevels[l].resize(static_cast<size_t>(width) * (width / 2));
+        for (Vec3f& t : readLevels[l]) read(&t.x, 3);
+    }
+    std::vector<Vec2f> readLut(LutSize * LutSize);
+    for (Vec2f& t : readLut) read(&t.x, 2);
+    if (!in) return false;
+    levels.swap(readLevels);
+    lut.swap(readLut);
+    return true;
+}
+
+bool EnvironmentLighting::save(const std::string& filename) const {
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open()) return false;
+    out.write(kMagic, sizeof(kMagic));
+    out.write(reinterpret_cast<const char*>(&kFormatVersion), sizeof(kFormatVersion));
+    out.write(reinterpret_cast<const char*>(&sourceHash), sizeof(sourceHash));
+    const auto write = [&](const float* data, size_t n) {
+        out.write(reinterpret_cast<const char*>(data), n * sizeof(float));
+    };
+    write(&sh[0][0], 27);
+    for (const std::vector<Vec3f>& level : levels)
+        for (const Vec3f& t : level) write(&t.x, 3);
+    for (const Vec2f& t : lut) write(&t.x, 2);
+    return out.good();
+}
+
+TGAImage procedural_environment(const Vec3f& sunDir, int width, int height) {
+    TGAImage env(width, height, TGAImage::RGB);
+    Vec3f sun = sunDir;
+    sun.normalize();
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x) {
+            const Vec3f d = direction((x + 0.5f) / width, (y + 0.5f) / height);
+            Vec3f c;
+            if (d.y >= 0.f) {
+                const float t = std::sqrt(d.y);  // horizon to zenith
+                c = Vec3f(200.f, 215.f, 235.f) * (1.f - t) + Vec3f(60.f, 110.f, 200.f) * t;
+            } else {
+                c = Vec3f(70.f, 60.f, 50.f) * (1.f + 0.5f * d.y);
+            }
+            const float cosSun = d * sun;
+            if (cosSun > 0.999f) {
+                c = Vec3f(255.f, 250.f, 235.f);  // disc, about 5 degrees across
+            } else if (cosSun > 0.9f) {
+                c = c + Vec3f(80.f, 70.f, 50.f) * ((cosSun - 0.9f) * 10.f);  // glow
+            }
+            env.set(x, y, TGAColor(static_cast<unsigned char>(std::min(c.x, 255.f)),
+                                   static_cast<unsigned char>(std::min(c.y, 255.f)),
+                                   static_cast<unsigned char>(std::min(c.z, 255.f)), 255));
+        }
+    return env;
+}
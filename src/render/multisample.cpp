@@ -0,0 +1,163 @@
+#include "render/multisample.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <string>
+
+namespace {
+
+// in 1/16 pixel, the D3D standard sample patterns
+const int kPattern4[4][2] = {{-2, -6}, {6, -2}, {-6, 2}, {2, 6}};
+const int kPattern8[8][2] = {{1, -3}, {-1, 3}, {5, 1}, {-3, -5}, {-5, 5}, {-7, -1}, {3, 7}, {7, -7}};
+
+}  // namespace
+
+MultisampleBuffer::MultisampleBuffer(int w, int h, int s)
+    : width(w),
+      height(h),
+      samples(s == 8 ? 8 : 4),
+      colors(static_cast<size_t>(w) * h),
+      planeIndex(static_cast<size_t>(w) * h),
+      equal(static_cast<size_t>(w) * h) {
+    for (int k = 0; k < samples; ++k) {
+        const int* p = samples == 8 ? kPattern8[k] : kPattern4[k];
+        offsets[k] = Vec2f(p[0] / 16.f, p[1] / 16.f);
+    }
+    clear();
+}
+
+Vec2f MultisampleBuffer::sampleOffset(int s) const { return offsets[s]; }
+
+void MultisampleBuffer::clear() {
+    std::fill(colors.begin(), colors.end(), 0);
+    std::fill(planeIndex.begin(), planeIndex.end(), 0);
+    std::fill(equal.begin(), equal.end(), 1);
+    planes.assign(1, PlaneSlot{{0.f, 0.f, -std::numeric_limits<float>::max()}, 0});
+    freePlanes.clear();
+    lastPlane = 0;
+    pool.clear();
+    depthPool.clear();
+    freeBlocks.clear();
+}
+
+void MultisampleBuffer::clear(const Rect& r) {
+    const Rect c{std::max(r.x0, 0), std::max(r.y0, 0), std::min(r.x1, width - 1), std::min(r.y1, height - 1)};
+    for (int y = c.y0; y <= c.y1; ++y)
+        for (int x = c.x0; x <= c.x1; ++x) {
+            const size_t i = x + static_cast<size_t>(y) * width;
+            if (equal[i])
+                setPlane(i, 0);
+            else
+                freeBlocks.push_back(colors[i]);
+            equal[i] = 1;
+            colors[i] = 0;
+        }
+}
+
+void MultisampleBuffer::setPlane(size_t i, uint32_t p) {
+    if (p) ++planes[p].pixels;
+    const uint32_t old = planeIndex[i];
+    if (old && --planes[old].pixels == 0) freePlanes.push_back(old);
+    planeIndex[i] = p;
+}
+
+uint32_t MultisampleBuffer::addPlane(const DepthPlane& plane) {
+    const PlaneSlot& last = planes[lastPlane];
+    if (lastPlane && last.pixels && last.plane.dx == plane.dx && last.plane.dy == plane.dy && last.plane.c == plane.c)
+        return lastPlane;
+    if (freePlanes.empty()) {
+        lastPlane = static_cast<uint32_t>(planes.size());
+        planes.push_back(PlaneSlot{plane, 0});
+    } else {
+        lastPlane = freePlanes.back();
+        freePlanes.pop_back();
+        planes[lastPlane] = PlaneSlot{plane, 0};
+    }
+    return lastPlane;
+}
+
+void MultisampleBuffer::write(int x, int y, unsigned mask, uint32_t c, const DepthPlane& plane, const float z[]) {
+    const size_t i = x + static_cast<size_t>(y) * width;
+    if (mask == fullMask()) {
+        if (!equal[i]) freeBlocks.push_back(colors[i]);
+        setPlane(i, addPlane(plane));
+        equal[i] = 1;
+        colors[i] = c;
+        return;
+    }
+    if (equal[i]) {
+        uint32_t block;
+        if (freeBlocks.empty()) {
+            block = static_cast<uint32_t>(pool.size());
+            pool.resize(pool.size() + samples);
+            depthPool.resize(depthPool.size() + samples);
+        } else {
+            block = freeBlocks.back();
+            freeBlocks.pop_back();
+        }
+        std::fill(pool.begin() + block, pool.begin() + block + samples, colors[i]);
+        depth(x, y, &depthPool[block]);
+        setPlane(i, 0);
+        colors[i] = block;
+        equal[i] = 0;
+    }
+    uint32_t* block = &pool[colors[i]];
+    float* depths = &depthPool[colors[i]];
+    for (int s = 0; s < samples; ++s)
+        if (mask >> s & 1) {
+            block[s] = c;
+            depths[s] = z[s];
+        }
+}
+
+uint32_t MultisampleBuffer::color(int x, int y, int s) const {
+    const size_t i = x + static_cast<size_t>(y) * width;
+    return equal[i] ? colors[i] : pool[colors[i] + s];
+}
+
+void MultisampleBuffer::resolve(const Rect& r, TGAImage& out) const {
+    const int bpp = out.get_bytespp();
+    for (int y = r.y0; y <= r.y1; ++y) {
+        unsigned char* dst = out.buffer() + (r.x0 + static_cast<size_t>(y) * out.get_width()) * bpp;
+        for (int x = r.x0; x <= r.x1; ++x, dst += bpp) {
+            const size_t i = x + static_cast<size_t>(y) * width;
+            TGAColor c(colors[i], 4);
+            if (!equal[i]) {
+                const uint32_t* block = &pool[colors[i]];
+                unsigned sum[4] = {0, 0, 0, 0};
+                for (int s = 0; s < samples; ++s)
+                    for (int k = 0; k < 4; ++k) sum[k] += block[s] >> (8 * k) & 0xff;
+                for (int k = 0; k < 4; ++k) c.raw[k] = static_cast<unsigned char>((sum[k] + samples / 2) / samples);
+            }
+            std::copy(c.raw, c.raw + bpp, dst);
+        }
+    }
+}
+
+MultisampleBuffer::Stats MultisampleBuffer::stats() const {
+    const size_t pixels = static_cast<size_t>(width) * height;
+    Stats s{0, pixels * samples * (sizeof(float) + sizeof(uint32_t)), 0};
+    s.edgePixels = std::count(equal.begin(), equal.end(), 0);
+    s.bytes = colors.size() * sizeof(uint32_t) + planeIndex.size() * sizeof(uint32_t) + equal.size() +
+              planes.size() * sizeof(PlaneSlot) + pool.size() * sizeof(uint32_t) + depthPool.size() * sizeof(float);
+    return s;
+}
+
+size_t MultisampleBuffer::coveredPixels() const {
+    size_t n = 0;
+    float z[MaxSamples];
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x) {
+            depth(x, y, z);
+            n += *std::max_element(z, z + samples) != -std::numeric_limits<float>::max();
+        }
+    return n;
+}
+
+void print_multisample_stats(std::ostream& out, const MultisampleBuffer& buffer) {
+    const MultisampleBuffer::Stats s = buffer.stats();
+    out << std::left << std::setw(12) << "msaa" << std::setw(15) << (std::to_string(buffer.getSamples()) + "x")
+        << std::right << std::fixed << std::setprecision(2) << std::setw(9) << s.bytes / 1048576. << " MB, saves "
+        << std::setw(6) << (static_cast<double>(s.supersampledBytes) - s.bytes) / 1048576.
+        << " MB vs supersampling (edge pixels " << s.edgePixels << ")" << std::defaultfloat << std::endl;
+}
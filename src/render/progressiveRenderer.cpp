@@ -0,0 +1,69 @@
+#include "render/progressiveRenderer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+
+#include "util/profiler.h"
+
+ProgressiveRenderer::ProgressiveRenderer(int width, int height, int nlevels) {
+    nlevels = std::max(1, nlevels);
+    ShadowFilter hard;
+    hard.radius = 0;
+    for (int level = 0; level < nlevels; ++level) {
+        const int shift = nlevels - 1 - level;
+        levels.emplace_back(new Renderer(std::max(1, width >> shift), std::max(1, height >> shift)));
+        Renderer& renderer = *levels.back();
+        renderer.setCancelFlag(&cancelled);
+        if (shift) {
+            if (level) renderer.setOcclusionDepth(&levels[level - 1]->getZBuffer());
+            renderer.setPreview(true);
+            renderer.setShadowFilter(hard);
+        }
+    }
+}
+
+void ProgressiveRenderer::setShadowFilter(const ShadowFilter& filter) { levels.back()->setShadowFilter(filter); }
+
+void ProgressiveRenderer::setEnvironment(const EnvironmentLighting* env) { levels.back()->setEnvironment(env); }
+
+bool ProgressiveRenderer::render(const std::vector<Model>& models, const Vec3f& light_dir, const Camera& camera,
+                                 const std::function<void(int, const TGAImage&)>& onLevel) {
+    PROFILE_SCOPE("progressive render");
+    cancelled = false;
+    stats.clear();
+    firstImageMs = finalMs = -1.;
+    const auto start = std::chrono::steady_clock::now();
+    const auto since = [](std::chrono::steady_clock::time_point from) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - from).count();
+    };
+    for (size_t level = 0; level < levels.size(); ++level) {
+        if (cancelled) return false;
+        Renderer& renderer = *levels[level];
+        const auto levelStart = std::chrono::steady_clock::now();
+        renderer.render(models, light_dir, camera);
+        const bool finished = !cancelled;
+        stats.push_back(LevelStats{renderer.getWidth(), renderer.getHeight(), since(levelStart),
+                                   renderer.getOccludedTriangles(), finished});
+        if (!finished) return false;
+        if (level == 0) firstImageMs = since(start);
+        if (onLevel) onLevel(static_cast<int>(level), renderer.getOutput());
+    }
+    finalMs = since(start);
+    return true;
+}
+
+void ProgressiveRenderer::printStats(std::ostream& out) const {
+    out << std::fixed << std::setprecision(2);
+    for (size_t level = 0; level < stats.size(); ++level) {
+        const LevelStats& s = stats[level];
+        out << "level " << level << " " << s.width << "x" << s.height << ": " << s.ms << " ms, " << s.occluded
+            << " triangles occluded" << (s.finished ? "" : ", cancelled") << std::endl;
+    }
+    out << "time to first image " << firstImageMs << " ms, to final ";
+    if (finalMs >= 0.)
+        out << finalMs << " ms" << std::endl;
+    else
+        out << "- (cancelled)" << std::endl;
+    out << std::defaultfloat;
+}
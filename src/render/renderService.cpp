@@ -0,0 +1,355 @@
+#include "render/renderService.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+#include "render/scene.h"
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+constexpr size_t kLatencyWindow = 1024;
+
+static double now_ms() {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool parse_vec(const std::string& s, Vec3f& v) {
+    return std::sscanf(s.c_str(), "%f,%f,%f", &v.x, &v.y, &v.z) == 3;
+}
+
+// a relative path that stays below the directory it is joined to: no empty, "." or ".." components
+static bool contained_path(const std::string& path, bool allowDirs) {
+    if (path.empty() || path.find('\\') != std::string::npos || (!allowDirs && path.find('/') != std::string::npos))
+        return false;
+    std::istringstream parts(path);
+    std::string part;
+    while (std::getline(parts, part, '/'))
+        if (part.empty() || part == "." || part == "..") return false;
+    return path.back() != '/';
+}
+
+static std::string format_ms(const char* name, double ms) {
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "%s=%.3f", name, ms);
+    return buffer;
+}
+
+RenderService::RenderService(const std::string& dir, const std::string& outDir, int nworkers, size_t queueCapacity,
+                             size_t assetCapacity, bool compressTextures)
+    : resourceDir(dir),
+      outputDir(outDir),
+      assets(assetCapacity, compressTextures),
+      capacity(std::max<size_t>(1, queueCapacity)) {
+    latencies.reserve(kLatencyWindow);
+    for (int i = 0; i < std::max(1, nworkers); ++i) workers.emplace_back([this]() { workerLoop(); });
+}
+
+RenderService::~RenderService() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    ready.notify_all();
+    for (std::thread& t : workers) t.join();
+}
+
+void RenderService::handle(const std::string& line, const Reply& reply) {
+    std::istringstream iss(line);
+    std::string command;
+    if (!(iss >> command)) return;
+    if (command == "stats") {
+        reply(stats(), "");
+    } else if (command == "render") {
+        RenderJob job;
+        std::string error;
+        if (!parse(line, job, error)) {
+            reply("error " + job.id + " " + error, "");
+        } else {
+            const std::string id = job.id;
+            if (!submit(std::move(job), reply)) reply("error " + id + " queue full", "");
+        }
+    } else {
+        reply("error - unknown command " + command, "");
+    }
+}
+
+bool RenderService::parse(const std::string& line, RenderJob& job, std::string& error) {
+    std::istringstream iss(line);
+    std::string token;
+    iss >> token;  // "render"
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job.id = std::to_string(nextId++);
+    }
+    while (iss >> token) {
+        const size_t eq = token.find('=');
+        if (eq == std::string::npos) {
+            error = "bad argument " + token;
+            return false;
+        }
+        const std::string key = token.substr(0, eq);
+        const std::string value = token.substr(eq + 1);
+        bool ok = true;
+        if (key == "id") {
+            job.id = value;
+        } else if (key == "scene") {
+            job.models = scene_files(resourceDir, value);
+            ok = !job.models.empty();
+        } else if (key == "models") {
+            job.models.clear();
+            std::istringstream list(value);
+            std::string name;
+            while (ok && std::getline(list, name, ',')) {
+                ok = contained_path(name, true);
+                job.models.push_back(resourceDir + "/" + name);
+            }
+        } else if (key == "eye") {
+            ok = parse_vec(value, job.camera.eye);
+        } else if (key == "center") {
+            ok = parse_vec(value, job.camera.center);
+        } else if (key == "up") {
+            ok = parse_vec(value, job.camera.up);
+        } else if (key == "light") {
+            ok = parse_vec(value, job.light_dir);
+        } else if (key == "size") {
+            ok = std::sscanf(value.c_str(), "%dx%d", &job.width, &job.height) == 2 && job.width > 0 &&
+                 job.height > 0 && job.width <= 16384 && job.height <= 16384;
+        } else if (key == "pcf") {
+            ok = std::sscanf(value.c_str(), "%d", &job.pcf) == 1 && job.pcf >= 0 && job.pcf <= 8;
+        } else if (key == "msaa") {
+            ok = std::sscanf(value.c_str(), "%d", &job.msaa) == 1 && (job.msaa == 1 || job.msaa == 4 || job.msaa == 8);
+        } else if (key == "out") {
+            ok = value == "-" || (!outputDir.empty() && contained_path(value, false));
+            job.out = value == "-" ? value : outputDir + "/" + value;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            error = "bad argument " + token;
+            return false;
+        }
+    }
+    if (job.models.empty()) {
+        error = "no scene or models";
+        return false;
+    }
+    return true;
+}
+
+bool RenderService::submit(RenderJob job, const Reply& reply) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (queue.size() >= capacity) {
+            ++rejected;
+            return false;
+        }
+        queue.push_back({std::move(job), reply, now_ms()});
+    }
+    ready.notify_one();
+    return true;
+}
+
+void RenderService::workerLoop() {
+    Worker worker;
+    while (true) {
+        PendingJob pending;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [this]() { return stopping || !queue.empty(); });
+            if (queue.empty()) return;
+            pending = std::move(queue.front());
+            queue.pop_front();
+            ++active;
+        }
+        run(pending, worker);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --active;
+        }
+        idle.notify_all();
+    }
+}
+
+void RenderService::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this]() { return queue.empty() && active == 0; });
+}
+
+void RenderService::run(PendingJob& pending, Worker& worker) {
+    const RenderJob& job = pending.job;
+    const double start = now_ms();
+
+    std::vector<std::shared_ptr<AssetCache::Asset>> loaded;  // keeps the assets alive until the job is done
+    std::vector<Model> models;
+    loaded.reserve(job.models.size());
+    models.reserve(job.models.size());
+    for (const std::string& filename : job.models) {
+        loaded.push_back(assets.get(filename));
+        if (!loaded.back()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++failed;
+            }
+            const std::string name =
+                filename.compare(0, resourceDir.size() + 1, resourceDir + "/") ? filename
+                                                                              : filename.substr(resourceDir.size() + 1);
+            pending.reply("error " + job.id + " can't load " + name, "");
+            return;
+        }
+        models.push_back(loaded.back()->model());
+    }
+
+    std::unique_ptr<Renderer>& renderer = worker.renderer;
+    if (!renderer || renderer->getWidth() != job.width || renderer->getHeight() != job.height)
+        renderer.reset(new Renderer(job.width, job.height));
+    if (loaded != worker.assets) {
+        renderer->invalidateFrame();
+        renderer->invalidateShadowMap();
+        worker.assets = std::move(loaded);
+    }
+    ShadowFilter filter;
+    filter.radius = job.pcf;
+    renderer->setShadowFilter(filter);
+    renderer->setMultisample(job.msaa);
+    renderer->render(models, job.light_dir, job.camera);
+    const double rendered = now_ms();
+
+    TGAImage output = renderer->getOutput();  // the renderer keeps its frame, the next job may only redraw parts of it
+    output.flip_vertically();
+    std::string header;
+    std::string payload;
+    bool ok = true;
+    if (job.out == "-") {
+        std::ostringstream bytes;
+        ok = output.write_tga(bytes);
+        payload = bytes.str();
+        header = "ok " + job.id + " bytes " + std::to_string(payload.size());
+    } else {
+        ok = output.write_tga_file(job.out.c_str());
+        header = "ok " + job.id + " file " + job.out;
+    }
+    const double end = now_ms();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++(ok ? completed : failed);
+        if (latencies.size() < kLatencyWindow) {
+            latencies.push_back(end - pending.enqueued);
+        } else {
+            latencies[latencyCursor] = end - pending.enqueued;
+            latencyCursor = (latencyCursor + 1) % kLatencyWindow;
+        }
+    }
+    if (!ok) {
+        pending.reply("error " + job.id + " can't write the image", "");
+        return;
+    }
+    header += " " + format_ms("queue_ms", start - pending.enqueued) + " " + format_ms("render_ms", rendered - start) +
+              " " + format_ms("encode_ms", end - rendered) + " " + format_ms("total_ms", end - pending.enqueued);
+    pending.reply(header, payload);
+}
+
+std::string RenderService::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<double> sorted = latencies;
+    std::sort(sorted.begin(), sorted.end());
+    auto at = [&sorted](double p) {
+        return sorted.empty() ? 0. : sorted[static_cast<size_t>(p * (sorted.size() - 1))];
+    };
+    return "stats completed=" + std::to_string(completed) + " failed=" + std::to_string(failed) +
+           " rejected=" + std::to_string(rejected) + " queued=" + std::to_string(queue.size()) + " " +
+           format_ms("p50_ms", at(0.5)) + " " + format_ms("p99_ms", at(0.99)) + " " + format_ms("max_ms", at(1.));
+}
+
+int serve_stdio(RenderService& service) {
+    std::ostream reply(std::cout.rdbuf());
+    std::cout.rdbuf(std::cerr.rdbuf());  // asset loading logs to std::cout
+    std::mutex replyMutex;
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        service.handle(line, [&reply, &replyMutex](const std::string& header, const std::string& payload) {
+            std::lock_guard<std::mutex> lock(replyMutex);
+            reply << header << "\n";
+            reply.write(payload.data(), payload.size());
+            reply.flush();
+        });
+    }
+    service.wait();  // replies go through this function's stream
+    return 0;
+}
+
+#ifndef _WIN32
+// closes the socket once the reader and every pending reply are done with it
+struct Connection {
+    int fd;
+    std::mutex writeMutex;
+    explicit Connection(int f) : fd(f) {}
+    ~Connection() { close(fd); }
+
+    void send(const std::string& data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            const ssize_t n = write(fd, data.data() + sent, data.size() - sent);
+            if (n <= 0) return;
+            sent += static_cast<size_t>(n);
+        }
+    }
+};
+
+static void serve_connection(RenderService& service, std::shared_ptr<Connection> connection) {
+    std::string buffer;
+    char chunk[4096];
+    ssize_t n;
+    while ((n = read(connection->fd, chunk, sizeof(chunk))) > 0) {
+        buffer.append(chunk, static_cast<size_t>(n));
+        size_t newline;
+        while ((newline = buffer.find('\n')) != std::string::npos) {
+            const std::string line = buffer.substr(0, newline);
+            buffer.erase(0, newline + 1);
+            service.handle(line, [connection](const std::string& header, const std::string& payload) {
+                std::lock_guard<std::mutex> lock(connection->writeMutex);
+                connection->send(header + "\n");
+                connection->send(payload);
+            });
+        }
+    }
+}
+
+int serve_socket(RenderService& service, const std::string& path) {
+    signal(SIGPIPE, SIG_IGN);  // clients may hang up before their reply is ready
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (fd < 0 || path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "can't create socket " << path << "\n";
+        return 1;
+    }
+    std::copy(path.begin(), path.end(), addr.sun_path);
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        std::cerr << "can't listen on " << path << "\n";
+        close(fd);
+        return 1;
+    }
+    std::cerr << "listening on " << path << std::endl;
+    while (true) {
+        const int client = accept(fd, nullptr, nullptr);
+        if (client < 0) continue;
+        std::thread(serve_connection, std::ref(service), std::make_shared<Connection>(client)).detach();
+    }
+}
+#else
+int serve_socket(RenderService& service, const std::string& path) {
+    std::cerr << "unix domain sockets are not supported on this platform, use --serve without a path\n";
+    return 1;
+}
+#endif
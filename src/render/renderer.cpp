@@ -0,0 +1,776 @@
+#include "render/renderer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "graphics.h"
+#include "render/drawCapture.h"
+#include "util/parallel.h"
+#include "util/profiler.h"
+#include "util/radixSort.h"
+
+Renderer::Renderer(int w, int h)
+    : width(w),
+      height(h),
+      zbuffer(w, h),
+      shadowMap(w, h),
+      output(w, h, TGAImage::RGB),
+      depthOutput(w, h, TGAImage::RGB),
+      redraw(w, h),
+      shadowChanged(w, h),
+      tileDepth(redraw.size(), Vec2f(1.f, 0.f)) {}
+
+namespace {
+
+bool same(const Vec3f& a, const Vec3f& b) { return a.x == b.x && a.y == b.y && a.z == b.z; }
+
+bool same(const Matrix4x4& a, const Matrix4x4& b) {
+    for (size_t i = 0; i < 4; ++i)
+        for (size_t j = 0; j < 4; ++j)
+            if (a[i][j] != b[i][j]) return false;
+    return true;
+}
+
+// true when the object space cube around a bounding sphere lands entirely beside the width x height target through
+// M (Viewport * Projection * ModelView); a corner behind the camera keeps it
+bool off_screen(const Matrix4x4& M, const Vec3f& center, float radius, int width, int height) {
+    Vec2f lo(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+    Vec2f hi(-lo.x, -lo.y);
+    for (int corner = 0; corner < 8; ++corner) {
+        const Vec3f p(center.x + ((corner & 1) ? radius : -radius), center.y + ((corner & 2) ? radius : -radius),
+                      center.z + ((corner & 4) ? radius : -radius));
+        const Vec4f q = M * embed<4>(p);
+        if (q[3] <= 1e-6f) return false;
+        lo = Vec2f(std::min(lo.x, q[0] / q[3]), std::min(lo.y, q[1] / q[3]));
+        hi = Vec2f(std::max(hi.x, q[0] / q[3]), std::max(hi.y, q[1] / q[3]));
+    }
+    // one pixel of slack for the rounding of the screen vertices
+    return hi.x < -1.f || hi.y < -1.f || lo.x > width + 1.f || lo.y > height + 1.f;
+}
+
+// view space z of the point of the bounding sphere nearest to the camera, larger is nearer
+float nearest_depth(const Matrix4x4& ModelView, const Mesh& mesh) {
+    float scale = 0.f;  // largest axis scale
+    for (size_t j = 0; j < 3; ++j)
+        scale = std::max(scale, Vec3f(ModelView[0][j], ModelView[1][j], ModelView[2][j]).norm());
+    return (ModelView * embed<4>(mesh.boundCenter()))[2] + mesh.boundRadius() * scale;
+}
+
+// radix_sort() with its scratch in the arena
+void sort_items(ArenaVector<uint64_t>& items, FrameArena& arena) {
+    ArenaVector<uint64_t> scratch(items.size(), 0, ArenaAllocator<uint64_t>(arena));
+    radix_sort(items.data(), scratch.data(), items.size());
+}
+
+}  // namespace
+
+void Renderer::setDepthFormat(DepthFormat format, bool compressed) {
+    zbuffer = DepthBuffer(width, height, format, compressed);
+    mainState.valid = false;
+}
+
+void Renderer::setShadowMapFormat(DepthFormat format, bool compressed) {
+    shadowMap = DepthBuffer(width, height, format, compressed);
+    shadowState.valid = false;
+    mainState.valid = false;
+}
+
+void Renderer::memoryReport(std::ostream& out) const {
+    print_depth_stats(out, "shadow map", shadowMap);
+    print_depth_stats(out, "depth", zbuffer);
+    if (multisampled()) print_multisample_stats(out, multisample);
+    FrameArena::printStats(out);
+}
+
+void Renderer::setMultisample(int n) {
+    n = n >= 8 ? 8 : n >= 4 ? 4 : 1;
+    if (n == samples) return;
+    samples = n;
+    multisample = n > 1 ? MultisampleBuffer(width, height, n) : MultisampleBuffer();
+    mainState.valid = false;
+}
+
+void Renderer::setShadingMode(ShadingMode mode) {
+    if (mode != shadingMode) invalidateFrame();
+    shadingMode = mode;
+}
+
+void Renderer::setShadowFilter(const ShadowFilter& filter) {
+    if (filter.radius != shadowFilter.radius || filter.constantBias != shadowFilter.constantBias ||
+        filter.slopeBias != shadowFilter.slopeBias || filter.maxBias != shadowFilter.maxBias)
+        invalidateFrame();
+    shadowFilter = filter;
+}
+
+void Renderer::setEnvironment(const EnvironmentLighting* env) {
+    invalidateFrame();  // the same tables may have been rebuilt in place
+    environment = env;
+}
+
+size_t Renderer::collectDraws(const std::vector<Model>& models, const std::vector<InstanceBatch>& batches,
+                              Draws& draws) const {
+    size_t instances = 0;
+    for (const InstanceBatch& batch : batches) instances += batch.transforms.size();
+    draws.clear();
+    draws.reserve(models.size() + instances);
+    for (const Model& m : models) draws.push_back(Draw{&m, &m.getTransform(), -1, 1});
+    if (batches.empty()) return 0;
+    const Matrix4x4 screenM = Viewport * Projection * View;
+    size_t culled = 0;
+    for (size_t b = 0; b < batches.size(); ++b) {
+        const InstanceBatch& batch = batches[b];
+        const Mesh& mesh = *batch.model.getMesh();
+        const bool cull = !(batch.model.getPose() && batch.model.getBaseMesh()->skinned());
+        size_t first = draws.size();
+        for (const Matrix4x4& t : batch.transforms) {
+            if (cull && off_screen(screenM * t, mesh.boundCenter(), mesh.boundRadius(), width, height)) {
+                ++culled;
+                continue;
+            }
+            if (draws.size() - first == InstanceGroup) {
+                draws[first].group = InstanceGroup;
+                first = draws.size();
+            }
+            draws.push_back(Draw{&batch.model, &t, static_cast<int>(b), 0});
+        }
+        if (draws.size() > first) draws[first].group = draws.size() - first;
+    }
+    PROFILE_COUNT(Counter::InstancesDrawn, draws.size() - models.size());
+    PROFILE_COUNT(Counter::InstancesCulled, culled);
+    return culled;
+}
+
+bool Renderer::changedModels(const PassState& state, const Draws& draws, ArenaVector<size_t>& changed) {
+    if (state.meshes.size() != draws.size()) return false;
+    for (size_t k = 0; k < draws.size(); ++k) {
+        const Model& m = *draws[k].model;
+        if (state.meshes[k] != m.getMesh()) return false;
+        if (!same(state.transforms[k], *draws[k].transform) || state.poses[k] != m.getPoseVersion() ||
+            state.materials[k] != m.getMaterial())
+            changed.push_back(k);
+    }
+    return true;
+}
+
+void Renderer::planRedraw(PassState& state, const Draws& draws, const Vec3f& light_dir, const Camera& camera,
+                          const ArenaVector<size_t>* changed, std::vector<ScreenVertexBuffer>& screen,
+                          Jobs& transformed) {
+    JobSystem& jobs = JobSystem::instance();
+    screen.resize(draws.size());
+    state.bounds.resize(draws.size(), Rect{0, 0, -1, -1});
+    transformed.assign(draws.size(), nullptr);
+    // the transform globals are per thread, the jobs read copies
+    passView = View;
+    passScreen = Viewport * Projection;
+    // draws k .. k + n - 1 share model and mesh
+    const auto update = [&](size_t k, size_t n) {
+        const SkinnedVertices* skinned = skins.get(*draws[k].model);  // here, the cache is not thread safe
+        const PositionStream& positions = skinned ? skinned->positions : draws[k].model->getMesh()->positions();
+        const JobSystem::Handle job = jobs.submit([this, &state, &draws, &screen, &positions, k, n]() {
+            PROFILE_SCOPE("vertices");
+            for (size_t i = k; i < k + n; ++i) {
+                const Matrix4x4 ModelView = passView * *draws[i].transform;
+                transform_vertices(positions, passScreen * ModelView, screen[i]);
+                state.bounds[i] = screen_bounds(screen[i], width, height);
+            }
+        });
+        std::fill(transformed.begin() + k, transformed.begin() + k + n, job);
+    };
+    redraw.clear();
+    if (changed) {
+        for (size_t k : *changed) {
+            redraw.mark(state.bounds[k]);
+            update(k, 1);
+        }
+        for (const JobSystem::Handle& job : transformed) jobs.wait(job);
+        for (size_t k : *changed) redraw.mark(state.bounds[k]);
+    } else {
+        for (size_t k = 0; k < draws.size(); k += draws[k].group) update(k, draws[k].group);
+        redraw.markAll();
+    }
+
+    state.valid = true;
+    state.light_dir = light_dir;
+    state.camera = camera;
+    state.meshes.clear();
+    state.transforms.clear();
+    state.poses.clear();
+    state.materials.clear();
+    for (const Draw& d : draws) {
+        state.meshes.push_back(d.model->getMesh());
+        state.transforms.push_back(*d.transform);
+        state.poses.push_back(d.model->getPoseVersion());
+        state.materials.push_back(d.model->getMaterial());
+    }
+}
+
+void Renderer::clearTiles(DepthBuffer& depthBuffer, TGAImage& image, MultisampleBuffer* samples) {
+    if (redraw.all()) {
+        depthBuffer.clear();
+        image.clear();
+        if (samples) samples->clear();
+        return;
+    }
+    const int bpp = image.get_bytespp();
+    for (int ty = 0; ty < redraw.getTilesY(); ++ty)
+        for (int tx = 0; tx < redraw.getTilesX(); ++tx) {
+            if (!redraw.dirty(tx, ty)) continue;
+            const Rect r = redraw.tileRect(tx, ty);
+            depthBuffer.clear(r);
+            if (samples) samples->clear(r);
+            for (int y = r.y0; y <= r.y1; ++y)
+                std::fill(image.buffer() + (r.x0 + y * width) * bpp, image.buffer() + (r.x1 + 1 + y * width) * bpp, 0);
+        }
+}
+
+template <typename DrawFn>
+void Renderer::drawModels(const Draws& draws, const Jobs& transformed, const DrawFn& draw) {
+    JobSystem& jobs = JobSystem::instance();
+    FrameArena& arena = FrameArena::local();
+    FrameArena::Scope scope(arena);
+    // groups keyed by their nearest draw, negated so that ascending keys run front to back
+    ArenaVector<uint64_t> order{ArenaAllocator<uint64_t>(arena)};
+    order.reserve(draws.size());
+    for (size_t k = 0; k < draws.size(); k += draws[k].group) {
+        float nearest = -std::numeric_limits<float>::max();
+        if (depthSort)
+            for (size_t i = k; i < k + draws[k].group; ++i)
+                nearest = std::max(nearest, nearest_depth(passView * *draws[i].transform, *draws[i].model->getMesh()));
+        order.push_back(sort_item(depthSort ? float_sort_key(-nearest) : 0, static_cast<uint32_t>(k)));
+    }
+    if (depthSort) sort_items(order, arena);
+    JobSystem::Handle previous;
+    for (const uint64_t item : order) {
+        const size_t k = sort_payload(item);
+        const size_t n = draws[k].group;
+        previous = jobs.submit(
+            [&draw, k, n]() {
+                PROFILE_SCOPE("raster");
+                for (size_t i = k; i < k + n; ++i) draw(i);
+            },
+            {transformed[k], previous});
+    }
+    jobs.wait(previous);
+}
+
+template <typename Raster>
+void Renderer::drawModel(const Draw& draw, const ScreenVertexBuffer& screen, const Rect& bounds, IShader& shader,
+                         const float* occluders, const Raster& raster) {
+    if (bounds.empty() || !redraw.any(bounds)) return;
+    const Mesh& mesh = *draw.model->getMesh();
+    const bool everything = redraw.all();
+    size_t skipped = 0;
+    Vec4f screen_coord[3];
+    const auto drawFace = [&](size_t i) {
+        const std::vector<Mesh::Vertex>& face = mesh.face(i);
+        for (size_t j = 0; j < 3; ++j) screen_coord[j] = screen[face[j].vertIdx()];
+        if (everything && !occluders) {
+            for (size_t j = 0; j < 3; ++j) shader.attributes(i, j, screen_coord[j]);
+            raster(screen_coord, nullptr);
+            return;
+        }
+        const Rect box{
+            to_pixel(std::min(std::min(screen_coord[0][0], screen_coord[1][0]), screen_coord[2][0]), width),
+            to_pixel(std::min(std::min(screen_coord[0][1], screen_coord[1][1]), screen_coord[2][1]), height),
+            to_pixel(std::max(std::max(screen_coord[0][0], screen_coord[1][0]), screen_coord[2][0]), width),
+            to_pixel(std::max(std::max(screen_coord[0][1], screen_coord[1][1]), screen_coord[2][1]), height)};
+        if (!everything && !redraw.any(box)) return;
+        if (occluders && occluded(screen_coord, box)) {
+            ++skipped;
+            return;
+        }
+        for (size_t j = 0; j < 3; ++j) shader.attributes(i, j, screen_coord[j]);
+        if (everything)
+            raster(screen_coord, nullptr);
+        else
+            redraw.forEachSpan(box, [&](const Rect& span) { raster(screen_coord, &span); });
+    };
+    const std::vector<Mesh::Cluster>& clusters = mesh.clusters();
+    if (depthSort && clusters.size() > 1) {
+        FrameArena& arena = FrameArena::local();
+        FrameArena::Scope scope(arena);
+        const Matrix4x4 ModelView = passView * *draw.transform;
+        ArenaVector<uint64_t> order{ArenaAllocator<uint64_t>(arena)};
+        order.reserve(clusters.size());
+        for (size_t c = 0; c < clusters.size(); ++c)
+            order.push_back(sort_item(float_sort_key(-(ModelView * embed<4>(clusters[c].center))[2]),
+                                      static_cast<uint32_t>(c)));
+        sort_items(order, arena);
+        for (const uint64_t item : order) {
+            if (cancelled()) break;
+            const Mesh::Cluster& cluster = clusters[sort_payload(item)];
+            for (size_t i = cluster.firstFace; i < cluster.firstFace + cluster.nfaces; ++i) drawFace(i);
+        }
+    } else {
+        for (size_t i = 0; i < mesh.nfaces(); ++i) {
+            if (!(i & 255) && cancelled()) break;
+            drawFace(i);
+        }
+    }
+    if (occluders) occludedTriangles += skipped;  // the raster jobs of a pass run one after the other
+}
+
+void Renderer::setDepthSort(bool on) {
+    if (on != depthSort) {
+        shadowState.valid = false;
+        mainState.valid = false;
+    }
+    depthSort = on;
+}
+
+void Renderer::setPreview(bool on) {
+    if (on != preview) mainState.valid = false;
+    preview = on;
+}
+
+void Renderer::setOcclusionDepth(const DepthBuffer* coarse) {
+    occlusionDepth = coarse;
+    mainState.valid = false;
+}
+
+void Renderer::buildOccluders() {
+    // depth units, keeps surfaces just behind the coarse samples (eyes in their sockets, creases) from being culled
+    constexpr float kOcclusionMargin = 4.f;
+    const DepthBuffer& coarse = *occlusionDepth;
+    occlusionCellsX = (width + OcclusionCell - 1) / OcclusionCell;
+    const int cellsY = (height + OcclusionCell - 1) / OcclusionCell;
+    occluders.resize(static_cast<size_t>(occlusionCellsX) * cellsY);
+    const float sx = static_cast<float>(coarse.getWidth()) / width;
+    const float sy = static_cast<float>(coarse.getHeight()) / height;
+    parallel_for(0, cellsY, 4, [&](size_t begin, size_t end) {
+        for (int cy = static_cast<int>(begin); cy < static_cast<int>(end); ++cy)
+            for (int cx = 0; cx < occlusionCellsX; ++cx) {
+                // coarse pixels under the cell and one ring around it, an empty one keeps everything behind it
+                const int x0 = std::max(0, static_cast<int>(cx * OcclusionCell * sx) - 1);
+                const int y0 = std::max(0, static_cast<int>(cy * OcclusionCell * sy) - 1);
+                const int x1 =
+                    std::min(coarse.getWidth() - 1, static_cast<int>(((cx + 1) * OcclusionCell - 1) * sx) + 1);
+                const int y1 =
+                    std::min(coarse.getHeight() - 1, static_cast<int>(((cy + 1) * OcclusionCell - 1) * sy) + 1);
+                float farthest = std::numeric_limits<float>::max();
+                for (int y = y0; y <= y1; ++y)
+                    for (int x = x0; x <= x1; ++x) farthest = std::min(farthest, coarse.get(x, y));
+                occluders[cx + cy * occlusionCellsX] = farthest - kOcclusionMargin;
+            }
+    });
+}
+
+bool Renderer::occluded(const Vec4f pts[], const Rect& box) const {
+    constexpr int kMaxCells = 64;  // bigger triangles are cheaper to just draw
+    float nearest = -std::numeric_limits<float>::max();
+    for (int j = 0; j < 3; ++j) {
+        if (pts[j][3] <= 0.f) return false;  // behind the camera, the screen position means nothing
+        nearest = std::max(nearest, pts[j][2]);
+    }
+    const int cx0 = std::max(0, box.x0 / OcclusionCell), cy0 = std::max(0, box.y0 / OcclusionCell);
+    const int cx1 = std::min(occlusionCellsX - 1, box.x1 / OcclusionCell);
+    const int cy1 = std::min(static_cast<int>(occluders.size()) / occlusionCellsX - 1, box.y1 / OcclusionCell);
+    if (cx0 > cx1 || cy0 > cy1 || (cx1 - cx0 + 1) * (cy1 - cy0 + 1) > kMaxCells) return false;
+    for (int cy = cy0; cy <= cy1; ++cy)
+        for (int cx = cx0; cx <= cx1; ++cx)
+            if (nearest >= occluders[cx + cy * occlusionCellsX]) return false;
+    return true;
+}
+
+void Renderer::selectLods(std::vector<Model>& models, const Camera& camera, float maxError) const {
+    lookat(camera.eye, camera.center, camera.up);
+    viewport(width / 8, height / 8, width * 3 / 4, height * 3 / 4);
+    projection(-1.f / (camera.eye - camera.center).norm());
+    for (Model& m : models) {
+        const Mesh& mesh = *m.getBaseMesh();
+        const Matrix4x4 ModelView = View * m.getTransform();
+        float scale = 0.f;  // largest axis scale of the model transform
+        for (size_t j = 0; j < 3; ++j)
+            scale = std::max(scale, Vec3f(ModelView[0][j], ModelView[1][j], ModelView[2][j]).norm());
+        // screen distance between the sphere center and a point one radius to the side of it in view space
+        Vec4f center = ModelView * embed<4>(mesh.boundCenter());
+        Vec4f side = center;
+        side[0] += mesh.boundRadius() * scale;
+        center = Viewport * Projection * center;
+        side = Viewport * Projection * side;
+        if (center[3] <= 1e-6f || side[3] <= 1e-6f) {
+            m.selectLod(std::numeric_limits<float>::max(), maxError);  // behind the camera, must not matter
+            continue;
+        }
+        const float dx = side[0] / side[3] - center[0] / center[3], dy = side[1] / side[3] - center[1] / center[3];
+        m.selectLod(std::sqrt(dx * dx + dy * dy), maxError);
+    }
+}
+
+bool Renderer::shadowPass(const std::vector<Model>& models, const Vec3f& light_dir, const Camera& camera,
+                          const std::vector<InstanceBatch>& batches) {
+    FrameArena& arena = FrameArena::local();
+    FrameArena::Scope frame(arena);
+    // the instances inside the light view are part of what the cached map depends on
+    lookat(light_dir, camera.center, camera.up);
+    viewport(width / 8, height / 8, width * 3 / 4, height * 3 / 4);
+    projection(0);
+    Draws draws{ArenaAllocator<Draw>(arena)};
+    collectDraws(models, batches, draws);
+    ArenaVector<size_t> changed{ArenaAllocator<size_t>(arena)};
+    changed.reserve(draws.size());
+    const bool sameView = !capture && shadowState.valid && same(shadowState.light_dir, light_dir) &&
+                          same(shadowState.camera.center, camera.center) && same(shadowState.camera.up, camera.up) &&
+                          changedModels(shadowState, draws, changed);
+    if (sameView && changed.empty()) {
+        PROFILE_COUNT(Counter::ShadowPassesReused, 1);
+        return false;
+    }
+    PROFILE_SCOPE("shadow pass");
+    shadowMapM = Viewport * Projection * View;
+    Jobs transformed{ArenaAllocator<JobSystem::Handle>(arena)};
+    planRedraw(shadowState, draws, light_dir, camera, sameView ? &changed : nullptr, shadowVertices, transformed);
+    if (redraw.count() * 2 > redraw.size()) redraw.markAll();
+    PROFILE_COUNT(Counter::TilesRedrawn, redraw.count());
+    clearTiles(shadowMap, depthOutput);
+    ArenaVector<DepthShader> depthShaders{ArenaAllocator<DepthShader>(arena)};
+    depthShaders.reserve(draws.size());
+    for (const Draw& d : draws) depthShaders.emplace_back(d.model, View * *d.transform);
+    drawShadows(draws, shadowVertices, depthShaders, transformed);
+    shadowChanged.merge(redraw);
+    if (cancelled()) {
+        shadowState.valid = false;  // drawModels() returned, so every job of the pass is done
+        return true;
+    }
+    if (capture && batches.empty()) {
+        capture->shadow.view = View;
+        capture->shadow.projection = Projection;
+        capture->shadow.viewport = Viewport;
+        capture->shadow.vertices = shadowVertices;
+        capture->shadow.uniforms.clear();
+        for (const DepthShader& depthShader : depthShaders) capture->shadow.uniforms.push_back(depthShader.uniform_M);
+        capture->depthOutputHash = image_hash(depthOutput);
+    }
+    return true;
+}
+
+void Renderer::drawShadows(const Draws& draws, const std::vector<ScreenVertexBuffer>& screen,
+                           ArenaVector<DepthShader>& depthShaders, const Jobs& transformed) {
+    drawModels(draws, transformed, [&](size_t k) {
+        DepthShader& depthShader = depthShaders[k];
+        drawModel(draws[k], screen[k], shadowState.bounds[k], depthShader, nullptr,
+                  [&](const Vec4f pts[], const Rect* scissor) {
+                      rasterize(pts, depthShader, depthOutput, shadowMap, scissor);
+                  });
+    });
+}
+
+void Renderer::markShadowedTiles() {
+    if (!shadowChanged.count()) return;
+    Matrix4x4 toShadow = shadowMapM * (Viewport * Projection * View).invert();
+    const int pad = shadowFilter.radius + 1;
+    for (int ty = 0; ty < redraw.getTilesY(); ++ty)
+        for (int tx = 0; tx < redraw.getTilesX(); ++tx) {
+            const Vec2f& range = tileDepth[tx + ty * redraw.getTilesX()];
+            if (redraw.dirty(tx, ty) || range.x > range.y) continue;
+            // shadow map footprint of the box spanned by the tile and its depth range
+            const Rect r = redraw.tileRect(tx, ty);
+            Vec2f lo(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+            Vec2f hi(-lo.x, -lo.y);
+            bool behind = false;
+            for (int corner = 0; corner < 8; ++corner) {
+                const Vec3f p((corner & 1) ? r.x1 + 1.f : r.x0, (corner & 2) ? r.y1 + 1.f : r.y0,
+                              (corner & 4) ? range.y : range.x);
+                const Vec4f q = toShadow * embed<4>(p);
+                behind = behind || q[3] <= 1e-6f;
+                lo = Vec2f(std::min(lo.x, q[0] / q[3]), std::min(lo.y, q[1] / q[3]));
+                hi = Vec2f(std::max(hi.x, q[0] / q[3]), std::max(hi.y, q[1] / q[3]));
+            }
+            if (behind || shadowChanged.any(Rect{to_pixel(lo.x, width) - pad, to_pixel(lo.y, height) - pad,
+                                                 to_pixel(hi.x, width) + pad, to_pixel(hi.y, height) + pad}))
+                redraw.mark(r);
+        }
+}
+
+void Renderer::updateTileDepth() {
+    for (int ty = 0; ty < redraw.getTilesY(); ++ty)
+        for (int tx = 0; tx < redraw.getTilesX(); ++tx) {
+            if (!redraw.dirty(tx, ty)) continue;
+            const Rect r = redraw.tileRect(tx, ty);
+            Vec2f range(std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+            const auto add = [&](float z) {
+                if (z != -std::numeric_limits<float>::max()) range = Vec2f(std::min(range.x, z), std::max(range.y, z));
+            };
+            for (int y = r.y0; y <= r.y1; ++y)
+                for (int x = r.x0; x <= r.x1; ++x) {
+                    if (!multisampled()) {
+                        add(zbuffer.get(x, y));
+                        continue;
+                    }
+                    float z[MultisampleBuffer::MaxSamples];
+                    multisample.depth(x, y, z);
+                    for (int s = 0; s < samples; ++s) add(z[s]);
+                }
+            tileDepth[tx + ty * redraw.getTilesX()] = range;
+        }
+}
+
+void Renderer::mainPass(const std::vector<Model>& models, const Vec3f& light_dir, const Camera& camera,
+                        const std::vector<InstanceBatch>& batches) {
+    PROFILE_SCOPE("main pass");
+    FrameArena& arena = FrameArena::local();
+    FrameArena::Scope frame(arena);
+    lookat(camera.eye, camera.center, camera.up);
+    viewport(width / 8, height / 8, width * 3 / 4, height * 3 / 4);
+    projection(-1.f / (camera.eye - camera.center).norm());
+    Draws draws{ArenaAllocator<Draw>(arena)};
+    culledInstances = collectDraws(models, batches, draws);
+    drawnInstances = draws.size() - models.size();
+    ArenaVector<size_t> changed{ArenaAllocator<size_t>(arena)};
+    changed.reserve(draws.size());
+    const bool sameView = !capture && mainState.valid && same(mainState.light_dir, light_dir) &&
+                          same(mainState.camera.eye, camera.eye) && same(mainState.camera.center, camera.center) &&
+                          same(mainState.camera.up, camera.up) && changedModels(mainState, draws, changed);
+    Jobs transformed{ArenaAllocator<JobSystem::Handle>(arena)};
+    planRedraw(mainState, draws, light_dir, camera, sameView ? &changed : nullptr, vertices, transformed);
+    if (sameView) markShadowedTiles();
+    if (redraw.count() * 2 > redraw.size()) redraw.markAll();
+    shadowChanged.clear();
+    PROFILE_COUNT(Counter::TilesRedrawn, redraw.count());
+    if (!redraw.count()) return;
+
+    clearTiles(zbuffer, output, multisampled() ? &multisample : nullptr);
+    ArenaVector<Shader> shaders{ArenaAllocator<Shader>(arena)};
+    shaders.reserve(draws.size());
+    const auto setup = [&](ArenaVector<Shader>& out, const Model& m, const Matrix4x4& ModelView,
+                           const Matrix4x4& MS) {
+        out.emplace_back(&m, Projection * ModelView, MS, light_dir, &shadowMap, shadowFilter);
+        if (const SkinnedVertices* skinned = skins.get(m)) out.back().uniform_normals = &skinned->normals;
+        out.back().uniform_ibl = environment;
+        out.back().uniform_preview = preview;
+    };
+    for (const Model& m : models) {
+        const Matrix4x4 ModelView = View * m.getTransform();
+        setup(shaders, m, ModelView, shadowMapM * m.getTransform() * (Viewport * Projection * ModelView).invert());
+    }
+    if (drawnInstances) {
+        // one shader per batch, every instance copies it and replaces the transform uniforms; the transform cancels
+        // out of the shadow matrix
+        const Matrix4x4 toShadow = shadowMapM * (Viewport * Projection * View).invert();
+        ArenaVector<Shader> prototypes{ArenaAllocator<Shader>(arena)};
+        prototypes.reserve(batches.size());
+        for (const InstanceBatch& batch : batches) setup(prototypes, batch.model, View, toShadow);
+        for (size_t k = models.size(); k < draws.size(); ++k) {
+            const Matrix4x4& t = *draws[k].transform;
+            shaders.push_back(prototypes[draws[k].batch]);
+            shaders.back().setInstance(t, Projection * View * t, toShadow, light_dir);
+        }
+    }
+
+    drawMain(draws, vertices, shaders, transformed);
+    if (cancelled()) {
+        mainState.valid = false;
+        return;
+    }
+    if (capture && batches.empty()) captureMainPass(draws, shaders, light_dir);
+}
+
+void Renderer::drawMain(const Draws& draws, const std::vector<ScreenVertexBuffer>& screen, ArenaVector<Shader>& shaders,
+                        const Jobs& transformed) {
+    occludedTriangles = 0;
+    if (occlusionDepth) buildOccluders();
+    if (shadingMode == ShadingMode::Visibility) {
+        visibilityPass(draws, screen, transformed);
+        if (!cancelled()) resolvePass(draws, screen, shaders);
+    } else {
+        forwardPass(draws, screen, shaders, transformed);
+    }
+    if (cancelled()) return;
+    updateTileDepth();
+    PROFILE_COUNT(Counter::PixelsVisible, multisampled() ? multisample.coveredPixels() : zbuffer.coveredPixels());
+}
+
+void Renderer::forwardPass(const Draws& draws, const std::vector<ScreenVertexBuffer>& screen,
+                           ArenaVector<Shader>& shaders, const Jobs& transformed) {
+    PROFILE_ONLY(std::atomic<uint64_t> shades{0});  // a draw rasterizes on one thread, its share of PixelsShaded
+    drawModels(draws, transformed, [&](size_t k) {
+        Shader& shader = shaders[k];
+        PROFILE_ONLY(const uint64_t shadedBefore = Profiler::threadCount(Counter::PixelsShaded));
+        drawModel(draws[k], screen[k], mainState.bounds[k], shader, mainOccluders(),
+                  [&](const Vec4f pts[], const Rect* scissor) {
+                      if (multisampled())
+                          rasterize(pts, shader, multisample, scissor);
+                      else
+                          rasterize(pts, shader, output, zbuffer, scissor);
+                  });
+        PROFILE_ONLY(shades += Profiler::threadCount(Counter::PixelsShaded) - shadedBefore);
+    });
+    PROFILE_COUNT(Counter::MainPassShades, shades);
+    if (!multisampled()) return;
+    parallel_for(0, redraw.getTilesY(), 1, [&](size_t begin, size_t end) {
+        PROFILE_SCOPE("msaa resolve");
+        for (int ty = static_cast<int>(begin); ty < static_cast<int>(end); ++ty)
+            for (int tx = 0; tx < redraw.getTilesX(); ++tx)
+                if (redraw.dirty(tx, ty)) multisample.resolve(redraw.tileRect(tx, ty), output);
+    });
+}
+
+void Renderer::visibilityPass(const Draws& draws, const std::vector<ScreenVertexBuffer>& screen,
+                              const Jobs& transformed) {
+    PROFILE_SCOPE("visibility");
+    if (redraw.all() || visibility.size() != static_cast<size_t>(width * height)) {
+        visibility.assign(width * height, VisibilitySample{-1, 0});
+    } else {
+        for (int ty = 0; ty < redraw.getTilesY(); ++ty)
+            for (int tx = 0; tx < redraw.getTilesX(); ++tx) {
+                if (!redraw.dirty(tx, ty)) continue;
+                const Rect r = redraw.tileRect(tx, ty);
+                for (int y = r.y0; y <= r.y1; ++y)
+                    std::fill(visibility.begin() + r.x0 + y * width, visibility.begin() + r.x1 + 1 + y * width,
+                              VisibilitySample{-1, 0});
+            }
+    }
+    drawModels(draws, transformed, [&](size_t k) {
+        VisibilityShader shader(visibility.data(), width, static_cast<int>(k));
+        drawModel(draws[k], screen[k], mainState.bounds[k], shader, mainOccluders(),
+                  [&](const Vec4f pts[], const Rect* scissor) { rasterize(pts, shader, output, zbuffer, scissor); });
+    });
+}
+
+void Renderer::resolvePass(const Draws& draws, const std::vector<ScreenVertexBuffer>& screen,
+                           const ArenaVector<Shader>& shaders) {
+    const bool everything = redraw.all();
+    parallel_for(0, height, 16, [&](size_t begin, size_t end) {
+        PROFILE_SCOPE("resolve");
+        // varyings are per thread
+        ArenaVector<Shader> local(shaders.begin(), shaders.end(), ArenaAllocator<Shader>(FrameArena::local()));
+        int lastModel = -1, lastFace = -1;
+        bool covered = false;
+        TriangleSetup t;
+        PROFILE_ONLY(uint64_t resolved = 0);
+        for (int y = static_cast<int>(begin); y < static_cast<int>(end); ++y)
+            for (int x = 0; x < width; ++x) {
+                if (!everything && !redraw.dirty(x / TileMask::TileSize, y / TileMask::TileSize)) {
+                    x = (x / TileMask::TileSize + 1) * TileMask::TileSize - 1;  // skip the rest of the clean tile
+                    continue;
+                }
+                const VisibilitySample& s = visibility[x + y * width];
+                if (s.model < 0) continue;
+                Shader& shader = local[s.model];
+                if (s.model != lastModel || s.face != lastFace) {
+                    const std::vector<Mesh::Vertex>& face = draws[s.model].model->getMesh()->face(s.face);
+                    Vec4f pts[3];
+                    for (size_t j = 0; j < 3; ++j) {
+                        pts[j] = screen[s.model][face[j].vertIdx()];
+                        shader.attributes(s.face, j, pts[j]);
+                    }
+                    // same planes as the forward pass, so both modes shade a pixel with the same values
+                    covered = setup_shading(pts, shader, t);
+                    lastModel = s.model;
+                    lastFace = s.face;
+                }
+                if (!covered) continue;
+                TGAColor c;
+                PROFILE_ONLY(++resolved);
+                if (!shade_pixel(t, shader, x, y, c)) output.set(x, y, c);
+            }
+        PROFILE_COUNT(Counter::PixelsResolved, resolved);
+        PROFILE_COUNT(Counter::MainPassShades, resolved);
+    });
+}
+
+void Renderer::render(const std::vector<Model>& models, const Vec3f& light_dir, const Camera& camera,
+                      const std::vector<InstanceBatch>& batches) {
+    shadowPass(models, light_dir, camera, batches);
+    if (cancelled()) {
+        mainState.valid = false;
+        return;
+    }
+    mainPass(models, light_dir, camera, batches);
+}
+
+void Renderer::setCapture(DrawCapture* c) {
+    capture = c;
+    shadowState.valid = false;
+    mainState.valid = false;
+}
+
+void Renderer::captureMainPass(const Draws& draws, const ArenaVector<Shader>& shaders, const Vec3f& light_dir) {
+    capture->width = width;
+    capture->height = height;
+    capture->shadingMode = shadingMode;
+    capture->samples = samples;
+    capture->shadowFilter = shadowFilter;
+    capture->shadowFormat = shadowMap.getFormat();
+    capture->shadowCompressed = shadowMap.isCompressed();
+    capture->depthFormat = zbuffer.getFormat();
+    capture->depthCompressed = zbuffer.isCompressed();
+    capture->depthSort = depthSort;
+    capture->lightDir = light_dir;
+    capture->transforms.clear();
+    capture->lods.clear();
+    capture->faces.clear();
+    capture->normals.clear();
+    for (size_t k = 0; k < draws.size(); ++k) {
+        const Model& m = *draws[k].model;
+        capture->transforms.push_back(*draws[k].transform);
+        capture->lods.push_back(m.getLod());
+        capture->faces.push_back(static_cast<uint32_t>(m.getMesh()->nfaces()));
+        const std::vector<Vec3f>* normals = shaders[k].uniform_normals;
+        capture->normals.push_back(normals ? *normals : std::vector<Vec3f>());
+    }
+    capture->main.view = View;
+    capture->main.projection = Projection;
+    capture->main.viewport = Viewport;
+    capture->main.vertices = vertices;
+    capture->main.uniforms.clear();
+    for (const Shader& shader : shaders) {
+        capture->main.uniforms.push_back(shader.uniform_M);
+        capture->main.uniforms.push_back(shader.uniform_shadow);
+    }
+    capture->outputHash = image_hash(output);
+}
+
+void Renderer::replayPass(const CapturedPass& pass, PassState& state) {
+    View = pass.view;
+    Projection = pass.projection;
+    Viewport = pass.viewport;
+    passView = View;
+    state.valid = false;  // the next regular pass draws everything
+    state.bounds.resize(pass.vertices.size());
+    for (size_t k = 0; k < pass.vertices.size(); ++k) state.bounds[k] = screen_bounds(pass.vertices[k], width, height);
+    redraw.clear();
+    redraw.markAll();
+    PROFILE_COUNT(Counter::TilesRedrawn, redraw.count());
+}
+
+void Renderer::replay(const std::vector<Model>& models, const DrawCapture& c) {
+    setShadingMode(c.shadingMode);
+    setMultisample(c.samples);
+    setShadowFilter(c.shadowFilter);
+    setDepthSort(c.depthSort);
+    if (shadowMap.getFormat() != c.shadowFormat || shadowMap.isCompressed() != c.shadowCompressed)
+        setShadowMapFormat(c.shadowFormat, c.shadowCompressed);
+    if (zbuffer.getFormat() != c.depthFormat || zbuffer.isCompressed() != c.depthCompressed)
+        setDepthFormat(c.depthFormat, c.depthCompressed);
+    FrameArena& arena = FrameArena::local();
+    FrameArena::Scope frame(arena);
+    Draws draws{ArenaAllocator<Draw>(arena)};
+    collectDraws(models, {}, draws);
+    const Jobs transformed(models.size(), nullptr, ArenaAllocator<JobSystem::Handle>(arena));  // no vertex stage
+    {
+        PROFILE_SCOPE("shadow pass");
+        replayPass(c.shadow, shadowState);
+        shadowMapM = Viewport * Projection * View;
+        clearTiles(shadowMap, depthOutput);
+        ArenaVector<DepthShader> depthShaders{ArenaAllocator<DepthShader>(arena)};
+        depthShaders.reserve(models.size());
+        for (size_t k = 0; k < models.size(); ++k) depthShaders.emplace_back(&models[k], c.shadow.uniforms[k]);
+        drawShadows(draws, c.shadow.vertices, depthShaders, transformed);
+    }
+    PROFILE_SCOPE("main pass");
+    replayPass(c.main, mainState);
+    shadowChanged.clear();
+    clearTiles(zbuffer, output, multisampled() ? &multisample : nullptr);
+    ArenaVector<Shader> shaders{ArenaAllocator<Shader>(arena)};
+    shaders.reserve(models.size());
+    for (size_t k = 0; k < models.size(); ++k) {
+        shaders.emplace_back(&models[k], c.main.uniforms[2 * k], c.main.uniforms[2 * k + 1], c.lightDir, &shadowMap,
+                             shadowFilter);
+        if (!c.normals[k].empty()) shaders.back().uniform_normals = &c.normals[k];
+        shaders.back().uniform_ibl = environment;
+        shaders.back().uniform_preview = preview;
+    }
+    drawMain(draws, c.main.vertices, shaders, transformed);
+}
@@ -0,0 +1,36 @@
+#include "render/scene.h"
+
+#include "util/jobSystem.h"
+
+Scene::Scene(const std::vector<std::string>& modelsFilename)
+    : meshs(modelsFilename.size()), materials(modelsFilename.size()) {
+    JobSystem& jobs = JobSystem::instance();
+    std::vector<JobSystem::Handle> loads;
+    for (size_t k = 0; k < modelsFilename.size(); ++k) {
+        const std::string& filename = modelsFilename[k];
+        loads.push_back(jobs.submit([this, k, &filename]() { meshs[k].reset(new Mesh(filename + ".obj")); }));
+        loads.push_back(jobs.submit([this, k, &filename]() {
+            materials[k].reset(
+                new Material(filename + "_diffuse.tga", filename + "_nm_tangent.tga", filename + "_spec.tga"));
+        }));
+    }
+    jobs.wait(loads);
+    models.reserve(modelsFilename.size());
+    for (size_t k = 0; k < modelsFilename.size(); ++k) models.emplace_back(meshs[k].get(), materials[k].get());
+}
+
+std::vector<std::string> scene_files(const std::string& resourceDir, const std::string& name) {
+    if (name == "african_head") {
+        return {resourceDir + "/african_head/african_head", resourceDir + "/african_head/african_head_eye_inner",
+                resourceDir + "/african_head/african_head_eye_outer"};
+    }
+    if (name == "boggie") {
+        return {resourceDir + "/boggie/body", resourceDir + "/boggie/eyes", resourceDir + "/boggie/head"};
+    }
+    if (name == "diablo3_pose") {
+        return {resourceDir + "/diablo3_pose/diablo3_pose"};
+    }
+    return {};
+}
+
+std::vector<std::string> scene_names() { return {"african_head", "boggie", "diablo3_pose"}; }
@@ -0,0 +1,135 @@
+#include "render/shaders.h"
+
+#include <algorithm>
+
+namespace {
+
+constexpr float kIblDiffuse = 0.5f;  // the direct light already carries most of the diffuse energy
+
+// direction through the rotation part of m, keeps unit vectors unit when m is View.invert()
+inline Vec3f rotate(const Matrix4x4& m, const Vec3f& v) {
+    return Vec3f(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z, m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+                 m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+}
+
+}  // namespace
+
+Vec4f DepthShader::vertex(const int& faceIdx, const int& nthvert) {
+    const Vec3f v = model->getMesh()->vert(model->getMesh()->face(faceIdx)[nthvert].vertIdx());
+    return uniform_M * embed<4>(v);
+}
+
+bool DepthShader::fragment(const Vec3f& viewCoord, const Vec3f bar, const float varying[],
+                           TGAColor& outColor) const {
+    outColor = TGAColor(255, 255, 255, 255) * (viewCoord.z / depth);
+    return false;
+}
+
+Shader::Shader(const Model* m, const Matrix4x4& M, const Matrix4x4& MS, const Vec3f& light_dir,
+               const DepthBuffer* shadowMap, const ShadowFilter& filter)
+    : model(m),
+      uniform_shadowmap(shadowMap),
+      uniform_M(M),
+      uniform_shadow(MS),
+      uniform_light_dir(projection<3>(uniform_M * embed<4>(light_dir)).normalize()),
+      uniform_light_model(projection<3>(Matrix4x4(m->getTransform()).invert() * embed<4>(light_dir, 0.f)).normalize()),
+      uniform_shadow_filter(filter),
+      vary_uv(),
+      vary_tri(),
+      uniform_viewport_inv(Viewport.invert()),
+      uniform_view_inv(Matrix4x4(View).invert()) {
+    nvaryings = 5;
+}
+
+void Shader::setInstance(const Matrix4x4& transform, const Matrix4x4& M, const Matrix4x4& MS,
+                         const Vec3f& light_dir) {
+    uniform_M = M;
+    uniform_shadow = MS;
+    uniform_light_dir = projection<3>(uniform_M * embed<4>(light_dir)).normalize();
+    uniform_light_model = projection<3>(Matrix4x4(transform).invert() * embed<4>(light_dir, 0.f)).normalize();
+}
+
+Vec4f Shader::vertex(const int& faceIdx, const int& nthvert) {
+    const Mesh::Vertex& v = model->getMesh()->face(faceIdx)[nthvert];
+    setVaryings(nthvert, v);
+    Vec4f vertex = uniform_M * embed<4>(model->getMesh()->vert(v.vertIdx()));
+    vary_tri.set_column(nthvert, projection<3>(vertex / vertex[3]));
+    return vertex;
+}
+
+void Shader::attributes(const int& faceIdx, const int& nthvert, const Vec4f& screenCoord) {
+    setVaryings(nthvert, model->getMesh()->face(faceIdx)[nthvert]);
+    Vec4f ndc = screenCoord;
+    ndc[3] = 1.f;
+    vary_tri.set_column(nthvert, projection<3>(uniform_viewport_inv * ndc));
+}
+
+void Shader::setVaryings(const int& nthvert, const Mesh::Vertex& v) {
+    const Vec2f uv = model->getMesh()->uv(v.uvIdx());
+    const Vec3f n = uniform_normals ? (*uniform_normals)[v.normalIdx()] : model->getMesh()->normal(v.normalIdx());
+    vary_uv.set_column(nthvert, uv);
+    vary_out[nthvert][0] = uv.x;
+    vary_out[nthvert][1] = uv.y;
+    vary_out[nthvert][2] = n.x;
+    vary_out[nthvert][3] = n.y;
+    vary_out[nthvert][4] = n.z;
+}
+
+bool Shader::fragment(const Vec3f& viewCoord, const Vec3f bar, const float varying[],
+                      TGAColor& outColor) const {
+    const Vec2f uv(varying[0], varying[1]);
+    const Vec3f bn = Vec3f(varying[2], varying[3], varying[4]).normalize();
+    if (uniform_preview) {
+        Vec4f sm_p = uniform_shadow * embed<4>(viewCoord);
+        sm_p = sm_p / sm_p[3];
+        const float bias = uniform_shadow_filter.bias(bn * uniform_light_model);
+        const float shadow = 0.3f + 0.7f * shadow_lookup(*uniform_shadowmap, sm_p[0], sm_p[1], sm_p[2] + bias, 0);
+        const float diff = std::max(0.f, uniform_light_dir * bn);
+        outColor = model->getMaterial()->diffuse(uv);
+        for (size_t i = 0; i < 3; ++i)
+            outColor[i] = static_cast<unsigned char>(std::min(5.f + outColor[i] * shadow * 1.2f * diff, 255.f));
+        return false;
+    }
+
+    Matrix<3, 3, float> A;
+    A[0] = vary_tri.column(1) - vary_tri.column(0);
+    A[1] = vary_tri.column(2) - vary_tri.column(0);
+    A[2] = bn;
+
+    const Matrix<3, 3, float> AI = A.invert();
+    const Vec3f i = AI * Vec3f(vary_uv[0][1] - vary_uv[0][0], vary_uv[0][2] - vary_uv[0][0], 0.f);
+    const Vec3f j = AI * Vec3f(vary_uv[1][1] - vary_uv[1][0], vary_uv[1][2] - vary_uv[1][0], 0.f);
+    Matrix<3, 3, float> B;
+    B.set_column(0, i);
+    B.set_column(1, j);
+    B.set_column(2, bn);
+
+    const Vec3f n = (B * model->getMaterial()->normal(uv)).normalize();
+
+    Vec4f sm_p = uniform_shadow * embed<4>(viewCoord);
+    sm_p = sm_p / sm_p[3];
+    const float bias = uniform_shadow_filter.bias(bn * uniform_light_model);
+    const float shadow = 0.3f + 0.7f * shadow_lookup(*uniform_shadowmap, sm_p[0], sm_p[1], sm_p[2] + bias,
+                                                     uniform_shadow_filter.radius);
+
+    const Vec3f r = n * (uniform_light_dir * n) * 2 - uniform_light_dir;
+    const float spec = std::pow(std::max(r.z, 0.f), model->getMaterial()->specular(uv));
+    const float diff = std::max(0.f, uniform_light_dir * n);
+    outColor = model->getMaterial()->diffuse(uv);
+    float ambient[3] = {5.f, 5.f, 5.f};  // b, g, r like outColor
+    if (uniform_ibl) {
+        // split sum with F0 = 0.04, the camera looks down -z like the specular term above
+        const float roughness = std::sqrt(2.f / (model->getMaterial()->specular(uv) + 2.f));  // from the exponent
+        const Vec2f ab = uniform_ibl->brdf(std::max(n.z, 1e-3f), roughness);
+        const Vec3f irradiance = uniform_ibl->irradiance(rotate(uniform_view_inv, n));
+        const Vec3f reflected = uniform_ibl->specular(rotate(uniform_view_inv, n * (2.f * n.z) - Vec3f(0.f, 0.f, 1.f)),
+                                                      roughness) *
+                                (0.04f * ab.x + ab.y);
+        for (size_t i = 0; i < 3; ++i)
+            ambient[i] = outColor[i] * irradiance[2 - i] * kIblDiffuse + 255.f * reflected[2 - i];
+    }
+    for (size_t i = 0; i < 3; ++i)
+        outColor[i] = static_cast<unsigned char>(
+            std::min(ambient[i] + outColor[i] * shadow * (1.2f * diff + 0.6f * spec), 255.f));
+    return false;
+}
@@ -0,0 +1,94 @@
+#include "render/shadow.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "render/depthBuffer.h"
+#include "util/simd.h"
+
+namespace {
+
+// taps of a size x size kernel at (x0, y0) where the stored key is below ref, the kernel is inside the map
+template <typename Codec>
+int lit_taps(const DepthBuffer& map, int x0, int y0, int size, typename Codec::Key ref) {
+    int lit = 0;
+    for (int y = y0; y < y0 + size; ++y)
+        for (int x = x0; x < x0 + size; ++x) lit += map.key<Codec>(x, y) < ref;
+    return lit;
+}
+
+#ifdef MINIRENDERER_SSE2
+inline int popcount4(int bits) { return (bits & 1) + ((bits >> 1) & 1) + ((bits >> 2) & 1) + ((bits >> 3) & 1); }
+
+// whole 4 (float) or 8 (unorm16) wide loads must stay inside the row, near the edges the generic path takes over
+template <>
+int lit_taps<Float32Codec>(const DepthBuffer& map, int x0, int y0, int size, float ref) {
+    if (map.isCompressed() || x0 + ((size + 3) & ~3) > map.getWidth()) {
+        int lit = 0;
+        for (int y = y0; y < y0 + size; ++y)
+            for (int x = x0; x < x0 + size; ++x) lit += map.key<Float32Codec>(x, y) < ref;
+        return lit;
+    }
+    static const int masks[5] = {0x0, 0x1, 0x3, 0x7, 0xf};
+    const __m128 ref4 = _mm_set1_ps(ref);
+    const float* pixels = reinterpret_cast<const float*>(map.pixels());
+    int lit = 0;
+    for (int y = y0; y < y0 + size; ++y) {
+        const float* row = pixels + x0 + y * map.getWidth();
+        for (int i = 0; i < size; i += 4)
+            lit += popcount4(_mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(row + i), ref4)) & masks[std::min(4, size - i)]);
+    }
+    return lit;
+}
+
+template <>
+int lit_taps<Unorm16Codec>(const DepthBuffer& map, int x0, int y0, int size, uint32_t ref) {
+    if (map.isCompressed() || size > 8 || x0 + 8 > map.getWidth()) {
+        int lit = 0;
+        for (int y = y0; y < y0 + size; ++y)
+            for (int x = x0; x < x0 + size; ++x) lit += map.key<Unorm16Codec>(x, y) < ref;
+        return lit;
+    }
+    // SSE2 only compares signed 16 bit lanes, flipping the top bit keeps the unsigned order
+    const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+    const __m128i ref8 = _mm_xor_si128(_mm_set1_epi16(static_cast<short>(ref)), bias);
+    const int mask = (1 << (2 * size)) - 1;  // two movemask bits per lane
+    int lit = 0;
+    for (int y = y0; y < y0 + size; ++y) {
+        const __m128i row = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(map.pixels() + static_cast<size_t>(x0 + y * map.getWidth()) * 2));
+        const int bits = _mm_movemask_epi8(_mm_cmplt_epi16(_mm_xor_si128(row, bias), ref8)) & mask;
+        for (int b = bits; b; b &= b - 1) ++lit;
+    }
+    return lit / 2;
+}
+#endif
+
+}  // namespace
+
+float ShadowFilter::bias(float cosTheta) const {
+    const float c = std::min(std::max(cosTheta, 1e-3f), 1.f);
+    return std::min(constantBias + slopeBias * std::sqrt(1.f - c * c) / c, maxBias);
+}
+
+float shadow_lookup(const DepthBuffer& shadowMap, float x, float y, float refDepth, int radius) {
+    const int width = shadowMap.getWidth(), height = shadowMap.getHeight();
+    const int cx = static_cast<int>(x + 0.5f);
+    const int cy = static_cast<int>(y + 0.5f);
+    const int size = 2 * radius + 1;
+    const int x0 = cx - radius, y0 = cy - radius;
+    int lit = 0;
+    dispatch_depth_format(shadowMap.getFormat(), [&](auto codec) {
+        using Codec = decltype(codec);
+        const typename Codec::Key ref = Codec::encode(refDepth);
+        if (x0 >= 0 && y0 >= 0 && x0 + size <= width && y0 + size <= height) {
+            lit = lit_taps<Codec>(shadowMap, x0, y0, size, ref);
+            return;
+        }
+        // taps outside the map count as lit
+        for (int y = y0; y < y0 + size; ++y)
+            for (int x = x0; x < x0 + size; ++x)
+                lit += x < 0 || y < 0 || x >= width || y >= height || shadowMap.key<Codec>(x, y) < ref;
+    });
+    return static_cast<float>(lit) / (size * size);
+}
@@ -0,0 +1,91 @@
+#include "render/skinning.h"
+
+#include "util/frameArena.h"
+#include "util/parallel.h"
+#include "util/profiler.h"
+#include "util/simd.h"
+
+namespace {
+
+constexpr size_t kSkinGrain = 1024;  // vertices per parallel chunk
+
+// palette as 4 columns of the upper 3 rows per joint, so one blended column is a single SSE register
+ArenaVector<float> palette_columns(const std::vector<Matrix4x4>& palette, FrameArena& arena) {
+    ArenaVector<float> columns(palette.size() * 16, 0.f, ArenaAllocator<float>(arena));
+    for (size_t j = 0; j < palette.size(); ++j)
+        for (size_t c = 0; c < 4; ++c)
+            for (size_t r = 0; r < 4; ++r) columns[j * 16 + c * 4 + r] = r < 3 ? palette[j][r][c] : 0.f;
+    return columns;
+}
+
+// weighted sum of the joint matrices applied to (x, y, z, w)
+inline Vec3f blend(const float* columns, const SkinWeights& s, float x, float y, float z, float w) {
+#ifdef MINIRENDERER_SSE2
+    __m128 c[4] = {_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps()};
+    for (int k = 0; k < 4; ++k) {
+        if (s.weights[k] == 0.f) continue;
+        const __m128 weight = _mm_set1_ps(s.weights[k]);
+        const float* m = columns + s.joints[k] * 16;
+        for (int i = 0; i < 4; ++i) c[i] = _mm_add_ps(c[i], _mm_mul_ps(weight, _mm_loadu_ps(m + i * 4)));
+    }
+    const __m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[0], _mm_set1_ps(x)), _mm_mul_ps(c[1], _mm_set1_ps(y))),
+                                _mm_add_ps(_mm_mul_ps(c[2], _mm_set1_ps(z)), _mm_mul_ps(c[3], _mm_set1_ps(w))));
+    float out[4];
+    _mm_storeu_ps(out, v);
+    return Vec3f(out[0], out[1], out[2]);
+#else
+    float out[3] = {0.f, 0.f, 0.f};
+    for (int k = 0; k < 4; ++k) {
+        if (s.weights[k] == 0.f) continue;
+        const float* m = columns + s.joints[k] * 16;
+        for (int r = 0; r < 3; ++r) out[r] += s.weights[k] * (m[r] * x + m[4 + r] * y + m[8 + r] * z + m[12 + r] * w);
+    }
+    return Vec3f(out[0], out[1], out[2]);
+#endif
+}
+
+}  // namespace
+
+void skin_vertices(const Mesh& mesh, const std::vector<Matrix4x4>& palette, SkinnedVertices& out) {
+    FrameArena& arena = FrameArena::local();
+    FrameArena::Scope scope(arena);
+    const ArenaVector<float> columns = palette_columns(palette, arena);
+    const std::vector<SkinWeights>& skin = mesh.skinWeights();
+    const PositionStream& in = mesh.positions();
+    out.positions.x.resize(in.size());
+    out.positions.y.resize(in.size());
+    out.positions.z.resize(in.size());
+    parallel_for(0, in.size(), kSkinGrain, [&](size_t begin, size_t end) {
+        PROFILE_SCOPE("skinning");
+        for (size_t i = begin; i < end; ++i) {
+            const Vec3f p = blend(columns.data(), skin[i], in.x[i], in.y[i], in.z[i], 1.f);
+            out.positions.x[i] = p.x;
+            out.positions.y[i] = p.y;
+            out.positions.z[i] = p.z;
+        }
+    });
+    const std::vector<int>& owners = mesh.normalPositions();
+    out.normals.resize(owners.size());
+    parallel_for(0, owners.size(), kSkinGrain, [&](size_t begin, size_t end) {
+        PROFILE_SCOPE("skinning");
+        for (size_t i = begin; i < end; ++i) {
+            const Vec3f n = mesh.normal(static_cast<int>(i));
+            out.normals[i] = owners[i] < 0 ? n : blend(columns.data(), skin[owners[i]], n.x, n.y, n.z, 0.f);
+        }
+    });
+}
+
+const SkinnedVertices* SkinCache::get(const Model& model) {
+    const Mesh* mesh = model.getMesh();
+    const Pose* pose = model.getPose();
+    if (!pose || !mesh->skinned()) return nullptr;
+    Entry& entry = entries[std::make_pair(mesh, pose)];
+    if (entry.version == pose->getVersion()) {
+        ++hits;
+        return &entry.vertices;
+    }
+    skin_vertices(*mesh, pose->getPalette(), entry.vertices);
+    entry.version = pose->getVersion();
+    ++runs;
+    return &entry.vertices;
+}
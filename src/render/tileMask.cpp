@@ -0,0 +1,37 @@
+#include "render/tileMask.h"
+
+TileMask::TileMask(int w, int h)
+    : width(w),
+      height(h),
+      tilesX((w + TileSize - 1) / TileSize),
+      tilesY((h + TileSize - 1) / TileSize),
+      tiles(tilesX * tilesY, 0) {}
+
+Rect TileMask::tilesOf(const Rect& r) const {
+    const Rect clipped{std::max(r.x0, 0), std::max(r.y0, 0), std::min(r.x1, width - 1), std::min(r.y1, height - 1)};
+    if (clipped.empty()) return Rect{0, 0, -1, -1};
+    return Rect{clipped.x0 / TileSize, clipped.y0 / TileSize, clipped.x1 / TileSize, clipped.y1 / TileSize};
+}
+
+void TileMask::mark(const Rect& r) {
+    const Rect t = tilesOf(r);
+    for (int ty = t.y0; ty <= t.y1; ++ty)
+        for (int tx = t.x0; tx <= t.x1; ++tx) tiles[tx + ty * tilesX] = 1;
+}
+
+void TileMask::merge(const TileMask& other) {
+    for (size_t i = 0; i < tiles.size(); ++i) tiles[i] |= other.tiles[i];
+}
+
+bool TileMask::any(const Rect& r) const {
+    const Rect t = tilesOf(r);
+    for (int ty = t.y0; ty <= t.y1; ++ty)
+        for (int tx = t.x0; tx <= t.x1; ++tx)
+            if (dirty(tx, ty)) return true;
+    return false;
+}
+
+Rect TileMask::tileRect(int tx, int ty) const {
+    return Rect{tx * TileSize, ty * TileSize, std::min(width, (tx + 1) * TileSize) - 1,
+                std::min(height, (ty + 1) * TileSize) - 1};
+}
@@ -0,0 +1,155 @@
+#include "render/tiledRenderer.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <mutex>
+
+#include "graphics.h"
+#include "render/vertexBuffer.h"
+#include "util/frameArena.h"
+#include "util/parallel.h"
+#include "util/profiler.h"
+#include "util/tgaImage.h"
+
+TiledRenderer::TiledRenderer(int w, int h, int tile, int shadowSize)
+    : width(w),
+      height(h),
+      tileSize(tile),
+      tilesX((w + tile - 1) / tile),
+      tilesY((h + tile - 1) / tile),
+      shadowMap(shadowSize, shadowSize) {}
+
+void TiledRenderer::shadowPass(const std::vector<Model>& models, const Vec3f& light_dir, const Camera& camera) {
+    PROFILE_SCOPE("shadow pass");
+    const int size = shadowMap.getWidth();
+    lookat(light_dir, camera.center, camera.up);
+    viewport(size / 8, size / 8, size * 3 / 4, size * 3 / 4);
+    projection(0);
+    shadowMapM = Viewport * Projection * View;
+    shadowMap.clear();
+    TGAImage depthOutput(size, size, TGAImage::GRAYSCALE);  // DepthShader needs a colour target
+    ScreenVertexBuffer screen;
+    for (const Model& m : models) {
+        const Matrix4x4 ModelView = View * m.getTransform();
+        DepthShader depthShader(&m, ModelView);
+        const Mesh& mesh = *m.getMesh();
+        const SkinnedVertices* skinned = skins.get(m);
+        transform_vertices(skinned ? skinned->positions : mesh.positions(), Viewport * Projection * ModelView, screen);
+        Vec4f screen_coord[3];
+        for (size_t i = 0; i < mesh.nfaces(); ++i) {
+            const std::vector<Mesh::Vertex>& face = mesh.face(i);
+            for (size_t j = 0; j < 3; ++j) {
+                screen_coord[j] = screen[face[j].vertIdx()];
+                depthShader.attributes(i, j, screen_coord[j]);
+            }
+            rasterize(screen_coord, depthShader, depthOutput, shadowMap);
+        }
+    }
+}
+
+void TiledRenderer::binFaces(const std::vector<Model>& models) {
+    PROFILE_SCOPE("binning");
+    bins.resize(tilesX * tilesY);
+    for (std::vector<BinnedFace>& bin : bins) bin.clear();  // keeps the capacity of the last frame
+    stats.binnedFaces = 0;
+    for (size_t k = 0; k < models.size(); ++k) {
+        const Mesh& mesh = *models[k].getMesh();
+        const ScreenVertexBuffer& screen = vertices[k];
+        for (size_t i = 0; i < mesh.nfaces(); ++i) {
+            const std::vector<Mesh::Vertex>& face = mesh.face(i);
+            const Vec4f a = screen[face[0].vertIdx()], b = screen[face[1].vertIdx()], c = screen[face[2].vertIdx()];
+            const int x0 = std::max(0, to_pixel(std::min(std::min(a[0], b[0]), c[0]), width));
+            const int y0 = std::max(0, to_pixel(std::min(std::min(a[1], b[1]), c[1]), height));
+            const int x1 = std::min(width - 1, to_pixel(std::max(std::max(a[0], b[0]), c[0]), width));
+            const int y1 = std::min(height - 1, to_pixel(std::max(std::max(a[1], b[1]), c[1]), height));
+            if (x0 > x1 || y0 > y1) continue;
+            for (int ty = y0 / tileSize; ty <= y1 / tileSize; ++ty)
+                for (int tx = x0 / tileSize; tx <= x1 / tileSize; ++tx) {
+                    bins[tx + ty * tilesX].push_back(BinnedFace{static_cast<int>(k), static_cast<int>(i)});
+                    ++stats.binnedFaces;
+                }
+        }
+    }
+}
+
+bool TiledRenderer::render(const std::vector<Model>& models, const Vec3f& light_dir, const Camera& camera,
+                           const char* filename) {
+    PROFILE_SCOPE("tiled render");
+    TGAStreamWriter writer(filename, width, height, TGAImage::RGB);
+    if (!writer.good()) return false;
+    shadowPass(models, light_dir, camera);
+
+    lookat(camera.eye, camera.center, camera.up);
+    viewport(width / 8, height / 8, width * 3 / 4, height * 3 / 4);
+    projection(-1.f / (camera.eye - camera.center).norm());
+    vertices.resize(models.size());
+    for (size_t k = 0; k < models.size(); ++k) {
+        const Matrix4x4 ModelView = View * models[k].getTransform();
+        const SkinnedVertices* skinned = skins.get(models[k]);
+        transform_vertices(skinned ? skinned->positions : models[k].getMesh()->positions(),
+                           Viewport * Projection * ModelView, vertices[k]);
+    }
+    binFaces(models);
+
+    // the transform globals are per thread, so the shaders are set up here and copied by the workers
+    FrameArena& arena = FrameArena::local();
+    FrameArena::Scope frame(arena);
+    ArenaVector<Shader> shaders{ArenaAllocator<Shader>(arena)};
+    shaders.reserve(models.size());
+    for (const Model& m : models) {
+        const Matrix4x4 ModelView = View * m.getTransform();
+        shaders.emplace_back(&m, Projection * ModelView,
+                             shadowMapM * m.getTransform() * (Viewport * Projection * ModelView).invert(), light_dir,
+                             &shadowMap, shadowFilter);
+        if (const SkinnedVertices* skinned = skins.get(m)) shaders.back().uniform_normals = &skinned->normals;
+        shaders.back().uniform_ibl = environment;
+    }
+
+    std::mutex writeMutex;
+    bool ok = true;
+    const size_t threads = JobSystem::instance().getThreadCount();
+    stats.tiles = static_cast<int>(std::count_if(bins.begin(), bins.end(), [](const auto& b) { return !b.empty(); }));
+    size_t verticesBytes = 0, binBytes = bins.capacity() * sizeof(bins[0]);
+    for (const ScreenVertexBuffer& v : vertices) verticesBytes += v.size() * 4 * sizeof(float);
+    for (const auto& b : bins) binBytes += b.capacity() * sizeof(BinnedFace);
+    stats.peakBytes = shadowMap.stats().bytes + static_cast<size_t>(shadowMap.getWidth()) * shadowMap.getHeight() +
+                      verticesBytes + binBytes +
+                      std::min(threads, bins.size()) * (static_cast<size_t>(tileSize) * tileSize * (3 + 4) +
+                                                        models.size() * sizeof(Shader));
+
+    parallel_for(0, bins.size(), 1, [&](size_t begin, size_t end) {
+        PROFILE_SCOPE("tiles");
+        TGAImage image(tileSize, tileSize, TGAImage::RGB);
+        DepthBuffer zbuffer(tileSize, tileSize);
+        ArenaVector<Shader> local(shaders.begin(), shaders.end(), ArenaAllocator<Shader>(FrameArena::local()));
+        for (size_t t = begin; t < end; ++t) {
+            const int ox = static_cast<int>(t) % tilesX * tileSize, oy = static_cast<int>(t) / tilesX * tileSize;
+            const int w = std::min(tileSize, width - ox), h = std::min(tileSize, height - oy);
+            const Rect scissor{ox, oy, ox + w - 1, oy + h - 1};  // edge tiles are partly outside the image
+            image.clear();
+            zbuffer.clear();
+            Vec4f screen_coord[3];
+            for (const BinnedFace& f : bins[t]) {
+                const std::vector<Mesh::Vertex>& face = models[f.model].getMesh()->face(f.face);
+                Shader& shader = local[f.model];
+                for (size_t j = 0; j < 3; ++j) {
+                    screen_coord[j] = vertices[f.model][face[j].vertIdx()];
+                    shader.attributes(f.face, j, screen_coord[j]);
+                }
+                rasterize(screen_coord, shader, image, zbuffer, &scissor, ox, oy);
+            }
+
+            std::lock_guard<std::mutex> lock(writeMutex);
+            for (int y = 0; y < h; ++y)
+                ok = writer.write_pixels(ox, oy + y, image.buffer() + y * tileSize * TGAImage::RGB, w) && ok;
+        }
+    });
+    return ok;
+}
+
+void TiledRenderer::printStats(std::ostream& out) const {
+    out << width << "x" << height << " in " << tilesX * tilesY << " tiles of " << tileSize << " (" << stats.tiles
+        << " with faces), " << stats.binnedFaces << " binned faces, peak " << std::fixed << std::setprecision(2)
+        << stats.peakBytes / 1048576. << " MB vs " << static_cast<double>(width) * height * (3 + 4) / 1048576.
+        << " MB for full frame buffers" << std::defaultfloat << std::endl;
+}
@@ -0,0 +1,84 @@
+#include "render/vertexBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "util/parallel.h"
+#include "util/profiler.h"
+#include "util/simd.h"
+
+namespace {
+
+constexpr size_t kVertexGrain = 1024;  // vertices per parallel chunk, multiple of the SIMD width
+
+#ifdef MINIRENDERER_SSE2
+// std::round for every input: truncate, then step away from zero when the exact remainder is at least one half.
+// From 2^23 on floats are integers already (and would overflow the int conversion), they pass through like NaN.
+inline __m128 round_ps(__m128 v) {
+    const __m128 sign = _mm_and_ps(v, _mm_set1_ps(-0.f));
+    const __m128 magnitude = _mm_andnot_ps(_mm_set1_ps(-0.f), v);
+    const __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+    const __m128 remainder = _mm_andnot_ps(_mm_set1_ps(-0.f), _mm_sub_ps(v, truncated));
+    const __m128 step = _mm_and_ps(_mm_cmpge_ps(remainder, _mm_set1_ps(0.5f)), _mm_or_ps(_mm_set1_ps(1.f), sign));
+    const __m128 rounded = _mm_or_ps(_mm_add_ps(truncated, step), sign);
+    const __m128 small = _mm_cmplt_ps(magnitude, _mm_set1_ps(8388608.f));
+    return _mm_or_ps(_mm_and_ps(small, rounded), _mm_andnot_ps(small, v));
+}
+#endif
+
+void transform_range(const PositionStream& in, const Matrix4x4& M, ScreenVertexBuffer& out, size_t begin,
+                     size_t end) {
+    PROFILE_SCOPE("vertex");
+    size_t i = begin;
+#ifdef MINIRENDERER_SSE2
+    __m128 m[4][4];
+    for (size_t r = 0; r < 4; ++r)
+        for (size_t c = 0; c < 4; ++c) m[r][c] = _mm_set1_ps(M[r][c]);
+    for (; i + 4 <= end; i += 4) {
+        const __m128 x = _mm_loadu_ps(&in.x[i]);
+        const __m128 y = _mm_loadu_ps(&in.y[i]);
+        const __m128 z = _mm_loadu_ps(&in.z[i]);
+        __m128 row[4];
+        for (size_t r = 0; r < 4; ++r) {
+            row[r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[r][0], x), _mm_mul_ps(m[r][1], y)),
+                                _mm_add_ps(_mm_mul_ps(m[r][2], z), m[r][3]));
+        }
+        const __m128 invW = _mm_div_ps(_mm_set1_ps(1.f), row[3]);
+        _mm_storeu_ps(&out.x[i], round_ps(_mm_mul_ps(row[0], invW)));
+        _mm_storeu_ps(&out.y[i], round_ps(_mm_mul_ps(row[1], invW)));
+        _mm_storeu_ps(&out.z[i], round_ps(_mm_mul_ps(row[2], invW)));
+        _mm_storeu_ps(&out.w[i], row[3]);
+    }
+#endif
+    for (; i < end; ++i) {
+        float row[4];
+        for (size_t r = 0; r < 4; ++r) row[r] = M[r][0] * in.x[i] + M[r][1] * in.y[i] + M[r][2] * in.z[i] + M[r][3];
+        out.x[i] = std::round(row[0] / row[3]);
+        out.y[i] = std::round(row[1] / row[3]);
+        out.z[i] = std::round(row[2] / row[3]);
+        out.w[i] = row[3];
+    }
+}
+
+}  // namespace
+
+void ScreenVertexBuffer::resize(size_t n) {
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+    w.resize(n);
+}
+
+void transform_vertices(const PositionStream& in, const Matrix4x4& M, ScreenVertexBuffer& out) {
+    out.resize(in.size());
+    parallel_for(0, in.size(), kVertexGrain,
+                 [&](size_t begin, size_t end) { transform_range(in, M, out, begin, end); });
+}
+
+Rect screen_bounds(const ScreenVertexBuffer& vertices, int width, int height) {
+    if (!vertices.size()) return Rect{0, 0, -1, -1};
+    const auto x = std::minmax_element(vertices.x.begin(), vertices.x.end());
+    const auto y = std::minmax_element(vertices.y.begin(), vertices.y.end());
+    return Rect{std::max(0, to_pixel(*x.first, width)), std::max(0, to_pixel(*y.first, height)),
+                std::min(width - 1, to_pixel(*x.second, width)), std::min(height - 1, to_pixel(*y.second, height))};
+}
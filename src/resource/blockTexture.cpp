@@ -0,0 +1,234 @@
+#include "resource/blockTexture.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#include "util/parallel.h"
+
+namespace {
+
+constexpr size_t kCachedBlocks = 512;  // per thread, 36 KB
+constexpr size_t kEncodeGrain = 4;     // block rows per parallel chunk
+
+struct DecodedBlock {
+    uint64_t key = ~0ull;
+    uint32_t texels[16];
+};
+
+thread_local DecodedBlock decodedBlocks[kCachedBlocks];
+std::atomic<unsigned> textureIds{0};
+
+size_t block_bytes(BlockTexture::Format format) { return format == BlockTexture::BC5 ? 16 : 8; }
+
+uint16_t pack_565(const float rgb[3]) {
+    const auto quantize = [](float v, int max) {
+        return static_cast<uint16_t>(std::lround(std::min(std::max(v, 0.f), 255.f) * max / 255.f));
+    };
+    return static_cast<uint16_t>(quantize(rgb[0], 31) << 11 | quantize(rgb[1], 63) << 5 | quantize(rgb[2], 31));
+}
+
+void unpack_565(uint16_t c, int rgb[3]) {
+    const int r = c >> 11 & 31, g = c >> 5 & 63, b = c & 31;
+    rgb[0] = r << 3 | r >> 2;
+    rgb[1] = g << 2 | g >> 4;
+    rgb[2] = b << 3 | b >> 2;
+}
+
+// four colours when c0 > c1, else three and black
+void bc1_palette(uint16_t c0, uint16_t c1, int palette[4][3]) {
+    unpack_565(c0, palette[0]);
+    unpack_565(c1, palette[1]);
+    for (int i = 0; i < 3; ++i) {
+        if (c0 > c1) {
+            palette[2][i] = (2 * palette[0][i] + palette[1][i] + 1) / 3;
+            palette[3][i] = (palette[0][i] + 2 * palette[1][i] + 1) / 3;
+        } else {
+            palette[2][i] = (palette[0][i] + palette[1][i]) / 2;
+            palette[3][i] = 0;
+        }
+    }
+}
+
+// eight values when a0 > a1, else six and the two extremes
+void bc4_palette(int a0, int a1, int palette[8]) {
+    palette[0] = a0;
+    palette[1] = a1;
+    if (a0 > a1) {
+        for (int i = 1; i < 7; ++i) palette[i + 1] = ((7 - i) * a0 + i * a1 + 3) / 7;
+    } else {
+        for (int i = 1; i < 5; ++i) palette[i + 1] = ((5 - i) * a0 + i * a1 + 2) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+// endpoints at the extremes of the texels along their principal axis, every texel to the nearest palette entry
+void encode_bc1(const float texels[16][3], uint8_t* out) {
+    float mean[3] = {0.f, 0.f, 0.f};
+    for (int t = 0; t < 16; ++t)
+        for (int i = 0; i < 3; ++i) mean[i] += texels[t][i] / 16.f;
+    float cov[3][3] = {};
+    for (int t = 0; t < 16; ++t)
+        for (int i = 0; i < 3; ++i)
+            for (int j = 0; j < 3; ++j) cov[i][j] += (texels[t][i] - mean[i]) * (texels[t][j] - mean[j]);
+    float axis[3] = {1.f, 1.f, 1.f};
+    for (int iter = 0; iter < 4; ++iter) {
+        float next[3];
+        for (int i = 0; i < 3; ++i) next[i] = cov[i][0] * axis[0] + cov[i][1] * axis[1] + cov[i][2] * axis[2];
+        const float norm = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+        for (int i = 0; i < 3; ++i) axis[i] = norm > 1e-6f ? next[i] / norm : 0.f;
+    }
+    float tmin = 0.f, tmax = 0.f;
+    for (int t = 0; t < 16; ++t) {
+        float d = 0.f;
+        for (int i = 0; i < 3; ++i) d += (texels[t][i] - mean[i]) * axis[i];
+        tmin = std::min(tmin, d);
+        tmax = std::max(tmax, d);
+    }
+    float e0[3], e1[3];
+    for (int i = 0; i < 3; ++i) {
+        e0[i] = mean[i] + axis[i] * tmax;
+        e1[i] = mean[i] + axis[i] * tmin;
+    }
+    uint16_t c0 = pack_565(e0), c1 = pack_565(e1);
+    if (c0 < c1) std::swap(c0, c1);
+
+    uint32_t indices = 0;
+    if (c0 != c1) {
+        int palette[4][3];
+        bc1_palette(c0, c1, palette);
+        for (int t = 0; t < 16; ++t) {
+            uint32_t best = 0;
+            float bestError = 1e30f;
+            for (uint32_t k = 0; k < 4; ++k) {
+                float error = 0.f;
+                for (int i = 0; i < 3; ++i) error += (texels[t][i] - palette[k][i]) * (texels[t][i] - palette[k][i]);
+                if (error < bestError) {
+                    bestError = error;
+                    best = k;
+                }
+            }
+            indices |= best << (2 * t);
+        }
+    }
+    out[0] = static_cast<uint8_t>(c0);
+    out[1] = static_cast<uint8_t>(c0 >> 8);
+    out[2] = static_cast<uint8_t>(c1);
+    out[3] = static_cast<uint8_t>(c1 >> 8);
+    for (int i = 0; i < 4; ++i) out[4 + i] = static_cast<uint8_t>(indices >> (8 * i));
+}
+
+// endpoints at the block's min and max, eight value mode
+void encode_bc4(const int values[16], uint8_t* out) {
+    const int hi = *std::max_element(values, values + 16);
+    const int lo = *std::min_element(values, values + 16);
+    uint64_t indices = 0;
+    if (hi != lo) {
+        int palette[8];
+        bc4_palette(hi, lo, palette);
+        for (int t = 0; t < 16; ++t) {
+            uint64_t best = 0;
+            int bestError = 1 << 30;
+            for (uint64_t k = 0; k < 8; ++k) {
+                const int error = std::abs(values[t] - palette[k]);
+                if (error < bestError) {
+                    bestError = error;
+                    best = k;
+                }
+            }
+            indices |= best << (3 * t);
+        }
+    }
+    out[0] = static_cast<uint8_t>(hi);
+    out[1] = static_cast<uint8_t>(lo);
+    for (int i = 0; i < 6; ++i) out[2 + i] = static_cast<uint8_t>(indices >> (8 * i));
+}
+
+void decode_bc4(const uint8_t* in, int channel, uint32_t texels[16]) {
+    int palette[8];
+    bc4_palette(in[0], in[1], palette);
+    uint64_t indices = 0;
+    for (int i = 0; i < 6; ++i) indices |= static_cast<uint64_t>(in[2 + i]) << (8 * i);
+    unsigned char* bytes = reinterpret_cast<unsigned char*>(texels);  // TGAColor::raw of each texel
+    for (int t = 0; t < 16; ++t) bytes[t * 4 + channel] = static_cast<unsigned char>(palette[indices >> (3 * t) & 7]);
+}
+
+}  // namespace
+
+BlockTexture::BlockTexture(const TGAImage& image, Format f, int channel0, int channel1)
+    : format(f),
+      channels{channel0, channel1},
+      width(image.get_width()),
+      height(image.get_height()),
+      blocksWide((image.get_width() + 3) / 4),
+      bytespp(image.get_bytespp()),
+      id(++textureIds) {
+    if (width <= 0 || height <= 0) return;
+    const int blocksHigh = (height + 3) / 4;
+    const size_t stride = block_bytes(format);
+    blocks.resize(static_cast<size_t>(blocksWide) * blocksHigh * stride);
+    parallel_for(0, blocksHigh, kEncodeGrain, [&](size_t begin, size_t end) {
+        for (size_t by = begin; by < end; ++by) {
+            for (int bx = 0; bx < blocksWide; ++bx) {
+                TGAColor texels[16];
+                for (int t = 0; t < 16; ++t)
+                    texels[t] = image.get(std::min(bx * 4 + t % 4, width - 1),
+                                          std::min(static_cast<int>(by) * 4 + t / 4, height - 1));
+                uint8_t* out = blocks.data() + (by * blocksWide + bx) * stride;
+                if (format == BC1) {
+                    float rgb[16][3];
+                    for (int t = 0; t < 16; ++t) {
+                        rgb[t][0] = texels[t].r;
+                        rgb[t][1] = texels[t].g;
+                        rgb[t][2] = texels[t].b;
+                    }
+                    encode_bc1(rgb, out);
+                    continue;
+                }
+                for (int c = 0; c < (format == BC5 ? 2 : 1); ++c) {
+                    int values[16];
+                    for (int t = 0; t < 16; ++t) values[t] = texels[t][channels[c]];
+                    encode_bc4(values, out + 8 * c);
+                }
+            }
+        }
+    });
+}
+
+void BlockTexture::decode(size_t block, uint32_t texels[16]) const {
+    const uint8_t* in = blocks.data() + block * block_bytes(format);
+    if (format == BC1) {
+        const uint16_t c0 = static_cast<uint16_t>(in[0] | in[1] << 8);
+        const uint16_t c1 = static_cast<uint16_t>(in[2] | in[3] << 8);
+        const uint32_t indices = in[4] | in[5] << 8 | in[6] << 16 | static_cast<uint32_t>(in[7]) << 24;
+        int palette[4][3];
+        bc1_palette(c0, c1, palette);
+        uint32_t colors[4];
+        for (int k = 0; k < 4; ++k)
+            colors[k] = TGAColor(static_cast<unsigned char>(palette[k][0]), static_cast<unsigned char>(palette[k][1]),
+                                 static_cast<unsigned char>(palette[k][2]), 255)
+                            .val;
+        for (int t = 0; t < 16; ++t) texels[t] = colors[indices >> (2 * t) & 3];
+        return;
+    }
+    std::fill(texels, texels + 16, 0u);
+    decode_bc4(in, channels[0], texels);
+    if (format == BC5) decode_bc4(in + 8, channels[1], texels);
+}
+
+TGAColor BlockTexture::get(int x, int y) const {
+    if (blocks.empty()) return TGAColor();
+    x = std::min(std::max(x, 0), width - 1);
+    y = std::min(std::max(y, 0), height - 1);
+    const unsigned bx = static_cast<unsigned>(x) >> 2, by = static_cast<unsigned>(y) >> 2;
+    const size_t block = static_cast<size_t>(by) * blocksWide + bx;
+    const uint64_t key = static_cast<uint64_t>(id) << 32 | block;
+    // 16x16 neighbouring blocks map to distinct slots, textures fetched together are offset from each other
+    DecodedBlock& slot = decodedBlocks[(((by & 15) << 4 | (bx & 15)) + id * 97) & (kCachedBlocks - 1)];
+    if (slot.key != key) {
+        decode(block, slot.texels);
+        slot.key = key;
+    }
+    return TGAColor(static_cast<int>(slot.texels[(y & 3) * 4 + (x & 3)]), bytespp);
+}
@@ -1,30 +1,53 @@
 #include "resource/material.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <vector>
 
-void load_texture(const std::string& filename, TGAImage& out) {
-    std::cout << "Texture file " << filename << " loading " << (out.read_tga_file(filename.c_str()) ? " ok " : " fail ")
-              << std::endl;
+#include "util/jobSystem.h"
+
+// the maps load concurrently, so the status and what the reader reports go out as one write; false when the file
+// exists but can't be read
+bool load_texture(const std::string& filename, TGAImage& out) {
+    std::ostringstream log;
+    const bool ok = out.read_tga_file(filename.c_str(), log);
+    std::string details = log.str();
+    while (!details.empty() && details.back() == '\n') details.pop_back();
+    std::replace(details.begin(), details.end(), '\n', ' ');
+    std::cout << "Texture file " + filename + " loading " + (ok ? "ok" : "fail") + " (" + details + ")\n" << std::flush;
+    out.flip_vertically();
+    return ok || !std::ifstream(filename).is_open();
 }
 
 Material::Material(const std::string& diffuseFile, const std::string& normalFile, const std::string& specularFile) {
-    load_texture(diffuseFile, diffuseMap);
-    diffuseMap.flip_vertically();
-    if (!normalFile.empty()) {
-        load_texture(normalFile, normalMap);
-        normalMap.flip_vertically();
-    }
-    if (!specularFile.empty()) {
-        load_texture(specularFile, specularMap);
-        specularMap.flip_vertically();
-    }
+    JobSystem& jobs = JobSystem::instance();
+    bool ok[3] = {true, true, true};
+    std::vector<JobSystem::Handle> loads{jobs.submit([&]() { ok[0] = load_texture(diffuseFile, diffuseMap); })};
+    if (!normalFile.empty()) loads.push_back(jobs.submit([&]() { ok[1] = load_texture(normalFile, normalMap); }));
+    if (!specularFile.empty())
+        loads.push_back(jobs.submit([&]() { ok[2] = load_texture(specularFile, specularMap); }));
+    jobs.wait(loads);
+    mapsLoaded = ok[0] && ok[1] && ok[2];
 }
 
 TGAColor Material::diffuse(Vec2f uv) {
+    if (isCompressed)
+        return diffuseBlocks.get(static_cast<int>(uv[0] * diffuseBlocks.getWidth()),
+                                 static_cast<int>(uv[1] * diffuseBlocks.getHeight()));
     Vec2i uvi(static_cast<int>(uv[0] * diffuseMap.get_width()), static_cast<int>(uv[1] * diffuseMap.get_height()));
     return diffuseMap.get(uvi[0], uvi[1]);
 }
 Vec3f Material::normal(Vec2f uv) {
+    if (isCompressed) {
+        const TGAColor c = normalBlocks.get(static_cast<int>(uv[0] * normalBlocks.getWidth()),
+                                            static_cast<int>(uv[1] * normalBlocks.getHeight()));
+        const float x = c[2] / 255.f * 2.f - 1.f;
+        const float y = c[1] / 255.f * 2.f - 1.f;
+        return Vec3f(x, y, std::sqrt(std::max(0.f, 1.f - x * x - y * y)));
+    }
     Vec2i uvi(static_cast<int>(uv[0] * normalMap.get_width()), static_cast<int>(uv[1] * normalMap.get_height()));
     TGAColor c = normalMap.get(uvi[0], uvi[1]);
     Vec3f ret;
@@ -34,6 +57,26 @@ Vec3f Material::normal(Vec2f uv) {
     return ret;
 }
 float Material::specular(Vec2f uv) {
+    if (isCompressed)
+        return specularBlocks.get(static_cast<int>(uv[0] * specularBlocks.getWidth()),
+                                  static_cast<int>(uv[1] * specularBlocks.getHeight()))[0] / 1.0f;
     Vec2i uvi(static_cast<int>(uv[0] * specularMap.get_width()), static_cast<int>(uv[1] * specularMap.get_height()));
     return specularMap.get(uvi[0], uvi[1])[0] / 1.0f;
-}
\ No newline at end of file
+}
+
+void Material::compress() {
+    if (isCompressed) return;
+    diffuseBlocks = BlockTexture(diffuseMap, BlockTexture::BC1);
+    normalBlocks = BlockTexture(normalMap, BlockTexture::BC5, 2, 1);  // r, g: x, y
+    specularBlocks = BlockTexture(specularMap, BlockTexture::BC4, 0);
+    diffuseMap = normalMap = specularMap = TGAImage();
+    isCompressed = true;
+}
+
+size_t Material::textureBytes() const {
+    if (isCompressed) return diffuseBlocks.bytes() + normalBlocks.bytes() + specularBlocks.bytes();
+    size_t bytes = 0;
+    for (const TGAImage* map : {&diffuseMap, &normalMap, &specularMap})
+        bytes += static_cast<size_t>(map->get_width()) * map->get_height() * map->get_bytespp();
+    return bytes;
+}
@@ -47,6 +47,43 @@ Mesh::Mesh(const std::string& filename) {
             normals.emplace_back(v);
         }
     }
+
+    filePosition.resize(verts.size());
+    for (size_t i = 0; i < verts.size(); ++i) filePosition[i] = static_cast<int>(i);
+    optimize();
+    finishLoad();
+    buildLods();
+}
+
+void Mesh::finishLoad() {
+    positionStream.x.reserve(verts.size());
+    positionStream.y.reserve(verts.size());
+    positionStream.z.reserve(verts.size());
+    Vec3f lo(1e30f, 1e30f, 1e30f), hi(-1e30f, -1e30f, -1e30f);
+    for (const Vec3f& v : verts) {
+        positionStream.x.push_back(v.x);
+        positionStream.y.push_back(v.y);
+        positionStream.z.push_back(v.z);
+        lo = Vec3f(std::min(lo.x, v.x), std::min(lo.y, v.y), std::min(lo.z, v.z));
+        hi = Vec3f(std::max(hi.x, v.x), std::max(hi.y, v.y), std::max(hi.z, v.z));
+    }
+    center = verts.empty() ? Vec3f(0.f, 0.f, 0.f) : (lo + hi) * 0.5f;
+    radius = 0.f;
+    for (const Vec3f& v : verts) radius = std::max(radius, (v - center).norm());
+
+    faceClusters.clear();
+    for (size_t first = 0; first < faces.size(); first += ClusterFaces) {
+        const size_t last = std::min(faces.size(), first + ClusterFaces);
+        Vec3f clo(1e30f, 1e30f, 1e30f), chi(-1e30f, -1e30f, -1e30f);
+        for (size_t i = first; i < last; ++i)
+            for (const Vertex& v : faces[i]) {
+                const Vec3f& p = verts[v.vertIdx()];
+                clo = Vec3f(std::min(clo.x, p.x), std::min(clo.y, p.y), std::min(clo.z, p.z));
+                chi = Vec3f(std::max(chi.x, p.x), std::max(chi.y, p.y), std::max(chi.z, p.z));
+            }
+        faceClusters.push_back(
+            Cluster{static_cast<uint32_t>(first), static_cast<uint32_t>(last - first), (clo + chi) * 0.5f});
+    }
 }
 
 Mesh::~Mesh() = default;
@@ -83,3 +120,24 @@ std::vector<int> Mesh::face_normal(const int& idx) const {
 }
 
 const std::vector<Mesh::Vertex>& Mesh::face(const int& idx) const { return faces[idx]; }
+
+void Mesh::setSkin(const std::vector<SkinWeights>& weights) {
+    if (weights.size() != verts.size() || filePosition.size() != verts.size()) return;
+    std::vector<SkinWeights> optimized(weights.size());
+    for (size_t i = 0; i < weights.size(); ++i) optimized[filePosition[i]] = weights[i];
+    bindSkin(optimized);
+}
+
+void Mesh::bindSkin(const std::vector<SkinWeights>& weights) {
+    skin = weights;
+    normalPosition.assign(normals.size(), -1);
+    for (const std::vector<Vertex>& f : faces)
+        for (const Vertex& v : f)
+            if (normalPosition[v.normalIdx()] < 0) normalPosition[v.normalIdx()] = v.vertIdx();
+    for (Mesh& lod : lods) {
+        std::vector<SkinWeights> lodWeights;
+        lodWeights.reserve(lod.source.size());
+        for (int s : lod.source) lodWeights.push_back(weights[s]);
+        lod.bindSkin(lodWeights);
+    }
+}
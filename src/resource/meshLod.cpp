@@ -0,0 +1,258 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <queue>
+#include <unordered_map>
+
+#include "resource/mesh.h"
+
+namespace {
+
+// symmetric 4x4 matrix summing the squared distances to a set of planes (Garland & Heckbert)
+struct Quadric {
+    double a[10] = {0., 0., 0., 0., 0., 0., 0., 0., 0., 0.};  // xx xy xz xw yy yz yw zz zw ww
+
+    void addPlane(double nx, double ny, double nz, double d) {
+        const double p[4] = {nx, ny, nz, d};
+        int k = 0;
+        for (int i = 0; i < 4; ++i)
+            for (int j = i; j < 4; ++j) a[k++] += p[i] * p[j];
+    }
+    void add(const Quadric& q) {
+        for (int i = 0; i < 10; ++i) a[i] += q.a[i];
+    }
+    double eval(const Vec3f& v) const {
+        const double x = v.x, y = v.y, z = v.z;
+        return a[0] * x * x + 2. * a[1] * x * y + 2. * a[2] * x * z + 2. * a[3] * x + a[4] * y * y +
+               2. * a[5] * y * z + 2. * a[6] * y + a[7] * z * z + 2. * a[8] * z + a[9];
+    }
+};
+
+// move position `from` onto position `to`
+struct Collapse {
+    double cost;
+    int from, to;
+    unsigned fromVersion, toVersion;
+
+    bool operator<(const Collapse& other) const { return cost > other.cost; }  // cheapest first
+};
+
+// Greedy half-edge collapses ordered by quadric error. A collapse keeps the surviving vertex where it is, so uv and
+// normal indices stay valid; the collapsed vertex must have a single uv / normal pair and must not sit on an open
+// border, which keeps seams and silhouettes in place.
+class Simplifier {
+   public:
+    Simplifier(const std::vector<Vec3f>& verts, const std::vector<std::vector<Mesh::Vertex>>& inFaces)
+        : pos(verts),
+          faces(inFaces),
+          faceAlive(inFaces.size(), 1),
+          vertFaces(verts.size()),
+          quadrics(verts.size()),
+          locked(verts.size(), 0),
+          removed(verts.size(), 0),
+          version(verts.size(), 0),
+          aliveFaces(inFaces.size()) {
+        std::vector<int> wedge(verts.size(), -1);  // first face corner of every position
+        std::unordered_map<uint64_t, int> edges;
+        for (size_t f = 0; f < faces.size(); ++f) {
+            const std::vector<Mesh::Vertex>& face = faces[f];
+            if (face.size() != 3) {  // left alone
+                for (const Mesh::Vertex& v : face) locked[v.vertIdx()] = 1;
+                continue;
+            }
+            Vec3f n = cross(pos[face[1].vertIdx()] - pos[face[0].vertIdx()],
+                                  pos[face[2].vertIdx()] - pos[face[0].vertIdx()]);
+            const double len = n.norm();
+            for (int i = 0; i < 3; ++i) {
+                const Mesh::Vertex& v = face[i];
+                vertFaces[v.vertIdx()].push_back(static_cast<int>(f));
+                if (len > 0.)
+                    quadrics[v.vertIdx()].addPlane(n.x / len, n.y / len, n.z / len,
+                                                   -(n * pos[face[0].vertIdx()]) / len);
+                int& w = wedge[v.vertIdx()];
+                if (w < 0) {
+                    w = static_cast<int>(f * 3 + i);
+                } else {
+                    const Mesh::Vertex& first = faces[w / 3][w % 3];
+                    if (first.uvIdx() != v.uvIdx() || first.normalIdx() != v.normalIdx()) locked[v.vertIdx()] = 1;
+                }
+                ++edges[edgeKey(v.vertIdx(), face[(i + 1) % 3].vertIdx())];
+            }
+        }
+        for (const auto& e : edges)
+            if (e.second != 2) {  // open border or non-manifold
+                locked[e.first >> 32] = 1;
+                locked[e.first & 0xffffffffu] = 1;
+            }
+        for (const std::vector<Mesh::Vertex>& face : faces)
+            if (face.size() == 3)
+                for (int i = 0; i < 3; ++i) {
+                    push(face[i].vertIdx(), face[(i + 1) % 3].vertIdx());
+                    push(face[(i + 1) % 3].vertIdx(), face[i].vertIdx());
+                }
+    }
+
+    // collapse until at most target faces are left or no valid collapse remains
+    void run(size_t target) {
+        while (aliveFaces > target && !heap.empty()) {
+            const Collapse c = heap.top();
+            heap.pop();
+            if (removed[c.from] || removed[c.to] || version[c.from] != c.fromVersion || version[c.to] != c.toVersion)
+                continue;
+            Mesh::Vertex wedge(0, 0, 0);
+            if (!valid(c.from, c.to, wedge)) continue;
+            apply(c, wedge);
+        }
+    }
+
+    size_t faceCount() const { return aliveFaces; }
+    float error() const { return static_cast<float>(std::sqrt(std::max(0., maxCost))); }
+
+    // the surviving faces over the surviving positions
+    void snapshot(std::vector<Vec3f>& outVerts, std::vector<std::vector<Mesh::Vertex>>& outFaces,
+                  std::vector<int>& outSource) const {
+        std::vector<int> remap(pos.size(), -1);
+        for (size_t f = 0; f < faces.size(); ++f) {
+            if (!faceAlive[f]) continue;
+            std::vector<Mesh::Vertex> face = faces[f];
+            for (Mesh::Vertex& v : face) {
+                int& r = remap[v.vertIdx()];
+                if (r < 0) {
+                    r = static_cast<int>(outVerts.size());
+                    outVerts.push_back(pos[v.vertIdx()]);
+                    outSource.push_back(v.vertIdx());
+                }
+                v.raw[0] = r;
+            }
+            outFaces.push_back(std::move(face));
+        }
+    }
+
+   private:
+    static uint64_t edgeKey(int a, int b) {
+        return (static_cast<uint64_t>(std::min(a, b)) << 32) | static_cast<uint32_t>(std::max(a, b));
+    }
+
+    void push(int from, int to) {
+        if (locked[from] || from == to) return;
+        Quadric q = quadrics[from];
+        q.add(quadrics[to]);
+        heap.push(Collapse{q.eval(pos[to]), from, to, version[from], version[to]});
+    }
+
+    static int corner(const std::vector<Mesh::Vertex>& face, int v) {
+        for (int i = 0; i < 3; ++i)
+            if (face[i].vertIdx() == v) return i;
+        return -1;
+    }
+
+    // link condition (no fold over or pinched edges), matching wedges of `to` and no flipped faces
+    bool valid(int from, int to, Mesh::Vertex& wedge) const {
+        std::vector<int> opposite, fromRing, toRing;
+        bool haveWedge = false;
+        for (int f : vertFaces[from]) {
+            if (!faceAlive[f]) continue;
+            const std::vector<Mesh::Vertex>& face = faces[f];
+            const int ct = corner(face, to);
+            for (const Mesh::Vertex& v : face)
+                if (v.vertIdx() != from) fromRing.push_back(v.vertIdx());
+            if (ct < 0) {
+                // the face keeps its shape apart from moving `from`, it must not flip or degenerate
+                const int cf = corner(face, from);
+                const Vec3f& a = pos[face[(cf + 1) % 3].vertIdx()];
+                const Vec3f& b = pos[face[(cf + 2) % 3].vertIdx()];
+                Vec3f before = cross(a - pos[from], b - pos[from]);
+                Vec3f after = cross(a - pos[to], b - pos[to]);
+                const float lenBefore = before.norm(), lenAfter = after.norm();
+                if (lenAfter <= 1e-12f || (before * after) < 0.2f * lenBefore * lenAfter) return false;
+                continue;
+            }
+            if (haveWedge && (face[ct].uvIdx() != wedge.uvIdx() || face[ct].normalIdx() != wedge.normalIdx()))
+                return false;
+            wedge = face[ct];
+            haveWedge = true;
+            for (const Mesh::Vertex& v : face)
+                if (v.vertIdx() != from && v.vertIdx() != to) opposite.push_back(v.vertIdx());
+        }
+        if (!haveWedge) return false;  // no longer an edge
+        for (int f : vertFaces[to]) {
+            if (!faceAlive[f]) continue;
+            for (const Mesh::Vertex& v : faces[f])
+                if (v.vertIdx() != to) toRing.push_back(v.vertIdx());
+        }
+        std::sort(fromRing.begin(), fromRing.end());
+        fromRing.erase(std::unique(fromRing.begin(), fromRing.end()), fromRing.end());
+        std::sort(toRing.begin(), toRing.end());
+        toRing.erase(std::unique(toRing.begin(), toRing.end()), toRing.end());
+        std::sort(opposite.begin(), opposite.end());
+        opposite.erase(std::unique(opposite.begin(), opposite.end()), opposite.end());
+        std::vector<int> shared;
+        std::set_intersection(fromRing.begin(), fromRing.end(), toRing.begin(), toRing.end(),
+                              std::back_inserter(shared));
+        shared.erase(std::remove(shared.begin(), shared.end(), to), shared.end());
+        return shared == opposite;
+    }
+
+    void apply(const Collapse& c, const Mesh::Vertex& wedge) {
+        for (int f : vertFaces[c.from]) {
+            if (!faceAlive[f]) continue;
+            std::vector<Mesh::Vertex>& face = faces[f];
+            if (corner(face, c.to) >= 0) {
+                faceAlive[f] = 0;
+                --aliveFaces;
+                continue;
+            }
+            face[corner(face, c.from)] = Mesh::Vertex(c.to, wedge.uvIdx(), wedge.normalIdx());
+            vertFaces[c.to].push_back(f);
+        }
+        std::vector<int>& around = vertFaces[c.to];
+        around.erase(std::remove_if(around.begin(), around.end(), [&](int f) { return !faceAlive[f]; }),
+                     around.end());
+        vertFaces[c.from].clear();
+        quadrics[c.to].add(quadrics[c.from]);
+        removed[c.from] = 1;
+        ++version[c.to];
+        maxCost = std::max(maxCost, c.cost);
+        for (int f : around)
+            for (const Mesh::Vertex& v : faces[f]) {
+                push(v.vertIdx(), c.to);
+                push(c.to, v.vertIdx());
+            }
+    }
+
+    std::vector<Vec3f> pos;
+    std::vector<std::vector<Mesh::Vertex>> faces;
+    std::vector<char> faceAlive;
+    std::vector<std::vector<int>> vertFaces;  // faces around each position, may hold dead faces
+    std::vector<Quadric> quadrics;
+    std::vector<char> locked;  // seam, border or non-triangle vertices, never collapsed
+    std::vector<char> removed;
+    std::vector<unsigned> version;  // bumped when the quadric changes, invalidates queued collapses
+    std::priority_queue<Collapse> heap;
+    size_t aliveFaces;
+    double maxCost = 0.;
+};
+
+}  // namespace
+
+void Mesh::buildLods(int maxLevels, size_t minFaces) {
+    lods.clear();
+    Simplifier simplifier(verts, faces);
+    size_t previous = faces.size();
+    for (int level = 1; level < maxLevels && previous > minFaces; ++level) {
+        simplifier.run(std::max(minFaces, previous / 2));
+        // locked vertices stop the reduction long before the target on heavily seamed meshes
+        if (simplifier.faceCount() * 10 > previous * 9) break;
+        Mesh lod;
+        simplifier.snapshot(lod.verts, lod.faces, lod.source);
+        lod.uvs = uvs;
+        lod.normals = normals;
+        lod.error = simplifier.error();
+        if (lod.error > radius) break;  // coarser than the whole mesh, never worth drawing
+        lod.optimize();
+        lod.finishLoad();
+        previous = simplifier.faceCount();
+        lods.push_back(std::move(lod));
+    }
+}
@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <cmath>
+#include <deque>
+
+#include "resource/mesh.h"
+
+namespace {
+
+// Tom Forsyth, "Linear-Speed Vertex Cache Optimisation": greedily emit the triangle whose vertices score highest,
+// favouring vertices that were just used (still in a simulated LRU cache) and vertices with few triangles left
+constexpr int kCacheSize = 32;
+constexpr float kCacheDecayPower = 1.5f;
+constexpr float kLastTriScore = 0.75f;
+constexpr float kValenceBoostScale = 2.f;
+constexpr float kValenceBoostPower = 0.5f;
+
+float vertex_score(int cachePosition, int remaining) {
+    if (remaining == 0) return -1.f;
+    float score = 0.f;
+    if (cachePosition >= 0) {
+        if (cachePosition < 3) {
+            score = kLastTriScore;  // used by the last triangle, no preference among its corners
+        } else {
+            const float scaler = 1.f / (kCacheSize - 3);
+            score = std::pow(1.f - (cachePosition - 3) * scaler, kCacheDecayPower);
+        }
+    }
+    return score + kValenceBoostScale * std::pow(static_cast<float>(remaining), -kValenceBoostPower);
+}
+
+Vec2f uv_center(const std::vector<Mesh::Vertex>& face, const std::vector<Vec3f>& uvs) {
+    Vec2f c(0.f, 0.f);
+    for (const Mesh::Vertex& v : face) c = c + Vec2f(uvs[v.uvIdx()].x, uvs[v.uvIdx()].y);
+    return face.empty() ? c : c * (1.f / face.size());
+}
+
+// faces compared when the cache runs dry: the best restart scores in the heap, ordered by uv distance
+constexpr size_t kRestartCandidates = 64;
+
+std::vector<int> forsyth_order(const std::vector<std::vector<Mesh::Vertex>>& faces, size_t nverts,
+                               const std::vector<Vec3f>& uvs) {
+    std::vector<std::vector<int>> vertFaces(nverts);
+    for (size_t f = 0; f < faces.size(); ++f)
+        for (const Mesh::Vertex& v : faces[f]) vertFaces[v.vertIdx()].push_back(static_cast<int>(f));
+    std::vector<int> remaining(nverts), cachePos(nverts, -1);
+    std::vector<float> score(nverts);
+    for (size_t v = 0; v < nverts; ++v) {
+        remaining[v] = static_cast<int>(vertFaces[v].size());
+        score[v] = vertex_score(-1, remaining[v]);
+    }
+    std::vector<char> added(faces.size(), 0);
+    const auto faceScore = [&](int f) {
+        float s = 0.f;
+        for (const Mesh::Vertex& v : faces[f]) s += score[v.vertIdx()];
+        return s;
+    };
+
+    // Restarts only see faces outside the cache, whose score depends on the remaining valences alone. It is kept per
+    // face and pushed again at the next restart when it changed, outdated heap entries are dropped when they come up.
+    struct Candidate {
+        float score;
+        int face;
+        bool operator<(const Candidate& o) const { return score < o.score || (score == o.score && face > o.face); }
+    };
+    std::vector<float> valenceScore;  // vertex_score(-1, remaining)
+    for (int r : remaining)
+        while (valenceScore.size() <= static_cast<size_t>(r))
+            valenceScore.push_back(vertex_score(-1, static_cast<int>(valenceScore.size())));
+    std::vector<float> restartScore(faces.size());
+    std::vector<char> changed(faces.size(), 0);
+    std::vector<int> changedFaces;
+    std::vector<Candidate> heap;
+    heap.reserve(faces.size());
+    const auto pushRestart = [&](int f) {
+        float s = 0.f;
+        for (const Mesh::Vertex& v : faces[f]) s += valenceScore[remaining[v.vertIdx()]];
+        restartScore[f] = s;
+        heap.push_back({s, f});
+        std::push_heap(heap.begin(), heap.end());
+    };
+    for (size_t f = 0; f < faces.size(); ++f) pushRestart(static_cast<int>(f));
+    const auto popRestart = [&](Candidate& c) {
+        while (!heap.empty()) {
+            std::pop_heap(heap.begin(), heap.end());
+            c = heap.back();
+            heap.pop_back();
+            if (!added[c.face] && restartScore[c.face] == c.score) return true;
+        }
+        return false;
+    };
+
+    std::vector<int> order;
+    order.reserve(faces.size());
+    std::vector<int> cache;  // most recent first
+    std::vector<Candidate> candidates;
+    candidates.reserve(kRestartCandidates);
+    int best = -1;
+    while (order.size() < faces.size()) {
+        if (best < 0) {
+            // cache exhausted: start again from the best face that is left, the one nearest in uv space to the
+            // last face among equals, so the next strip keeps reading the same part of the texture
+            const Vec2f last = order.empty() ? Vec2f(0.f, 0.f) : uv_center(faces[order.back()], uvs);
+            for (int f : changedFaces) {
+                changed[f] = 0;
+                if (!added[f]) pushRestart(f);
+            }
+            changedFaces.clear();
+            candidates.clear();
+            Candidate c;
+            while (candidates.size() < kRestartCandidates && popRestart(c)) {
+                if (!candidates.empty() && c.score < candidates.front().score - 1e-4f) {
+                    heap.push_back(c);
+                    std::push_heap(heap.begin(), heap.end());
+                    break;
+                }
+                candidates.push_back(c);
+            }
+            float bestDistance = 1e30f;
+            for (const Candidate& candidate : candidates) {
+                const Vec2f d = uv_center(faces[candidate.face], uvs) - last;
+                if (d * d < bestDistance) {
+                    bestDistance = d * d;
+                    best = candidate.face;
+                }
+            }
+            for (const Candidate& candidate : candidates) {
+                if (candidate.face == best) continue;
+                heap.push_back(candidate);
+                std::push_heap(heap.begin(), heap.end());
+            }
+        }
+        added[best] = 1;
+        order.push_back(best);
+
+        std::vector<int> next;
+        next.reserve(cache.size() + 3);
+        for (const Mesh::Vertex& v : faces[best]) {
+            --remaining[v.vertIdx()];
+            if (std::find(next.begin(), next.end(), v.vertIdx()) == next.end()) next.push_back(v.vertIdx());
+        }
+        for (int v : next)
+            for (int f : vertFaces[v])
+                if (!added[f] && !changed[f]) {
+                    changed[f] = 1;
+                    changedFaces.push_back(f);
+                }
+        for (int v : cache)
+            if (std::find(next.begin(), next.end(), v) == next.end()) next.push_back(v);
+        for (size_t i = 0; i < next.size(); ++i) {
+            const int v = next[i];
+            cachePos[v] = i < kCacheSize ? static_cast<int>(i) : -1;
+            score[v] = vertex_score(cachePos[v], remaining[v]);
+        }
+        if (next.size() > kCacheSize) next.resize(kCacheSize);
+        cache.swap(next);
+
+        // the best face touching the cache
+        best = -1;
+        float bestScore = -1e30f;
+        for (int v : cache)
+            for (int f : vertFaces[v]) {
+                if (added[f]) continue;
+                const float s = faceScore(f);
+                if (s > bestScore) {
+                    bestScore = s;
+                    best = f;
+                }
+            }
+    }
+    return order;
+}
+
+// new index of every attribute in order of first use, unused entries go last
+std::vector<int> first_use_order(const std::vector<std::vector<Mesh::Vertex>>& faces, size_t count, int attribute) {
+    std::vector<int> remap(count, -1);
+    int next = 0;
+    for (const std::vector<Mesh::Vertex>& face : faces)
+        for (const Mesh::Vertex& v : face)
+            if (remap[v.raw[attribute]] < 0) remap[v.raw[attribute]] = next++;
+    for (int& r : remap)
+        if (r < 0) r = next++;
+    return remap;
+}
+
+template <typename T>
+void apply_remap(std::vector<T>& items, const std::vector<int>& remap) {
+    std::vector<T> reordered(items.size());
+    for (size_t i = 0; i < items.size(); ++i) reordered[remap[i]] = items[i];
+    items.swap(reordered);
+}
+
+}  // namespace
+
+float vertex_cache_miss_ratio(const Mesh& mesh, int cacheSize) {
+    if (!mesh.nfaces()) return 0.f;
+    std::deque<int> cache;
+    size_t misses = 0;
+    for (size_t f = 0; f < mesh.nfaces(); ++f)
+        for (const Mesh::Vertex& v : mesh.face(f)) {
+            if (std::find(cache.begin(), cache.end(), v.vertIdx()) != cache.end()) continue;
+            ++misses;
+            cache.push_back(v.vertIdx());
+            if (static_cast<int>(cache.size()) > cacheSize) cache.pop_front();
+        }
+    return static_cast<float>(misses) / mesh.nfaces();
+}
+
+void Mesh::optimize() {
+    acmrBefore = vertex_cache_miss_ratio(*this);
+    const std::vector<int> order = forsyth_order(faces, verts.size(), uvs);
+    std::vector<std::vector<Vertex>> reordered;
+    reordered.reserve(faces.size());
+    for (int f : order) reordered.push_back(std::move(faces[f]));
+    faces.swap(reordered);
+
+    // positions, uvs and normals in the order the faces fetch them
+    const std::vector<int> vertRemap = first_use_order(faces, verts.size(), 0);
+    const std::vector<int> uvRemap = first_use_order(faces, uvs.size(), 1);
+    const std::vector<int> normalRemap = first_use_order(faces, normals.size(), 2);
+    for (std::vector<Vertex>& face : faces)
+        for (Vertex& v : face) v = Vertex(vertRemap[v.vertIdx()], uvRemap[v.uvIdx()], normalRemap[v.normalIdx()]);
+    apply_remap(verts, vertRemap);
+    if (!source.empty()) apply_remap(source, vertRemap);
+    for (int& p : filePosition) p = vertRemap[p];
+    if (!skin.empty()) apply_remap(skin, vertRemap);
+    apply_remap(uvs, uvRemap);
+    apply_remap(normals, normalRemap);
+    acmrAfter = vertex_cache_miss_ratio(*this);
+}
@@ -0,0 +1,10 @@
+#include "resource/model.h"
+
+void Model::selectLod(float pixelRadius, float maxError) {
+    lodLevel = 0;
+    if (meshRes->boundRadius() <= 0.f) return;
+    // object space error to pixels, levels only get coarser
+    const float pixelsPerUnit = pixelRadius / meshRes->boundRadius();
+    for (int level = 1; level < meshRes->nlods() && meshRes->lodError(level) * pixelsPerUnit <= maxError; ++level)
+        lodLevel = level;
+}
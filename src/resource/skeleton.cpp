@@ -0,0 +1,33 @@
+#include "resource/skeleton.h"
+
+#include <atomic>
+
+namespace {
+
+std::atomic<unsigned> poseVersions{0};
+
+}  // namespace
+
+int Skeleton::addJoint(int parent, const Matrix4x4& bind) {
+    parents.push_back(parent);
+    binds.push_back(bind);
+    Matrix4x4 m = bind;
+    inverseBinds.push_back(m.invert());
+    return static_cast<int>(parents.size()) - 1;
+}
+
+Pose::Pose(const Skeleton& s) : skeleton(&s), locals(s.njoints()), palette(s.njoints()) {
+    for (size_t j = 0; j < s.njoints(); ++j)
+        locals[j] = s.parent(j) < 0 ? s.bind(j) : s.inverseBind(s.parent(j)) * s.bind(j);
+    update();
+}
+
+void Pose::update() {
+    std::vector<Matrix4x4> global(locals.size());
+    for (size_t j = 0; j < locals.size(); ++j) {
+        const int p = skeleton->parent(j);
+        global[j] = p < 0 ? locals[j] : global[p] * locals[j];
+        palette[j] = global[j] * skeleton->inverseBind(j);
+    }
+    version = ++poseVersions;
+}
@@ -0,0 +1,78 @@
+#include "util/frameArena.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <mutex>
+
+namespace {
+
+// live arenas for totals(), threads add theirs on first use and remove it when they exit
+std::mutex registryMutex;
+std::vector<const FrameArena*>& registry() {
+    static std::vector<const FrameArena*> arenas;
+    return arenas;
+}
+
+}  // namespace
+
+FrameArena::FrameArena(size_t size) : blockSize(std::max<size_t>(size, 64)) {}
+
+FrameArena::~FrameArena() {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    std::vector<const FrameArena*>& arenas = registry();
+    arenas.erase(std::remove(arenas.begin(), arenas.end(), this), arenas.end());
+}
+
+FrameArena& FrameArena::local() {
+    thread_local FrameArena* arena = nullptr;
+    if (!arena) {
+        thread_local FrameArena storage;
+        arena = &storage;
+        std::lock_guard<std::mutex> lock(registryMutex);
+        registry().push_back(arena);
+    }
+    return *arena;
+}
+
+FrameArena::Stats FrameArena::totals() {
+    Stats stats;
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (const FrameArena* arena : registry()) {
+        ++stats.arenas;
+        stats.used += arena->used();
+        stats.highWater += arena->highWater();
+        stats.reserved += arena->reserved();
+    }
+    return stats;
+}
+
+void FrameArena::printStats(std::ostream& out) {
+    const Stats stats = totals();
+    out << "frame arenas: " << stats.arenas << " threads, high water " << std::fixed << std::setprecision(1)
+        << stats.highWater / 1024. << " KB, reserved " << stats.reserved / 1024. << " KB" << std::defaultfloat
+        << std::endl;
+}
+
+void* FrameArena::allocate(size_t bytes, size_t alignment) {
+    for (;;) {
+        if (current < blocks.size()) {
+            Block& block = blocks[current];
+            const uintptr_t start = reinterpret_cast<uintptr_t>(block.data.get());
+            const size_t aligned = (start + offset + alignment - 1) / alignment * alignment - start;
+            if (aligned + bytes <= block.size) {
+                offset = aligned + bytes;
+                high = std::max(high, used());
+                return block.data.get() + aligned;
+            }
+            // the tail of this block stays unused until the next rewind
+            base += block.size;
+            offset = 0;
+            ++current;
+            continue;
+        }
+        const size_t size = std::max(blockSize, bytes + alignment);
+        blocks.push_back(Block{std::unique_ptr<unsigned char[]>(new unsigned char[size]), size});
+        capacity += size;
+    }
+}
@@ -0,0 +1,287 @@
+#include "util/jobSystem.h"
+
+#include <iomanip>
+#include <string>
+
+#include "util/profiler.h"
+
+namespace {
+
+thread_local const JobSystem* currentSystem = nullptr;  // scheduler the calling thread works for
+thread_local size_t currentQueue = 0;
+thread_local int runDepth = 0;  // jobs on the stack of this thread, nested ones run inside wait()
+
+// recycles the blocks of shared_ptr control block plus Job, all of one size
+class JobPool {
+   public:
+    void* get(size_t bytes) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (bytes == blockBytes && freeList) {
+                Node* node = freeList;
+                freeList = node->next;
+                return node;
+            }
+        }
+        return ::operator new(bytes);
+    }
+    void put(void* p, size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!blockBytes) blockBytes = bytes;
+        if (bytes != blockBytes || bytes < sizeof(Node)) {
+            ::operator delete(p);
+            return;
+        }
+        Node* node = static_cast<Node*>(p);
+        node->next = freeList;
+        freeList = node;
+    }
+
+   private:
+    struct Node {
+        Node* next;
+    };
+    std::mutex mutex;
+    Node* freeList = nullptr;
+    size_t blockBytes = 0;
+};
+
+JobPool& job_pool() {
+    static JobPool* pool = new JobPool();  // never destroyed, handles may outlive every static
+    return *pool;
+}
+
+template <typename T>
+class PoolAllocator {
+   public:
+    using value_type = T;
+
+    PoolAllocator() = default;
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(job_pool().get(n * sizeof(T))); }
+    void deallocate(T* p, size_t n) { job_pool().put(p, n * sizeof(T)); }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>&) const { return false; }
+};
+
+}  // namespace
+
+void JobSystem::HandleRing::push_back(Handle job) {
+    if (count == slots.size()) {
+        std::vector<Handle> grown(std::max<size_t>(64, slots.size() * 2));
+        for (size_t i = 0; i < count; ++i) grown[i] = std::move(slots[(head + i) % slots.size()]);
+        slots.swap(grown);
+        head = 0;
+    }
+    slots[(head + count++) % slots.size()] = std::move(job);
+}
+
+JobSystem::Handle JobSystem::HandleRing::pop_back() { return std::move(slots[(head + --count) % slots.size()]); }
+
+JobSystem::Handle JobSystem::HandleRing::pop_front() {
+    Handle job = std::move(slots[head]);
+    head = (head + 1) % slots.size();
+    --count;
+    return job;
+}
+
+JobSystem& JobSystem::instance() {
+    static JobSystem system;
+    return system;
+}
+
+JobSystem::JobSystem(int threads) { start(threads); }
+
+JobSystem::~JobSystem() { stop(); }
+
+void JobSystem::setThreadCount(int threads) {
+    stop();
+    start(threads);
+}
+
+void JobSystem::start(int threads) {
+    if (threads <= 0) threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    queues.clear();
+    for (int i = 0; i < threads; ++i) queues.emplace_back(new Queue());
+    for (size_t i = 1; i < queues.size(); ++i) workers.emplace_back([this, i]() { workerLoop(i); });
+    statsStartUs = Profiler::nowUs();
+}
+
+void JobSystem::stop() {
+    stopping = true;
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wakeUp.notify_all();
+    for (std::thread& t : workers) t.join();
+    workers.clear();
+    stopping = false;
+}
+
+size_t JobSystem::self() const { return currentSystem == this ? currentQueue : 0; }
+
+JobSystem::Handle JobSystem::allocate() { return std::allocate_shared<Job>(PoolAllocator<Job>()); }
+
+void JobSystem::schedule(const Handle& job, const Handle* dependencies, size_t count) {
+    // the links are inline, the last one waits for a join job over the rest when there are too many
+    Handle join;
+    if (count > Job::kMaxDependencies) {
+        join = allocate();
+        join->invoke = [](void*) {};
+        schedule(join, dependencies + Job::kMaxDependencies - 1, count - (Job::kMaxDependencies - 1));
+        count = Job::kMaxDependencies - 1;
+    }
+    size_t links = 0;
+    const auto link = [&](const Handle& dependency) {
+        if (!dependency) return;
+        std::lock_guard<std::mutex> lock(dependency->mutex);
+        if (dependency->finished) return;
+        ++job->pending;
+        Job::Link& link = job->links[links++];
+        link.job = job;
+        link.next = dependency->continuations;
+        dependency->continuations = &link;
+    };
+    for (size_t i = 0; i < count; ++i) link(dependencies[i]);
+    link(join);
+    if (--job->pending == 0) enqueue(job);
+}
+
+void JobSystem::enqueue(Handle job) {
+    Queue& queue = *queues[self()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back(std::move(job));
+    }
+    ++queued;
+    if (sleepers > 0) {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wakeUp.notify_one();
+    }
+}
+
+JobSystem::Handle JobSystem::take(size_t me, bool& stolen) {
+    Handle job;
+    const auto pop = [&](Queue& queue, bool back) {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.jobs.empty()) return false;
+        job = back ? queue.jobs.pop_back() : queue.jobs.pop_front();
+        --queued;
+        return true;
+    };
+    if (!queued) return job;
+    // own deque newest first, then the shared queue, then the oldest jobs of the other workers
+    if ((me && pop(*queues[me], true)) || pop(*queues[0], false)) return job;
+    for (size_t i = 1; i < queues.size(); ++i) {
+        const size_t victim = (me + i) % queues.size();
+        if (victim && pop(*queues[victim], false)) {
+            stolen = true;
+            return job;
+        }
+    }
+    return job;
+}
+
+bool JobSystem::runOne(size_t me) {
+    bool stolen = false;
+    Handle job = take(me, stolen);
+    if (!job) return false;
+    const uint64_t start = Profiler::nowUs();
+    ++runDepth;
+    {
+        FrameArena::Scope scope(FrameArena::local());
+        job->run();
+    }
+    --runDepth;
+    Queue& stats = *queues[me];
+    ++stats.ran;
+    if (stolen) ++stats.stolen;
+    if (!runDepth) stats.busyUs += Profiler::nowUs() - start;  // nested jobs are inside the outer one's time
+    finish(job);
+    return true;
+}
+
+void JobSystem::finish(const Handle& job) {
+    Job::Link* next;
+    {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        job->finished = true;
+        next = job->continuations;
+        job->continuations = nullptr;
+    }
+    job->release();  // drop the captures now, handles may live on
+    while (next) {
+        Job::Link* link = next;
+        next = link->next;  // before the waiting job, which owns the link, may go away
+        Handle waiting = std::move(link->job);
+        if (--waiting->pending == 0) enqueue(std::move(waiting));
+    }
+    if (sleepers > 0) {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wakeUp.notify_all();
+    }
+}
+
+void JobSystem::sleep(const std::function<bool()>& wake) {
+    ++sleepers;
+    {
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeUp.wait(lock, [&]() { return stopping || queued > 0 || wake(); });
+    }
+    --sleepers;
+}
+
+void JobSystem::workerLoop(size_t me) {
+    currentSystem = this;
+    currentQueue = me;
+    while (!stopping)
+        if (!runOne(me)) sleep([]() { return false; });
+}
+
+bool JobSystem::done(const Handle& job) { return !job || job->finished; }
+
+void JobSystem::wait(const Handle& job) {
+    const size_t me = self();
+    while (!done(job))
+        if (!runOne(me)) sleep([&]() { return done(job); });
+}
+
+void JobSystem::wait(const std::vector<Handle>& jobs) {
+    for (const Handle& job : jobs) wait(job);
+}
+
+std::vector<JobSystem::WorkerStats> JobSystem::getStats() const {
+    std::vector<WorkerStats> stats;
+    for (const auto& queue : queues) stats.push_back({queue->ran, queue->stolen, queue->busyUs / 1e3});
+    return stats;
+}
+
+void JobSystem::resetStats() {
+    for (auto& queue : queues) {
+        queue->ran = 0;
+        queue->stolen = 0;
+        queue->busyUs = 0;
+    }
+    statsStartUs = Profiler::nowUs();
+}
+
+void JobSystem::printStats(std::ostream& out) const {
+    const double wallMs = (Profiler::nowUs() - statsStartUs) / 1e3;
+    const std::vector<WorkerStats> stats = getStats();
+    out << "---- jobs (" << stats.size() << " threads, worker, jobs, steals, busy ms, utilisation) ----" << std::endl;
+    for (size_t i = 0; i < stats.size(); ++i) {
+        out << std::left << std::setw(10) << (i ? "worker " + std::to_string(i) : std::string("callers"))
+            << std::right << std::setw(10) << stats[i].jobs << std::setw(10) << stats[i].steals << std::setw(12)
+            << std::fixed << std::setprecision(3) << stats[i].busyMs << std::setw(9) << std::setprecision(1)
+            << (wallMs > 0. ? 100. * stats[i].busyMs / wallMs : 0.) << "%" << std::defaultfloat << std::endl;
+    }
+}
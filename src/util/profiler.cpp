@@ -0,0 +1,171 @@
+#include "util/profiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct TraceEvent {
+    const char* name;
+    uint64_t start;
+    uint64_t duration;
+};
+
+// written by its own thread, read and reset by any: relaxed atomic counters, events under the profile's lock
+struct ThreadProfile {
+    int tid;
+    std::atomic<uint64_t> counters[static_cast<size_t>(Counter::Count)] = {};
+    std::mutex eventsMutex;
+    std::vector<TraceEvent> events;
+
+    explicit ThreadProfile(int t) : tid(t) {}
+};
+
+// profiles outlive their threads, e.g. the workers of a restarted JobSystem
+static std::mutex profilesMutex;
+static std::vector<std::unique_ptr<ThreadProfile>> profiles;
+
+static ThreadProfile& thread_profile() {
+    thread_local ThreadProfile* profile = nullptr;
+    if (!profile) {
+        std::lock_guard<std::mutex> lock(profilesMutex);
+        profiles.emplace_back(new ThreadProfile(static_cast<int>(profiles.size())));
+        profile = profiles.back().get();
+    }
+    return *profile;
+}
+
+void Profiler::add(Counter c, uint64_t n) {
+    thread_profile().counters[static_cast<size_t>(c)].fetch_add(n, std::memory_order_relaxed);
+}
+
+void Profiler::addEvent(const char* name, uint64_t startUs, uint64_t durationUs) {
+    ThreadProfile& profile = thread_profile();
+    std::lock_guard<std::mutex> lock(profile.eventsMutex);
+    profile.events.push_back({name, startUs, durationUs});
+}
+
+uint64_t Profiler::nowUs() {
+    static const auto epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void Profiler::reset() {
+    std::lock_guard<std::mutex> lock(profilesMutex);
+    for (auto& profile : profiles) {
+        for (std::atomic<uint64_t>& counter : profile->counters) counter.store(0, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> events(profile->eventsMutex);
+        profile->events.clear();
+    }
+}
+
+PipelineCounters Profiler::counters() {
+    std::lock_guard<std::mutex> lock(profilesMutex);
+    PipelineCounters total;
+    for (auto& profile : profiles)
+        for (size_t i = 0; i < static_cast<size_t>(Counter::Count); ++i)
+            total.value[i] += profile->counters[i].load(std::memory_order_relaxed);
+    return total;
+}
+
+uint64_t Profiler::threadCount(Counter c) {
+    return thread_profile().counters[static_cast<size_t>(c)].load(std::memory_order_relaxed);
+}
+
+const char* Profiler::counterName(Counter c) {
+    switch (c) {
+        case Counter::TrianglesSubmitted:
+            return "triangles submitted";
+        case Counter::TrianglesCulled:
+            return "triangles culled";
+        case Counter::TrianglesRasterized:
+            return "triangles rasterized";
+        case Counter::PixelsCovered:
+            return "pixels covered";
+        case Counter::PixelsDepthRejected:
+            return "pixels depth rejected";
+        case Counter::PixelsShaded:
+            return "pixels shaded";
+        case Counter::PixelsDiscarded:
+            return "pixels discarded";
+        case Counter::PixelsResolved:
+            return "pixels resolved";
+        case Counter::PixelsVisible:
+            return "pixels visible";
+        case Counter::MainPassShades:
+            return "main pass shades";
+        case Counter::ShadowPassesReused:
+            return "shadow passes reused";
+        case Counter::TilesRedrawn:
+            return "tiles redrawn";
+        case Counter::DepthTilesAccepted:
+            return "depth tiles accepted";
+        case Counter::DepthTilesRejected:
+            return "depth tiles rejected";
+        case Counter::InstancesDrawn:
+            return "instances drawn";
+        case Counter::InstancesCulled:
+            return "instances culled";
+        default:
+            return "";
+    }
+}
+
+void Profiler::printSummary(std::ostream& out) {
+    const PipelineCounters total = counters();
+    out << "---- pipeline counters ----" << std::endl;
+    for (size_t i = 0; i < static_cast<size_t>(Counter::Count); ++i) {
+        out << std::left << std::setw(24) << counterName(static_cast<Counter>(i)) << std::right << std::setw(14)
+            << total.value[i] << std::endl;
+    }
+    // full shader invocations per pixel that ends up on screen
+    if (total[Counter::PixelsVisible]) {
+        out << std::left << std::setw(24) << "shading overdraw" << std::right << std::setw(14)
+            << static_cast<double>(total[Counter::MainPassShades]) / total[Counter::PixelsVisible] << std::endl;
+    }
+
+    std::lock_guard<std::mutex> lock(profilesMutex);
+    out << "---- scopes (thread, calls, total ms) ----" << std::endl;
+    for (auto& profile : profiles) {
+        std::map<std::string, std::pair<uint64_t, uint64_t>> scopes;  // name -> (calls, total us)
+        {
+            std::lock_guard<std::mutex> events(profile->eventsMutex);
+            for (const TraceEvent& e : profile->events) {
+                auto& s = scopes[e.name];
+                ++s.first;
+                s.second += e.duration;
+            }
+        }
+        for (const auto& s : scopes) {
+            out << std::left << std::setw(24) << s.first << std::right << std::setw(4) << profile->tid << std::setw(10)
+                << s.second.first << std::setw(12) << std::fixed << std::setprecision(3) << s.second.second / 1e3
+                << std::defaultfloat << std::endl;
+        }
+    }
+}
+
+bool Profiler::writeChromeTrace(const std::string& filename) {
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(profilesMutex);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    for (auto& profile : profiles) {
+        std::lock_guard<std::mutex> events(profile->eventsMutex);
+        for (const TraceEvent& e : profile->events) {
+            out << (first ? "" : ",\n") << "{\"name\": \"" << e.name
+                << "\", \"cat\": \"render\", \"ph\": \"X\", \"ts\": " << e.start << ", \"dur\": " << e.duration
+                << ", \"pid\": 1, \"tid\": " << profile->tid << "}";
+            first = false;
+        }
+    }
+    out << "\n]}\n";
+    return out.good();
+}
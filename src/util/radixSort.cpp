@@ -0,0 +1,27 @@
+#include "util/radixSort.h"
+
+#include <algorithm>
+
+void radix_sort(uint64_t* items, uint64_t* scratch, size_t n) {
+    if (n < 2) return;
+    // histograms of all four key bytes in one read
+    size_t counts[4][256] = {};
+    for (size_t i = 0; i < n; ++i)
+        for (int pass = 0; pass < 4; ++pass) ++counts[pass][(items[i] >> (32 + 8 * pass)) & 0xff];
+    uint64_t* from = items;
+    uint64_t* to = scratch;
+    for (int pass = 0; pass < 4; ++pass) {
+        const int shift = 32 + 8 * pass;
+        size_t* count = counts[pass];
+        if (count[(from[0] >> shift) & 0xff] == n) continue;  // every key has this byte
+        size_t offset = 0;
+        for (size_t b = 0; b < 256; ++b) {
+            const size_t c = count[b];
+            count[b] = offset;
+            offset += c;
+        }
+        for (size_t i = 0; i < n; ++i) to[count[(from[i] >> shift) & 0xff]++] = from[i];
+        std::swap(from, to);
+    }
+    if (from != items) std::copy(from, from + n, items);
+}
@@ -41,13 +41,13 @@ TGAImage &TGAImage::operator=(const TGAImage &img) {
     return *this;
 }
 
-bool TGAImage::read_tga_file(const char *filename) {
+bool TGAImage::read_tga_file(const char *filename, std::ostream &log) {
     if (data) delete[] data;
     data = NULL;
     std::ifstream in;
     in.open(filename, std::ios::binary);
     if (!in.is_open()) {
-        std::cerr << "can't open file " << filename << "\n";
+        log << "can't open file " << filename << "\n";
         in.close();
         return false;
     }
@@ -55,7 +55,7 @@ bool TGAImage::read_tga_file(const char *filename) {
     in.read((char *)&header, sizeof(header));
     if (!in.good()) {
         in.close();
-        std::cerr << "an error occured while reading the header\n";
+        log << "an error occured while reading the header\n";
         return false;
     }
     width = header.width;
@@ -63,7 +63,7 @@ bool TGAImage::read_tga_file(const char *filename) {
     bytespp = header.bitsperpixel >> 3;
     if (width <= 0 || height <= 0 || (bytespp != GRAYSCALE && bytespp != RGB && bytespp != RGBA)) {
         in.close();
-        std::cerr << "bad bpp (or width/height) value\n";
+        log << "bad bpp (or width/height) value\n";
         return false;
     }
     unsigned long nbytes = bytespp * width * height;
@@ -72,18 +72,18 @@ bool TGAImage::read_tga_file(const char *filename) {
         in.read((char *)data, nbytes);
         if (!in.good()) {
             in.close();
-            std::cerr << "an error occured while reading the data\n";
+            log << "an error occured while reading the data\n";
             return false;
         }
     } else if (10 == header.datatypecode || 11 == header.datatypecode) {
-        if (!load_rle_data(in)) {
+        if (!load_rle_data(in, log)) {
             in.close();
-            std::cerr << "an error occured while reading the data\n";
+            log << "an error occured while reading the data\n";
             return false;
         }
     } else {
         in.close();
-        std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
+        log << "unknown file format " << (int)header.datatypecode << "\n";
         return false;
     }
     if (!(header.imagedescriptor & 0x20)) {
@@ -92,12 +92,12 @@ bool TGAImage::read_tga_file(const char *filename) {
     if (header.imagedescriptor & 0x10) {
         flip_horizontally();
     }
-    std::cerr << width << "x" << height << "/" << bytespp * 8 << "\n";
+    log << width << "x" << height << "/" << bytespp * 8 << "\n";
     in.close();
     return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream &in) {
+bool TGAImage::load_rle_data(std::ifstream &in, std::ostream &log) {
     unsigned long pixelcount = width * height;
     unsigned long currentpixel = 0;
     unsigned long currentbyte = 0;
@@ -106,7 +106,7 @@ bool TGAImage::load_rle_data(std::ifstream &in) {
         unsigned char chunkheader = 0;
         chunkheader = in.get();
         if (!in.good()) {
-            std::cerr << "an error occured while reading the data\n";
+            log << "an error occured while reading the data\n";
             return false;
         }
         if (chunkheader < 128) {
@@ -114,13 +114,13 @@ bool TGAImage::load_rle_data(std::ifstream &in) {
             for (int i = 0; i < chunkheader; i++) {
                 in.read((char *)colorbuffer.raw, bytespp);
                 if (!in.good()) {
-                    std::cerr << "an error occured while reading the header\n";
+                    log << "an error occured while reading the header\n";
                     return false;
                 }
                 for (int t = 0; t < bytespp; t++) data[currentbyte++] = colorbuffer.raw[t];
                 currentpixel++;
                 if (currentpixel > pixelcount) {
-                    std::cerr << "Too many pixels read\n";
+                    log << "Too many pixels read\n";
                     return false;
                 }
             }
@@ -128,14 +128,14 @@ bool TGAImage::load_rle_data(std::ifstream &in) {
             chunkheader -= 127;
             in.read((char *)colorbuffer.raw, bytespp);
             if (!in.good()) {
-                std::cerr << "an error occured while reading the header\n";
+                log << "an error occured while reading the header\n";
                 return false;
             }
             for (int i = 0; i < chunkheader; i++) {
                 for (int t = 0; t < bytespp; t++) data[currentbyte++] = colorbuffer.raw[t];
                 currentpixel++;
                 if (currentpixel > pixelcount) {
-                    std::cerr << "Too many pixels read\n";
+                    log << "Too many pixels read\n";
                     return false;
                 }
             }
@@ -145,10 +145,6 @@ bool TGAImage::load_rle_data(std::ifstream &in) {
 }
 
 bool TGAImage::write_tga_file(const char *filename, bool rle) {
-    unsigned char developer_area_ref[4] = {0, 0, 0, 0};
-    unsigned char extension_area_ref[4] = {0, 0, 0, 0};
-    unsigned char footer[18] = {'T', 'R', 'U', 'E', 'V', 'I', 'S', 'I', 'O',
-                                'N', '-', 'X', 'F', 'I', 'L', 'E', '.', '\0'};
     std::ofstream out;
     out.open(filename, std::ios::binary);
     if (!out.is_open()) {
@@ -156,6 +152,16 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
         out.close();
         return false;
     }
+    const bool ok = write_tga(out, rle);
+    out.close();
+    return ok;
+}
+
+bool TGAImage::write_tga(std::ostream &out, bool rle) {
+    unsigned char developer_area_ref[4] = {0, 0, 0, 0};
+    unsigned char extension_area_ref[4] = {0, 0, 0, 0};
+    unsigned char footer[18] = {'T', 'R', 'U', 'E', 'V', 'I', 'S', 'I', 'O',
+                                'N', '-', 'X', 'F', 'I', 'L', 'E', '.', '\0'};
     TGA_Header header;
     memset((void *)&header, 0, sizeof(header));
     header.bitsperpixel = bytespp << 3;
@@ -165,7 +171,6 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
     header.imagedescriptor = 0x20;  // top-left origin
     out.write((char *)&header, sizeof(header));
     if (!out.good()) {
-        out.close();
         std::cerr << "can't dump the tga file\n";
         return false;
     }
@@ -173,12 +178,10 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
         out.write((char *)data, width * height * bytespp);
         if (!out.good()) {
             std::cerr << "can't unload raw data\n";
-            out.close();
             return false;
         }
     } else {
         if (!unload_rle_data(out)) {
-            out.close();
             std::cerr << "can't unload rle data\n";
             return false;
         }
@@ -186,27 +189,23 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
     out.write((char *)developer_area_ref, sizeof(developer_area_ref));
     if (!out.good()) {
         std::cerr << "can't dump the tga file\n";
-        out.close();
         return false;
     }
     out.write((char *)extension_area_ref, sizeof(extension_area_ref));
     if (!out.good()) {
         std::cerr << "can't dump the tga file\n";
-        out.close();
         return false;
     }
     out.write((char *)footer, sizeof(footer));
     if (!out.good()) {
         std::cerr << "can't dump the tga file\n";
-        out.close();
         return false;
     }
-    out.close();
     return true;
 }
 
 // TODO: it is not necessary to break a raw chunk for two equal pixels (for the matter of the resulting size)
-bool TGAImage::unload_rle_data(std::ofstream &out) {
+bool TGAImage::unload_rle_data(std::ostream &out) {
     const unsigned char max_chunk_length = 128;
     unsigned long npixels = width * height;
     unsigned long curpix = 0;
@@ -301,6 +300,8 @@ bool TGAImage::flip_vertically() {
 
 unsigned char *TGAImage::buffer() { return data; }
 
+const unsigned char *TGAImage::buffer() const { return data; }
+
 void TGAImage::clear() { memset((void *)data, 0, width * height * bytespp); }
 
 bool TGAImage::scale(int w, int h) {
@@ -338,4 +339,32 @@ bool TGAImage::scale(int w, int h) {
     width = w;
     height = h;
     return true;
-}
\ No newline at end of file
+}
+TGAStreamWriter::TGAStreamWriter(const char *filename, int w, int h, int bpp)
+    : out(filename, std::ios::binary), width(w), height(h), bytespp(bpp) {
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return;
+    }
+    unsigned char tail[26] = {0, 0, 0, 0, 0, 0, 0, 0, 'T', 'R', 'U', 'E', 'V', 'I', 'S',
+                              'I', 'O', 'N', '-', 'X', 'F', 'I', 'L', 'E', '.', '\0'};
+    TGA_Header header;
+    memset((void *)&header, 0, sizeof(header));
+    header.bitsperpixel = bytespp << 3;
+    header.width = width;
+    header.height = height;
+    header.datatypecode = (bytespp == TGAImage::GRAYSCALE ? 3 : 2);
+    header.imagedescriptor = 0x00;  // bottom-left origin
+    out.write((char *)&header, sizeof(header));
+    // developer and extension area references plus the footer after the pixels, the gap reads as zeros
+    out.seekp(sizeof(header) + static_cast<std::streamoff>(width) * height * bytespp);
+    out.write((char *)tail, sizeof(tail));
+    if (!out.good()) std::cerr << "can't dump the tga file\n";
+}
+
+bool TGAStreamWriter::write_pixels(int x, int y, const unsigned char *pixels, int count) {
+    if (x < 0 || y < 0 || count < 0 || x + count > width || y >= height) return false;
+    out.seekp(sizeof(TGA_Header) + (static_cast<std::streamoff>(y) * width + x) * bytespp);
+    out.write((const char *)pixels, static_cast<std::streamsize>(count) * bytespp);
+    return out.good();
+}
@@ -0,0 +1,701 @@
+// MiniRendererBench: fixed micro and macro benchmarks, results written as JSON.
+//
+// usage: MiniRendererBench [--resource DIR] [--out FILE] [--iterations N] [--size N] [--jobs N]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "graphics.h"
+#include "render/depthBuffer.h"
+#include "render/ibl.h"
+#include "render/progressiveRenderer.h"
+#include "render/renderer.h"
+#include "render/scene.h"
+#include "render/skinning.h"
+#include "resource/material.h"
+#include "resource/mesh.h"
+#include "util/frameArena.h"
+#include "util/jobSystem.h"
+#include "util/profiler.h"
+
+// every heap allocation of the process goes through here (plain, array and over-aligned forms, the nothrow ones
+// forward to them), so a result can say how many its samples made
+std::atomic<uint64_t> heapAllocations{0};
+
+static void* counted_alloc(size_t size, size_t alignment) {
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    size = size ? size : 1;
+    void* p = nullptr;
+    if (alignment <= alignof(std::max_align_t)) {
+        p = std::malloc(size);
+    } else {
+#ifdef _WIN32
+        p = _aligned_malloc(size, alignment);
+#else
+        p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+    }
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+static void counted_free(void* p, size_t alignment) noexcept {
+#ifdef _WIN32
+    if (alignment > alignof(std::max_align_t)) {
+        _aligned_free(p);
+        return;
+    }
+#endif
+    (void)alignment;
+    std::free(p);
+}
+
+void* operator new(size_t size) { return counted_alloc(size, 0); }
+void* operator new[](size_t size) { return counted_alloc(size, 0); }
+void* operator new(size_t size, std::align_val_t a) { return counted_alloc(size, static_cast<size_t>(a)); }
+void* operator new[](size_t size, std::align_val_t a) { return counted_alloc(size, static_cast<size_t>(a)); }
+void operator delete(void* p) noexcept { counted_free(p, 0); }
+void operator delete[](void* p) noexcept { counted_free(p, 0); }
+void operator delete(void* p, size_t) noexcept { counted_free(p, 0); }
+void operator delete[](void* p, size_t) noexcept { counted_free(p, 0); }
+void operator delete(void* p, std::align_val_t a) noexcept { counted_free(p, static_cast<size_t>(a)); }
+void operator delete[](void* p, std::align_val_t a) noexcept { counted_free(p, static_cast<size_t>(a)); }
+void operator delete(void* p, size_t, std::align_val_t a) noexcept { counted_free(p, static_cast<size_t>(a)); }
+void operator delete[](void* p, size_t, std::align_val_t a) noexcept { counted_free(p, static_cast<size_t>(a)); }
+
+struct BenchResult {
+    std::string name;
+    std::string unit;  // what `work` counts, e.g. "faces", "pixels"
+    double work;       // units processed by one sample
+    std::vector<double> samples;  // seconds
+    double depthBytes = 0.;       // depth and msaa buffer memory after the last sample, 0 if not tracked
+    double textureBytes = 0.;     // material maps the fetches read from, 0 if not tracked
+    double allocations = 0.;      // heap allocations per sample
+    double shades = 0.;           // main pass fragment() calls of the last sample, profiling builds only
+    double visible = 0.;          // covered pixels after it, shades / visible is the shading overdraw
+};
+
+struct BenchConfig {
+    std::string resourceDir = "../resource";
+    std::string outFile = "bench.json";
+    int iterations = 5;
+    int size = 2048;
+};
+
+// deterministic generator so every run draws exactly the same triangles and texture coordinates
+struct XorShift {
+    uint32_t state;
+    explicit XorShift(uint32_t seed) : state(seed) {}
+    float next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return (state >> 8) * (1.f / 16777216.f);
+    }
+};
+
+volatile unsigned int benchSink = 0;  // keeps the optimizer from dropping measured work
+
+struct FlatShader : IShader {
+    virtual Vec4f vertex(const int& faceIdx, const int& nthvert) { return Vec4f(); }
+    virtual bool fragment(const Vec3f& viewCoord, const Vec3f bar, const float varying[],
+                          TGAColor& outColor) const {
+        outColor = TGAColor(static_cast<unsigned char>(bar.x * 255), static_cast<unsigned char>(bar.y * 255),
+                            static_cast<unsigned char>(bar.z * 255), 255);
+        return false;
+    }
+};
+
+template <typename Setup, typename Fn>
+BenchResult measure(const std::string& name, const std::string& unit, double work, int iterations, bool warmup,
+                    Setup setup, Fn fn) {
+    BenchResult result{name, unit, work, {}};
+    if (warmup) {
+        setup();
+        fn();
+    }
+    uint64_t allocations = 0;
+    for (int i = 0; i < iterations; ++i) {
+        setup();
+        const uint64_t allocationsBefore = heapAllocations;
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        const auto end = std::chrono::steady_clock::now();
+        allocations += heapAllocations - allocationsBefore;
+        result.samples.push_back(std::chrono::duration<double>(end - start).count());
+    }
+    result.allocations = static_cast<double>(allocations) / iterations;
+    std::cerr << name << ": " << result.samples.size() << " samples" << std::endl;
+    return result;
+}
+
+// pipeline counters of the sample measured last, its setup must have reset them
+void record_shading(BenchResult& result) {
+#ifdef MINIRENDERER_PROFILE
+    const PipelineCounters counters = Profiler::counters();
+    result.shades = static_cast<double>(counters[Counter::MainPassShades]);
+    result.visible = static_cast<double>(counters[Counter::PixelsVisible]);
+#endif
+}
+
+double percentile(std::vector<double> samples, double p) {
+    if (samples.empty()) return 0.;
+    std::sort(samples.begin(), samples.end());
+    const double rank = p * (samples.size() - 1);
+    const size_t lo = static_cast<size_t>(rank);
+    const size_t hi = std::min(lo + 1, samples.size() - 1);
+    return samples[lo] + (samples[hi] - samples[lo]) * (rank - lo);
+}
+
+Vec4f ndc(float x, float y, float z) {
+    Vec4f ret;
+    ret[0] = x;
+    ret[1] = y;
+    ret[2] = z;
+    ret[3] = 1.f;
+    return ret;
+}
+
+void bench_load(const BenchConfig& config, std::vector<BenchResult>& results) {
+    const std::vector<std::string> objs{
+        "african_head/african_head", "african_head/african_head_eye_inner", "african_head/african_head_eye_outer",
+        "boggie/body",               "boggie/eyes",                         "boggie/head",
+        "diablo3_pose/diablo3_pose", "floor",
+    };
+    for (const std::string& obj : objs) {
+        const std::string filename = config.resourceDir + "/" + obj + ".obj";
+        const double nfaces = static_cast<double>(Mesh(filename).nfaces());
+        results.push_back(measure(
+            "load/" + obj, "faces", nfaces, config.iterations, false, [] {},
+            [&] { benchSink += static_cast<unsigned int>(Mesh(filename).nfaces()); }));
+    }
+}
+
+void bench_texture(const BenchConfig& config, std::vector<BenchResult>& results) {
+    const std::string base = config.resourceDir + "/african_head/african_head";
+    Material raw(base + "_diffuse.tga", base + "_nm_tangent.tga", base + "_spec.tga");
+    Material compressed(base + "_diffuse.tga", base + "_nm_tangent.tga", base + "_spec.tga");
+    compressed.compress();
+    constexpr size_t nfetch = 1 << 20;
+    constexpr size_t span = 64;  // fetches per span, about a triangle row of a close-up
+    std::vector<Vec2f> uvs(nfetch);
+    std::vector<Vec2f> spans(nfetch);
+    XorShift rng(7);
+    for (Vec2f& uv : uvs) uv = Vec2f(rng.next(), rng.next());
+    for (size_t i = 0; i < nfetch; i += span) {
+        const Vec2f start(rng.next() * 0.9f, rng.next() * 0.9f);
+        const Vec2f step = Vec2f(rng.next(), rng.next() - 0.5f) * (1.f / 1024.f);
+        for (size_t j = 0; j < span; ++j) spans[i + j] = start + step * static_cast<float>(j);
+    }
+
+    for (Material* material : {&raw, &compressed}) {
+        const std::string suffix = material->compressed() ? "_bc" : "";
+        for (const std::vector<Vec2f>* fetches : {&uvs, &spans}) {
+            const std::string order = fetches == &uvs ? "" : "_span";
+            BenchResult diffuse = measure("texture/diffuse" + order + suffix, "fetches", nfetch, config.iterations,
+                                          true, [] {}, [&] {
+                                              unsigned int sum = 0;
+                                              for (const Vec2f& uv : *fetches) sum += material->diffuse(uv).val;
+                                              benchSink += sum;
+                                          });
+            BenchResult normal = measure("texture/normal" + order + suffix, "fetches", nfetch, config.iterations,
+                                         true, [] {}, [&] {
+                                             float sum = 0.f;
+                                             for (const Vec2f& uv : *fetches) sum += material->normal(uv).z;
+                                             benchSink += static_cast<unsigned int>(sum);
+                                         });
+            diffuse.textureBytes = normal.textureBytes = static_cast<double>(material->textureBytes());
+            results.push_back(diffuse);
+            results.push_back(normal);
+        }
+    }
+}
+
+void bench_triangles(const BenchConfig& config, std::vector<BenchResult>& results) {
+    constexpr int size = 1024;
+    constexpr size_t ntris = 100000;
+    TGAImage image(size, size, TGAImage::RGB);
+    DepthBuffer zbuffer(size, size);
+    std::vector<Vec4f> pts(ntris * 3);
+    XorShift rng(11);
+    const float radius = 8.f / size;  // a few pixels per triangle, like a dense mesh
+    for (size_t i = 0; i < ntris; ++i) {
+        const float cx = rng.next() * 2.f - 1.f, cy = rng.next() * 2.f - 1.f, cz = rng.next() * 2.f - 1.f;
+        for (size_t j = 0; j < 3; ++j) {
+            const float a = 2.f * PI * (j + rng.next() * 0.5f) / 3.f;
+            pts[i * 3 + j] = ndc(cx + radius * std::cos(a), cy + radius * std::sin(a), cz);
+        }
+    }
+    FlatShader shader;
+    results.push_back(measure(
+        "raster/small_triangles", "triangles", ntris, config.iterations, true,
+        [&] {
+            zbuffer.clear();
+            viewport(0, 0, size, size);
+        },
+        [&] {
+            for (size_t i = 0; i < ntris; ++i) triangle(&pts[i * 3], shader, image, zbuffer);
+        }));
+}
+
+void bench_fill(const BenchConfig& config, std::vector<BenchResult>& results) {
+    constexpr int layers = 4;
+    for (int size : {256, 512, 1024, 2048, -2048}) {
+        // negative: the same fill against a tile compressed depth buffer
+        const bool tiled = size < 0;
+        size = std::abs(size);
+        TGAImage image(size, size, TGAImage::RGB);
+        DepthBuffer zbuffer(size, size, DepthFormat::Float32, tiled);
+        FlatShader shader;
+        results.push_back(measure(
+            "raster/fill_" + std::to_string(size) + (tiled ? "_tiled" : ""), "pixels",
+            static_cast<double>(size) * size * layers,
+            config.iterations, true,
+            [&] {
+                zbuffer.clear();
+                viewport(0, 0, size, size);
+            },
+            [&] {
+                // back to front full screen quads, every layer passes the depth test
+                for (int l = 0; l < layers; ++l) {
+                    const float z = -0.5f + l * 0.25f;
+                    const Vec4f a[3] = {ndc(-1.f, -1.f, z), ndc(1.f, -1.f, z), ndc(1.f, 1.f, z)};
+                    const Vec4f b[3] = {ndc(-1.f, -1.f, z), ndc(1.f, 1.f, z), ndc(-1.f, 1.f, z)};
+                    triangle(a, shader, image, zbuffer);
+                    triangle(b, shader, image, zbuffer);
+                }
+            }));
+    }
+}
+
+double depth_bytes(const Renderer& renderer) {
+    const size_t multisample = renderer.getMultisample() > 1 ? renderer.getMultisampleBuffer().stats().bytes : 0;
+    return static_cast<double>(renderer.getShadowMap().stats().bytes + renderer.getZBuffer().stats().bytes +
+                               multisample);
+}
+
+void bench_scenes(const BenchConfig& config, std::vector<BenchResult>& results) {
+    const Vec3f light_dir{1.f, 1.f, 1.5f};
+    const Camera camera{Vec3f(1.f, 1.f, 4.f), Vec3f(0.f, 0.f, 0.f), Vec3f(0.f, 1.f, 0.f)};
+    Renderer renderer(config.size, config.size);
+    const double pixels = static_cast<double>(config.size) * config.size;
+    for (const std::string& name : scene_names()) {
+        const std::vector<std::string> files = scene_files(config.resourceDir, name);
+        results.push_back(measure("scene/" + name + "/load", "scenes", 1., config.iterations, false, [] {},
+                                  [&] { Scene loaded(files); }));
+
+        Scene scene(files);
+        const std::vector<Model>& models = scene.getModels();
+        const auto uncached = [&] { renderer.invalidateShadowMap(); };
+        const auto redraw = [&] {
+            renderer.invalidateFrame();
+            PROFILE_ONLY(Profiler::reset());
+        };
+        results.push_back(measure("scene/" + name + "/shadow_pass", "pixels", pixels, config.iterations, true,
+                                  uncached, [&] { renderer.shadowPass(models, light_dir, camera); }));
+        results.push_back(measure("scene/" + name + "/main_pass", "pixels", pixels, config.iterations, true, redraw,
+                                  [&] { renderer.mainPass(models, light_dir, camera); }));
+        record_shading(results.back());
+        // models and their face clusters front to back
+        renderer.setDepthSort(true);
+        results.push_back(measure("scene/" + name + "/main_pass_sorted", "pixels", pixels, config.iterations, true,
+                                  redraw, [&] { renderer.mainPass(models, light_dir, camera); }));
+        record_shading(results.back());
+        renderer.setDepthSort(false);
+        renderer.setShadingMode(ShadingMode::Visibility);
+        results.push_back(measure("scene/" + name + "/main_pass_visibility", "pixels", pixels, config.iterations,
+                                  true, redraw, [&] { renderer.mainPass(models, light_dir, camera); }));
+        renderer.setShadingMode(ShadingMode::Forward);
+        // 4 samples per pixel, still shaded once per pixel and triangle
+        renderer.setMultisample(4);
+        results.push_back(measure("scene/" + name + "/main_pass_msaa4", "pixels", pixels, config.iterations, true,
+                                  redraw, [&] { renderer.mainPass(models, light_dir, camera); }));
+        results.back().depthBytes = depth_bytes(renderer);
+        renderer.setMultisample(1);
+        results.push_back(measure(
+            "scene/" + name + "/frame", "frames", 1., config.iterations, true,
+            [&] {
+                uncached();
+                redraw();
+            },
+            [&] { renderer.render(models, light_dir, camera); }));
+        // light and models unchanged since the previous frame, only the main pass runs
+        results.back().depthBytes = depth_bytes(renderer);
+        // unorm16 shadow map and a tile compressed main depth buffer
+        renderer.setShadowMapFormat(DepthFormat::Unorm16);
+        renderer.setDepthFormat(DepthFormat::Float32, true);
+        results.push_back(measure(
+            "scene/" + name + "/frame_compact_depth", "frames", 1., config.iterations, true,
+            [&] {
+                uncached();
+                redraw();
+            },
+            [&] { renderer.render(models, light_dir, camera); }));
+        results.back().depthBytes = depth_bytes(renderer);
+        renderer.setShadowMapFormat(DepthFormat::Float32);
+        renderer.setDepthFormat(DepthFormat::Float32);
+        renderer.render(models, light_dir, camera);
+        results.push_back(measure("scene/" + name + "/frame_cached_shadow", "frames", 1., config.iterations, true,
+                                  redraw, [&] { renderer.render(models, light_dir, camera); }));
+        // nudge the last (smallest in the fixed scenes) model back and forth, only its tiles are redrawn
+        std::vector<Model> edited = models;
+        Matrix4x4 nudge = Matrix4x4::identity();
+        nudge[0][3] = 0.01f;
+        bool nudged = false;
+        results.push_back(measure(
+            "scene/" + name + "/frame_move_one_model", "frames", 1., config.iterations, true,
+            [&] {
+                nudged = !nudged;
+                edited.back().setTransform(nudged ? nudge : Matrix4x4::identity());
+            },
+            [&] { renderer.render(edited, light_dir, camera); }));
+    }
+}
+
+// small heads on a grid of grid x grid, spread over extent (1.8 fills the view), as one Model per copy and as one
+// InstanceBatch per scene model; both draw every head first, then every pair of eyes
+void crowd_grid(Scene& scene, int grid, float extent, std::vector<Model>& crowd, std::vector<InstanceBatch>& batches) {
+    for (size_t k = 0; k < scene.getModels().size(); ++k) {
+        const Model& m = scene.getModels()[k];
+        batches.emplace_back(&scene.getMesh(k), &scene.getMaterial(k));
+        for (int i = 0; i < grid * grid; ++i) {
+            Matrix4x4 t = Matrix4x4::identity();
+            for (size_t k = 0; k < 3; ++k) t[k][k] = 0.05f;
+            t[0][3] = extent * (-0.5f + static_cast<float>(i % grid) / (grid - 1));
+            t[1][3] = extent * (-0.5f + static_cast<float>(i / grid) / (grid - 1));
+            crowd.push_back(m);
+            crowd.back().setTransform(t);
+            batches.back().transforms.push_back(t);
+        }
+    }
+}
+
+// a 16 x 16 grid of small heads, most of their triangles cover less than a pixel at full detail, then a 48 x 48 grid
+// three times as wide as the view, drawn as models and as instances
+void bench_crowd(const BenchConfig& config, std::vector<BenchResult>& results) {
+    const Vec3f light_dir{1.f, 1.f, 1.5f};
+    const Camera camera{Vec3f(1.f, 1.f, 4.f), Vec3f(0.f, 0.f, 0.f), Vec3f(0.f, 1.f, 0.f)};
+    Renderer renderer(config.size, config.size);
+    Scene scene(scene_files(config.resourceDir, "african_head"));
+    std::vector<Model> crowd;
+    std::vector<InstanceBatch> batches;
+    crowd_grid(scene, 16, 1.8f, crowd, batches);
+    const auto faces = [&] {
+        double n = 0.;
+        for (const Model& m : crowd) n += m.getMesh()->nfaces();
+        return n;
+    };
+    const auto uncached = [&] {
+        renderer.invalidateShadowMap();
+        renderer.invalidateFrame();
+    };
+    for (bool lod : {false, true}) {
+        if (lod) renderer.selectLods(crowd, camera);
+        results.push_back(measure(lod ? "crowd/frame_lod" : "crowd/frame", "faces", faces(), config.iterations, true,
+                                  uncached, [&] {
+                                      if (lod) renderer.selectLods(crowd, camera);
+                                      renderer.render(crowd, light_dir, camera);
+                                  }));
+    }
+    for (Model& m : crowd) m.setLod(0);
+    results.push_back(measure("crowd/frame_instanced", "faces", faces(), config.iterations, true, uncached,
+                              [&] { renderer.render({}, light_dir, camera, batches); }));
+
+    crowd.clear();
+    batches.clear();
+    crowd_grid(scene, 48, 5.4f, crowd, batches);
+    results.push_back(measure("crowd/wide_models", "faces", faces(), config.iterations, true, uncached,
+                              [&] { renderer.render(crowd, light_dir, camera); }));
+    results.push_back(measure("crowd/wide_instanced", "faces", faces(), config.iterations, true, uncached,
+                              [&] { renderer.render({}, light_dir, camera, batches); }));
+}
+
+// a chain of joints up the y axis of the mesh, every position weighted between the two joints nearest in height
+void rig_spine(Mesh& mesh, int njoints, Skeleton& skeleton) {
+    float lo = std::numeric_limits<float>::max(), hi = -lo;
+    for (size_t i = 0; i < mesh.nverts(); ++i) {
+        lo = std::min(lo, mesh.vert(i).y);
+        hi = std::max(hi, mesh.vert(i).y);
+    }
+    const float step = (hi - lo) / (njoints - 1);
+    for (int j = 0; j < njoints; ++j) {
+        Matrix4x4 bind = Matrix4x4::identity();
+        bind[1][3] = lo + step * j;
+        skeleton.addJoint(j - 1, bind);
+    }
+    std::vector<SkinWeights> weights(mesh.nverts());  // in file order
+    for (size_t i = 0; i < mesh.nverts(); ++i) {
+        const float y = mesh.vert(mesh.filePositions()[i]).y;
+        const float t = std::min(std::max((y - lo) / step, 0.f), njoints - 1.f);
+        const int j = std::min(static_cast<int>(t), njoints - 2);
+        weights[i] = SkinWeights{{static_cast<uint16_t>(j), static_cast<uint16_t>(j + 1), 0, 0},
+                                 {1.f - (t - j), t - j, 0.f, 0.f}};
+    }
+    mesh.setSkin(weights);
+}
+
+// bend every joint of the chain around z
+void bend(Pose& pose, float angle) {
+    const Skeleton& skeleton = pose.getSkeleton();
+    for (size_t j = 1; j < skeleton.njoints(); ++j) {
+        Matrix4x4 local = skeleton.inverseBind(skeleton.parent(j)) * skeleton.bind(j);
+        Matrix4x4 rotation = Matrix4x4::identity();
+        rotation[0][0] = rotation[1][1] = std::cos(angle);
+        rotation[0][1] = -std::sin(angle);
+        rotation[1][0] = std::sin(angle);
+        pose.setLocal(j, local * rotation);
+    }
+    pose.update();
+}
+
+// diablo3 on a 16 joint spine, skinned alone and drawn with a pose that changes every frame or stays put
+void bench_skinning(const BenchConfig& config, std::vector<BenchResult>& results) {
+    const Vec3f light_dir{1.f, 1.f, 1.5f};
+    const Camera camera{Vec3f(1.f, 1.f, 4.f), Vec3f(0.f, 0.f, 0.f), Vec3f(0.f, 1.f, 0.f)};
+    Scene scene(scene_files(config.resourceDir, "diablo3_pose"));
+    Skeleton skeleton;
+    rig_spine(scene.getMesh(0), 16, skeleton);
+    std::vector<Model> models = scene.getModels();
+    Pose pose(skeleton);
+    models[0].setPose(&pose);
+    const Mesh& mesh = *models[0].getMesh();
+    SkinnedVertices skinned;
+    results.push_back(measure("skinning/diablo3", "vertices", static_cast<double>(mesh.nverts()), config.iterations,
+                              true, [] {}, [&] { skin_vertices(mesh, pose.getPalette(), skinned); }));
+
+    Renderer renderer(config.size, config.size);
+    int frame = 0;
+    results.push_back(measure(
+        "skinning/frame_new_pose", "frames", 1., config.iterations, true, [&] { bend(pose, 0.02f * (++frame % 8)); },
+        [&] { renderer.render(models, light_dir, camera); }));
+    const auto uncached = [&] {
+        renderer.invalidateShadowMap();
+        renderer.invalidateFrame();
+    };
+    results.push_back(measure("skinning/frame_same_pose", "frames", 1., config.iterations, true, uncached,
+                              [&] { renderer.render(models, light_dir, camera); }));
+}
+
+// frames in a loop once the buffers, frame arenas and job pool have grown: full redraws in every shading mode, a
+// moving model, a new pose and a moving instance each frame. None of them may touch the heap, main() fails otherwise.
+void bench_steady_state(const BenchConfig& config, std::vector<BenchResult>& results) {
+    const Vec3f light_dir{1.f, 1.f, 1.5f};
+    const Camera camera{Vec3f(1.f, 1.f, 4.f), Vec3f(0.f, 0.f, 0.f), Vec3f(0.f, 1.f, 0.f)};
+    constexpr int warmupFrames = 4;
+    Scene scene(scene_files(config.resourceDir, "diablo3_pose"));
+    Skeleton skeleton;
+    rig_spine(scene.getMesh(0), 16, skeleton);
+    Pose pose(skeleton);
+    std::vector<Model> models = scene.getModels();
+    std::vector<Model> posed = models;
+    posed[0].setPose(&pose);
+    Renderer renderer(config.size, config.size);
+    const auto uncached = [&] {
+        renderer.invalidateShadowMap();
+        renderer.invalidateFrame();
+    };
+    const auto loop = [&](const std::string& name, const std::vector<Model>& drawn, const auto& setup,
+                          const std::vector<InstanceBatch>& batches = {}) {
+        for (int i = 0; i < warmupFrames; ++i) {
+            setup();
+            renderer.render(drawn, light_dir, camera, batches);
+        }
+        results.push_back(measure("steady_state/" + name, "frames", 1., config.iterations, false, setup,
+                                  [&] { renderer.render(drawn, light_dir, camera, batches); }));
+    };
+    loop("forward", models, uncached);
+    renderer.setShadingMode(ShadingMode::Visibility);
+    loop("visibility", models, uncached);
+    renderer.setShadingMode(ShadingMode::Forward);
+    renderer.setMultisample(4);
+    loop("msaa4", models, uncached);
+    renderer.setMultisample(1);
+    std::vector<Model> edited = models;
+    Matrix4x4 nudge = Matrix4x4::identity();
+    nudge[0][3] = 0.01f;
+    bool nudged = false;
+    loop("move_one_model", edited, [&] {
+        nudged = !nudged;
+        edited.back().setTransform(nudged ? nudge : Matrix4x4::identity());
+    });
+    int frame = 0;
+    loop("new_pose", posed, [&] { bend(pose, 0.02f * (++frame % 8)); });
+    // 3 x 3 copies, the outer ones partly outside the view
+    std::vector<InstanceBatch> batches;
+    for (size_t k = 0; k < models.size(); ++k) {
+        batches.emplace_back(&scene.getMesh(k), &scene.getMaterial(k));
+        for (int i = 0; i < 9; ++i) {
+            Matrix4x4 t = Matrix4x4::identity();
+            for (size_t j = 0; j < 3; ++j) t[j][j] = 0.4f;
+            t[0][3] = 1.2f * (i % 3 - 1);
+            t[1][3] = 1.2f * (i / 3 - 1);
+            batches.back().transforms.push_back(t);
+        }
+    }
+    loop("move_one_instance", {}, [&] {
+        nudged = !nudged;
+        batches[0].transforms[4][0][3] = nudged ? 0.01f : 0.f;
+    }, batches);
+}
+
+// boggie coarse to fine with a camera that moves every frame: time to the first (1/8 size) image, to the final one,
+// and how long render() takes to return when cancel() comes as the full size level starts
+void bench_progressive(const BenchConfig& config, std::vector<BenchResult>& results) {
+    const Vec3f light_dir{1.f, 1.f, 1.5f};
+    Scene scene(scene_files(config.resourceDir, "boggie"));
+    ProgressiveRenderer progressive(config.size, config.size);
+    const auto camera = [](int frame) {
+        return Camera{Vec3f(1.f + 0.01f * frame, 1.f, 4.f), Vec3f(0.f, 0.f, 0.f), Vec3f(0.f, 1.f, 0.f)};
+    };
+    BenchResult first{"progressive/first_image", "frames", 1., {}};
+    BenchResult final{"progressive/final", "frames", 1., {}};
+    BenchResult cancel{"progressive/cancel_latency", "frames", 1., {}};
+    int frame = 0;
+    for (int i = 0; i <= config.iterations; ++i) {  // the first one warms up
+        progressive.render(scene.getModels(), light_dir, camera(++frame));
+        if (!i) continue;
+        first.samples.push_back(progressive.getTimeToFirstImage() / 1e3);
+        final.samples.push_back(progressive.getTimeToFinal() / 1e3);
+    }
+    for (int i = 0; i < config.iterations; ++i) {
+        std::atomic<bool> lastLevel{false};
+        std::thread render([&] {
+            progressive.render(scene.getModels(), light_dir, camera(++frame), [&](int level, const TGAImage&) {
+                if (level + 2 == progressive.getLevels()) lastLevel = true;
+            });
+        });
+        while (!lastLevel) std::this_thread::yield();
+        const auto start = std::chrono::steady_clock::now();
+        progressive.cancel();
+        render.join();
+        cancel.samples.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    for (BenchResult* r : {&first, &final, &cancel}) {
+        std::cerr << r->name << ": " << r->samples.size() << " samples" << std::endl;
+        results.push_back(*r);
+    }
+}
+
+// environment tables from the procedural sky: computed from scratch, read back from the cache file, and the main
+// pass of diablo3_pose shaded with them
+void bench_ibl(const BenchConfig& config, std::vector<BenchResult>& results) {
+    const Vec3f light_dir{1.f, 1.f, 1.5f};
+    const Camera camera{Vec3f(1.f, 1.f, 4.f), Vec3f(0.f, 0.f, 0.f), Vec3f(0.f, 1.f, 0.f)};
+    const TGAImage sky = procedural_environment(light_dir);
+    EnvironmentLighting environment;
+    results.push_back(measure("ibl/precompute", "tables", 1., config.iterations, false, [] {},
+                              [&] { environment.build(sky, ""); }));
+    environment.build(sky, ".");
+    results.push_back(measure("ibl/load_cache", "tables", 1., config.iterations, false, [] {},
+                              [&] { environment.build(sky, "."); }));
+
+    Scene scene(scene_files(config.resourceDir, "diablo3_pose"));
+    Renderer renderer(config.size, config.size);
+    renderer.setEnvironment(&environment);
+    renderer.shadowPass(scene.getModels(), light_dir, camera);
+    results.push_back(measure("ibl/main_pass", "pixels", static_cast<double>(config.size) * config.size,
+                              config.iterations, true, [&] { renderer.invalidateFrame(); },
+                              [&] { renderer.mainPass(scene.getModels(), light_dir, camera); }));
+}
+
+bool write_json(const BenchConfig& config, const std::vector<BenchResult>& results) {
+    std::ofstream out(config.outFile);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << config.outFile << "\n";
+        return false;
+    }
+    out << "{\n";
+    out << "  \"config\": {\"resource\": \"" << config.resourceDir << "\", \"iterations\": " << config.iterations
+        << ", \"size\": " << config.size << ", \"hardware_threads\": " << std::thread::hardware_concurrency()
+        << ", \"job_threads\": " << JobSystem::instance().getThreadCount() << "},\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        const double median = percentile(r.samples, 0.5);
+        out << "    {\"name\": \"" << r.name << "\", \"unit\": \"" << r.unit << "\", \"work\": " << r.work
+            << ", \"median_ms\": " << median * 1e3 << ", \"p10_ms\": " << percentile(r.samples, 0.1) * 1e3
+            << ", \"p90_ms\": " << percentile(r.samples, 0.9) * 1e3
+            << ", \"p99_ms\": " << percentile(r.samples, 0.99) * 1e3
+            << ", \"min_ms\": " << percentile(r.samples, 0.) * 1e3
+            << ", \"max_ms\": " << percentile(r.samples, 1.) * 1e3
+            << ", \"throughput_per_s\": " << (median > 0. ? r.work / median : 0.);
+        if (r.depthBytes > 0.) out << ", \"depth_bytes\": " << r.depthBytes;
+        if (r.textureBytes > 0.) out << ", \"texture_bytes\": " << r.textureBytes;
+        out << ", \"allocations\": " << r.allocations;
+        if (r.visible > 0.) out << ", \"main_pass_shades\": " << r.shades << ", \"overdraw\": " << r.shades / r.visible;
+        out << ", \"samples_ms\": [";
+        for (size_t j = 0; j < r.samples.size(); ++j) out << (j ? ", " : "") << r.samples[j] * 1e3;
+        out << "]}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    return out.good();
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config;
+    const char* usage =
+        "usage: MiniRendererBench [--resource DIR] [--out FILE] [--iterations N] [--size N] [--jobs N]\n";
+    for (int i = 1; i < argc; i += 2) {
+        const std::string arg = argv[i];
+        if (i + 1 == argc) {
+            std::cerr << "missing value for " << arg << "\n" << usage;
+            return 1;
+        }
+        if (arg == "--resource") {
+            config.resourceDir = argv[i + 1];
+        } else if (arg == "--out") {
+            config.outFile = argv[i + 1];
+        } else if (arg == "--iterations") {
+            config.iterations = std::max(1, std::atoi(argv[i + 1]));
+        } else if (arg == "--size") {
+            config.size = std::max(16, std::atoi(argv[i + 1]));
+        } else if (arg == "--jobs") {
+            JobSystem::instance().setThreadCount(std::atoi(argv[i + 1]));
+        } else {
+            std::cerr << "unknown option " << arg << "\n" << usage;
+            return 1;
+        }
+    }
+
+    std::vector<BenchResult> results;
+    bench_load(config, results);
+    bench_texture(config, results);
+    bench_triangles(config, results);
+    bench_fill(config, results);
+    bench_scenes(config, results);
+    bench_crowd(config, results);
+    bench_skinning(config, results);
+    bench_steady_state(config, results);
+    bench_progressive(config, results);
+    bench_ibl(config, results);
+
+    std::cout << std::endl;
+    for (const BenchResult& r : results) {
+        const double median = percentile(r.samples, 0.5);
+        std::cout << r.name << ": median " << median * 1e3 << " ms, p90 " << percentile(r.samples, 0.9) * 1e3
+                  << " ms, " << (median > 0. ? r.work / median : 0.) << " " << r.unit << "/s";
+        if (r.visible > 0.) std::cout << ", overdraw " << r.shades / r.visible;
+        std::cout << std::endl;
+    }
+    JobSystem::instance().printStats(std::cout);
+    FrameArena::printStats(std::cout);
+    bool steady = true;
+    for (const BenchResult& r : results)
+        if (r.name.compare(0, 13, "steady_state/") == 0 && r.allocations > 0.) {
+            std::cerr << r.name << ": " << r.allocations << " heap allocations per frame, expected none" << std::endl;
+            steady = false;
+        }
+    return write_json(config, results) && steady ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+// MiniRendererReplay: rasterizes and shades a frame captured with `MiniRenderer --capture FILE` again, without the
+// scene setup and vertex stage, and checks that the images match the captured ones.
+//
+// usage: MiniRendererReplay CAPTURE [--resource DIR] [--jobs N] [--repeat N] [--out FILE] [--job-stats]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "render/drawCapture.h"
+#include "render/ibl.h"
+#include "render/renderer.h"
+#include "render/scene.h"
+#include "util/jobSystem.h"
+#include "util/profiler.h"
+#include "util/tgaImage.h"
+
+int main(int argc, char** argv) {
+    std::string captureFile;
+    std::string resourceDir;  // empty: the one recorded in the capture
+    std::string outFile;
+    int repeat = 1;
+    bool jobStats = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--resource" && i + 1 < argc) {
+            resourceDir = argv[++i];
+        } else if (arg == "--jobs" && i + 1 < argc) {
+            JobSystem::instance().setThreadCount(std::atoi(argv[++i]));
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--out" && i + 1 < argc) {
+            outFile = argv[++i];
+        } else if (arg == "--job-stats") {
+            jobStats = true;
+        } else if (captureFile.empty() && arg.compare(0, 2, "--") != 0) {
+            captureFile = arg;
+        } else {
+            std::cerr << "unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (captureFile.empty()) {
+        std::cerr << "usage: MiniRendererReplay CAPTURE [--resource DIR] [--jobs N] [--repeat N] [--out FILE] "
+                     "[--job-stats]"
+                  << std::endl;
+        return 1;
+    }
+    DrawCapture capture;
+    if (!capture.read(captureFile)) {
+        std::cerr << "can't read capture " << captureFile << std::endl;
+        return 1;
+    }
+
+    if (resourceDir.empty()) resourceDir = capture.resourceDir;
+    std::vector<std::string> files;
+    for (const std::string& file : capture.modelFiles) files.push_back(resourceDir + "/" + file);
+    Scene scene(files);
+    std::vector<Model>& models = scene.getModels();
+    for (size_t k = 0; k < models.size(); ++k) {
+        if (capture.compressedTextures) scene.getMaterial(k).compress();
+        models[k].setTransform(capture.transforms[k]);
+        models[k].setLod(capture.lods[k]);
+        const Mesh& mesh = *models[k].getMesh();
+        if (mesh.nfaces() != capture.faces[k] || mesh.nverts() != capture.main.vertices[k].size() ||
+            mesh.nverts() != capture.shadow.vertices[k].size()) {
+            std::cerr << files[k] << " does not match the captured mesh" << std::endl;
+            return 1;
+        }
+    }
+    EnvironmentLighting environment;
+    if (capture.environment) {
+        TGAImage env;
+        if (capture.environmentFile.empty()) {
+            env = procedural_environment(capture.lightDir);
+        } else if (!env.read_tga_file(capture.environmentFile.c_str())) {
+            std::cerr << "can't read environment " << capture.environmentFile << std::endl;
+            return 1;
+        }
+        environment.build(env, ".");
+    }
+
+    Renderer renderer(capture.width, capture.height);
+    if (capture.environment) renderer.setEnvironment(&environment);
+    JobSystem::instance().resetStats();
+#ifdef MINIRENDERER_PROFILE
+    Profiler::reset();
+#endif
+    std::vector<double> times;
+    bool match = true;
+    for (int i = 0; i < repeat; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        renderer.replay(models, capture);
+        times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        match = match && image_hash(renderer.getDepthOutput()) == capture.depthOutputHash &&
+                image_hash(renderer.getOutput()) == capture.outputHash;
+    }
+    std::sort(times.begin(), times.end());
+    std::cout << capture.width << "x" << capture.height << ", " << models.size() << " models, "
+              << JobSystem::instance().getThreadCount() << " threads: replay min " << std::fixed
+              << std::setprecision(3) << times.front() << " ms, median " << times[times.size() / 2] << " ms"
+              << std::defaultfloat << std::endl;
+    std::cout << (match ? "images match the capture" : "images differ from the capture") << std::endl;
+
+    if (!outFile.empty()) {
+        TGAImage& output = renderer.getOutput();
+        output.flip_vertically();
+        output.write_tga_file(outFile.c_str());
+    }
+    if (jobStats) JobSystem::instance().printStats(std::cout);
+#ifdef MINIRENDERER_PROFILE
+    Profiler::printSummary(std::cout);
+    Profiler::writeChromeTrace("trace.json");
+#endif
+    return match ? 0 : 1;
+}